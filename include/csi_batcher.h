@@ -0,0 +1,201 @@
+//
+// collects measurements into CsiBatch messages, published when full or when the oldest entry has waited
+// for the batch window
+//
+
+#ifndef WIROS_CSI_BATCHER_H
+#define WIROS_CSI_BATCHER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ros/ros.h>
+#include "csi_parser.h"
+
+//published messages kept per batch for reuse
+#define CSI_BATCH_SPARES 4
+
+struct csi_batch_config {
+  //entries per batch
+  size_t max_count = 64;
+  //longest an entry waits to be published, in seconds
+  double window = 0.05;
+};
+
+//one batch is open per topic and receiver. adding to a full batch publishes it on the calling thread,
+//and a flush thread publishes batches whose window has run out, so no entry waits longer than the window
+//even when the stream stops. published messages are reused once roscpp lets go of them, keeping the
+//capacity of their arrays, so a steady stream publishes without allocating. safe to call from several
+//threads, batches are published outside the lock.
+class csi_batcher
+{
+public:
+  explicit csi_batcher(const csi_batch_config &c) : cfg(c), n_batches(0), n_entries(0), stopping(false){
+    if(cfg.max_count < 1) cfg.max_count = 1;
+    window_ns = (int64_t)(cfg.window * 1e9);
+    if(window_ns < 1000000) window_ns = 1000000;
+    flush_thread = std::thread(&csi_batcher::flush_loop, this);
+  }
+  ~csi_batcher(){
+    close();
+  }
+
+  //adds a measurement to the batch for pub and rx_id
+  void add(const ros::Publisher &pub, const std::string &rx_id, const std::vector<csi_instance> &group){
+    wiros_csi_node::CsiBatchPtr full;
+    ros::Publisher full_pub;
+    {
+      std::lock_guard<std::mutex> lk(lock);
+      if(stopping) return;
+      batch &b = find(pub, rx_id);
+      if(!b.msg){
+        b.msg = take(b);
+        b.msg->rx_id = rx_id;
+        b.deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(window_ns);
+        //the flush thread may be sleeping until a later deadline, or without one
+        wake.notify_all();
+      }
+      csi_append_batch(group, *b.msg);
+      ++n_entries;
+      if(b.msg->stamp.size() >= cfg.max_count){
+        full = b.msg;
+        full_pub = b.pub;
+        b.msg.reset();
+        ++n_batches;
+      }
+    }
+    if(full) send(full_pub, full);
+  }
+
+  //publishes what is left and stops the flush thread
+  void close(){
+    {
+      std::lock_guard<std::mutex> lk(lock);
+      if(stopping) return;
+      stopping = true;
+    }
+    wake.notify_all();
+    if(flush_thread.joinable()) flush_thread.join();
+    std::vector<std::pair<ros::Publisher, wiros_csi_node::CsiBatchPtr> > out;
+    {
+      std::lock_guard<std::mutex> lk(lock);
+      for(size_t i = 0; i < batches.size(); ++i){
+        if(!batches[i].msg) continue;
+        out.push_back(std::make_pair(batches[i].pub, batches[i].msg));
+        batches[i].msg.reset();
+        ++n_batches;
+      }
+    }
+    for(size_t i = 0; i < out.size(); ++i) send(out[i].first, out[i].second);
+  }
+
+  uint64_t batches_published(){
+    std::lock_guard<std::mutex> lk(lock);
+    return n_batches;
+  }
+  uint64_t entries(){
+    std::lock_guard<std::mutex> lk(lock);
+    return n_entries;
+  }
+
+private:
+  csi_batcher(const csi_batcher&);
+  csi_batcher& operator=(const csi_batcher&);
+
+  struct batch {
+    ros::Publisher pub;
+    std::string rx_id;
+    //the open batch, NULL if there is none
+    wiros_csi_node::CsiBatchPtr msg;
+    std::chrono::steady_clock::time_point deadline;
+    //messages published earlier, to fill again once nobody else holds them
+    std::vector<wiros_csi_node::CsiBatchPtr> spares;
+  };
+
+  //called with lock held. there are only as many batches as topics and receivers, so a linear search
+  //beats building a key for every measurement
+  batch& find(const ros::Publisher &pub, const std::string &rx_id){
+    for(size_t i = 0; i < batches.size(); ++i){
+      if(batches[i].pub == pub && batches[i].rx_id == rx_id) return batches[i];
+    }
+    batches.emplace_back();
+    batches.back().pub = pub;
+    batches.back().rx_id = rx_id;
+    return batches.back();
+  }
+
+  //an empty message for b, reusing a published one roscpp has released. called with lock held
+  wiros_csi_node::CsiBatchPtr take(batch &b){
+    for(size_t i = 0; i < b.spares.size(); ++i){
+      //only the spares list holds it, so no subscriber can still be reading it
+      if(b.spares[i].use_count() != 1) continue;
+      wiros_csi_node::CsiBatchPtr m = b.spares[i];
+      m->stamp.clear();
+      m->txmac.clear();
+      m->chan.clear();
+      m->bw.clear();
+      m->n_sub.clear();
+      m->seq_num.clear();
+      m->fc.clear();
+      m->rssi.clear();
+      m->chain_mask.clear();
+      m->csi_offset.clear();
+      m->csi.clear();
+      return m;
+    }
+    wiros_csi_node::CsiBatchPtr m = boost::make_shared<wiros_csi_node::CsiBatch>();
+    if(b.spares.size() < CSI_BATCH_SPARES) b.spares.push_back(m);
+    return m;
+  }
+
+  void send(const ros::Publisher &pub, const wiros_csi_node::CsiBatchPtr &msg){
+    msg->header.stamp = ros::Time::now();
+    pub.publish(msg);
+  }
+
+  void flush_loop(){
+    std::vector<std::pair<ros::Publisher, wiros_csi_node::CsiBatchPtr> > due;
+    std::unique_lock<std::mutex> lk(lock);
+    while(!stopping){
+      auto now = std::chrono::steady_clock::now();
+      auto next = now + std::chrono::hours(1);
+      for(size_t i = 0; i < batches.size(); ++i){
+        batch &b = batches[i];
+        if(!b.msg) continue;
+        if(b.deadline <= now){
+          due.push_back(std::make_pair(b.pub, b.msg));
+          b.msg.reset();
+          ++n_batches;
+        }
+        else if(b.deadline < next){
+          next = b.deadline;
+        }
+      }
+      if(!due.empty()){
+        lk.unlock();
+        for(size_t i = 0; i < due.size(); ++i) send(due[i].first, due[i].second);
+        due.clear();
+        lk.lock();
+        continue;
+      }
+      wake.wait_until(lk, next);
+    }
+  }
+
+  csi_batch_config cfg;
+  int64_t window_ns;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::vector<batch> batches;
+  uint64_t n_batches;
+  uint64_t n_entries;
+  bool stopping;
+  std::thread flush_thread;
+};
+
+#endif
@@ -0,0 +1,123 @@
+//
+// classic BPF socket filters that drop CSI from unwanted transmitters in the kernel
+//
+
+#ifndef WIROS_CSI_BPF_H
+#define WIROS_CSI_BPF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <algorithm>
+#include <vector>
+#include "csi_parser.h"
+#include "csi_mac_table.h"
+
+//source MAC offset from the start of the udp header. a udp socket filter sees the udp header first
+#define CSI_BPF_MAC_OFFSET (8 + offsetof(csi_udp_frame, src_mac))
+//a packet socket filter sees the ethernet header first
+#define CSI_BPF_ETH_HLEN 14
+//each entry takes at most 5 instructions, this keeps the program well under BPF_MAXINSNS
+#define CSI_BPF_MAX_ENTRIES 256
+
+//program that keeps or drops datagrams the way the table does. entries are tried longest prefix first,
+//so the first match is the most specific one. each prefix is compared with 4, 2 and 1 byte loads, which
+//are big endian like the MAC. datagrams too short to hold the MAC fail the load and are dropped too.
+//the udp header is at base, or at base + X if indexed.
+inline std::vector<struct sock_filter> csi_bpf_mac_program(const csi_mac_table &table, uint32_t base = 0, bool indexed = false){
+  std::vector<size_t> order(table.size());
+  for(size_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){
+    return table.rule(a).prefix.len > table.rule(b).prefix.len;
+  });
+
+  std::vector<struct sock_filter> prog;
+  for(size_t p = 0; p < order.size(); ++p){
+    const csi_mac_rule &r = table.rule(order[p]);
+    size_t len = r.prefix.len;
+    std::vector<size_t> jumps;
+    for(size_t i = 0; i < len;){
+      size_t n = len - i >= 4 ? 4 : len - i >= 2 ? 2 : 1;
+      uint32_t v = 0;
+      for(size_t b = 0; b < n; ++b) v = v << 8 | r.prefix.mac[i + b];
+      uint16_t size = n == 4 ? BPF_W : n == 2 ? BPF_H : BPF_B;
+      struct sock_filter ld = BPF_STMT(BPF_LD | size | (indexed ? BPF_IND : BPF_ABS), (uint32_t)(base + CSI_BPF_MAC_OFFSET + i));
+      struct sock_filter jeq = BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, v, 0, 0);
+      prog.push_back(ld);
+      jumps.push_back(prog.size());
+      prog.push_back(jeq);
+      i += n;
+    }
+    struct sock_filter ret = BPF_STMT(BPF_RET | BPF_K, r.deny ? 0 : 0xffffffff);
+    prog.push_back(ret);
+    //a mismatch skips to the next entry, right after this one's return
+    for(size_t j = 0; j < jumps.size(); ++j) prog[jumps[j]].jf = prog.size() - jumps[j] - 1;
+  }
+  struct sock_filter fallback = BPF_STMT(BPF_RET | BPF_K, table.allow_count() ? 0 : 0xffffffff);
+  prog.push_back(fallback);
+  return prog;
+}
+
+//attaches a filter for the table to a udp socket, or removes the filter if the table keeps everything.
+//attaching replaces any previous filter in one step, so no datagram sees a half-updated filter.
+//returns false and sets errno if the kernel refused it.
+inline bool csi_bpf_attach(int fd, const csi_mac_table &table){
+  if(table.accepts_all()){
+    //the value is ignored, but setsockopt rejects anything shorter than an int
+    int unused = 0;
+    if(setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused)) < 0 && errno != ENOENT) return false;
+    return true;
+  }
+  if(table.size() > CSI_BPF_MAX_ENTRIES){
+    errno = E2BIG;
+    return false;
+  }
+  std::vector<struct sock_filter> prog = csi_bpf_mac_program(table);
+  struct sock_fprog fprog;
+  fprog.len = prog.size();
+  fprog.filter = prog.data();
+  return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == 0;
+}
+
+//program for a packet socket that keeps incoming ipv4 udp packets to port, then applies the table.
+//X is loaded with the ip header length so the table's loads can find the udp header
+inline std::vector<struct sock_filter> csi_bpf_packet_program(const csi_mac_table &table, uint16_t port){
+  std::vector<struct sock_filter> prog = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_PKTTYPE)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 9, 0),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0800, 0, 7),
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, CSI_BPF_ETH_HLEN + 9),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 5),
+    //later fragments have no udp header
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, CSI_BPF_ETH_HLEN + 6),
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 3, 0),
+    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, CSI_BPF_ETH_HLEN),
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, CSI_BPF_ETH_HLEN + 2),
+    //every failed check above lands on this drop, the table's program follows it
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+  };
+  std::vector<struct sock_filter> mac = csi_bpf_mac_program(table, CSI_BPF_ETH_HLEN, true);
+  prog.insert(prog.end(), mac.begin(), mac.end());
+  return prog;
+}
+
+//attaches the port and table filter to a packet socket, replacing any previous one in one step
+inline bool csi_bpf_attach_packet(int fd, const csi_mac_table &table, uint16_t port){
+  if(table.size() > CSI_BPF_MAX_ENTRIES){
+    errno = E2BIG;
+    return false;
+  }
+  std::vector<struct sock_filter> prog = csi_bpf_packet_program(table, port);
+  struct sock_fprog fprog;
+  fprog.len = prog.size();
+  fprog.filter = prog.data();
+  return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == 0;
+}
+
+#endif
@@ -0,0 +1,152 @@
+//
+// indexing of CSI in pcap captures for the offline tools, which decode it in parallel
+//
+
+#ifndef WIROS_CSI_CAPTURE_H
+#define WIROS_CSI_CAPTURE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <ros/ros.h>
+#include "pcap_stream.h"
+#include "csi_parser.h"
+#include "csi_reassembly.h"
+#include "utils.h"
+
+//records per unit of work. chunks hold whole measurements, so this is a lower bound
+#define CHUNK_RECORDS 1024
+
+//a CSI frame found while indexing a capture, with the header fields it is grouped by
+struct csi_record {
+  const unsigned char* payload;
+  uint32_t len;
+  uint8_t source_mac[6];
+  uint16_t seq;
+  uint8_t tx;
+  uint8_t rx;
+  ros::Time stamp;
+};
+
+//grouping of frames into measurements, the node's reassembly_groups and reassembly_timeout_ms
+struct csi_grouping {
+  size_t max_groups = 64;
+  double timeout_ms = 10.0;
+};
+
+struct mapped_file {
+  const unsigned char* data;
+  size_t len;
+};
+
+inline bool map_file(const char* path, mapped_file &m){
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return false;
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size == 0){
+    close(fd);
+    return false;
+  }
+  void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED) return false;
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+  m.data = static_cast<const unsigned char*>(p);
+  m.len = st.st_size;
+  return true;
+}
+
+inline void unmap_file(mapped_file &m){
+  munmap(const_cast<unsigned char*>(m.data), m.len);
+}
+
+//walks the record headers of one capture and appends every valid CSI frame. frames that the node would
+//discard (not CSI, bad bandwidth, truncated, filtered) are counted and left out, so they can't affect grouping
+inline bool index_capture(const mapped_file &f, const csi_parser &parser, const mac_filter &filter,
+                          std::vector<csi_record> &out, size_t &skipped){
+  pcap_format fmt;
+  if(f.len < PCAP_GLOBAL_HDR || !pcap_parse_global(f.data, fmt)) return false;
+  size_t pos = PCAP_GLOBAL_HDR;
+  pcap_record rec;
+  while(pos + PCAP_RECORD_HDR <= f.len){
+    if(!pcap_parse_record(fmt, f.data + pos, rec)){
+      fprintf(stderr, "corrupt record at byte %lu, ignoring the rest of the file\n", pos);
+      break;
+    }
+    pos += PCAP_RECORD_HDR + rec.caplen;
+    //the capture was cut off mid-record
+    if(pos > f.len) break;
+
+    const unsigned char* payload;
+    size_t len;
+    uint8_t bw_code;
+    if(!pcap_udp_payload(fmt.link, rec.data, rec.caplen, &payload, &len) ||
+       parser.check(payload, len, bw_code) != CSI_FRAME_OK){
+      ++skipped;
+      continue;
+    }
+    const csi_udp_frame* hdr = reinterpret_cast<const csi_udp_frame*>(payload);
+    if(!mac_cmp(hdr->src_mac, filter)){
+      ++skipped;
+      continue;
+    }
+    csi_record r;
+    r.payload = payload;
+    r.len = len;
+    memcpy(r.source_mac, hdr->src_mac, 6);
+    r.seq = hdr->seqCnt;
+    r.tx = (hdr->csiconf >> 11) & 0x3;
+    r.rx = (hdr->csiconf >> 8) & 0x3;
+    r.stamp = ros::Time(rec.ts_sec, rec.ts_nsec);
+    out.push_back(r);
+  }
+  return true;
+}
+
+//groups records [begin, end) of one capture into measurements with the node's reassembler, clocked by the
+//capture timestamps, so the offline tools publish the measurements csi_node would. the records are
+//reordered so each measurement's frames are adjacent, in the order the node emits them, and the index of
+//every measurement's first record is appended to starts. returns the measurements missing chains
+inline size_t group_capture(std::vector<csi_record> &records, size_t begin, size_t end, const csi_grouping &g,
+                            std::vector<size_t> &starts){
+  csi_reassembler_t<csi_record> reasm(g.max_groups, (uint64_t)(g.timeout_ms * 1e6));
+  std::vector<csi_record> out;
+  out.reserve(end - begin);
+  auto emit = [&](std::vector<csi_record> &frames, bool complete){
+    starts.push_back(begin + out.size());
+    out.insert(out.end(), frames.begin(), frames.end());
+  };
+  for(size_t i = begin; i < end; ++i) reasm.add(records[i], records[i].stamp.toNSec(), emit);
+  reasm.flush(emit);
+  std::copy(out.begin(), out.end(), records.begin() + begin);
+  return reasm.incomplete();
+}
+
+//the end of measurement i, see group_capture
+inline size_t group_end(const std::vector<size_t> &starts, size_t n_records, size_t i){
+  return i + 1 < starts.size() ? starts[i + 1] : n_records;
+}
+
+//splits measurements [begin, end) into [start, stop) chunks of at least CHUNK_RECORDS records, which can
+//be decoded independently
+inline void split_chunks(const std::vector<size_t> &starts, size_t n_records, size_t begin, size_t end,
+                         std::vector<std::pair<size_t, size_t> > &out){
+  size_t start = begin;
+  while(start < end){
+    size_t stop = start;
+    while(stop < end && group_end(starts, n_records, stop) - starts[start] < CHUNK_RECORDS) ++stop;
+    if(stop < end) ++stop;
+    out.push_back(std::make_pair(start, stop));
+    start = stop;
+  }
+}
+
+#endif
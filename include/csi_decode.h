@@ -0,0 +1,391 @@
+#ifndef CSI_DECODE_H
+#define CSI_DECODE_H
+
+//decoders for the packed nexmon CSI words. each 32-bit word holds a shared 6-bit exponent and
+//sign + 11-bit mantissa for the real and imaginary parts, which are unpacked into IEEE doubles.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CSI_DECODE_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define CSI_DECODE_NEON
+#endif
+
+//111111 - exponent of
+const uint32_t e_mask = (1<<6)-1;
+//111111111111
+const uint32_t mantissa_mask = (1<<12)-1;
+//1
+const uint32_t sign_mask = 1;
+//111111111111000000
+const uint32_t r_mant_mask = (((1<<11) - 1) << 18);
+//same for imag
+const uint32_t i_mant_mask = (((1<<11) - 1) << 6);
+//
+const uint32_t r_sign_mask = (1<<29);
+const uint32_t i_sign_mask = (1<<17);
+
+const uint32_t count_mask = (1<<10);
+const uint32_t mant_mask = (1<<10)-1;
+
+//decodes n words from csi into doubles in csi_r/csi_i
+typedef void (*csi_decode_fn)(const uint32_t* csi, double* csi_r, double* csi_i, size_t n);
+
+//decodes and fft-shifts one whole frame, the size is fixed by the bandwidth the function was built for
+typedef void (*csi_frame_fn)(const uint32_t* csi, double* csi_r, double* csi_i);
+
+//per-bandwidth constants, indexed by the bandwidth bits of the chanspec ((chanspec >> 11) & 7)
+const uint8_t csi_bw_mhz[8] = {0, 0, 20, 40, 80, 160, 0, 0};
+const uint16_t csi_bw_nsub[8] = {0, 0, 64, 128, 256, 512, 0, 0};
+#define CSI_MAX_NSUB 512
+
+//number of subcarriers nexmon reports at a bandwidth, 3.2 per MHz
+template<int BW>
+struct csi_bw
+{
+  static_assert(BW == 20 || BW == 40 || BW == 80 || BW == 160, "unsupported bandwidth");
+  static constexpr size_t n_sub = BW * 16 / 5;
+  static constexpr size_t half = n_sub / 2;
+};
+
+//high 32 bits of the decoded double for every possible 11-bit mantissa, generated at compile time
+//by running the reference shift loop. (exp << 20 & exp_mask) + hi gives exponent and mantissa bits,
+//exp_mask is 0 for the e_shift == 10 case so the exponent is forced to 1023.
+struct csi_mant_entry
+{
+  uint32_t exp_mask;
+  uint32_t hi;
+};
+
+struct csi_mant_table
+{
+  csi_mant_entry e[1<<11];
+  constexpr csi_mant_table() : e(){
+	for(uint32_t m = 0; m < (1<<11); ++m){
+	  uint32_t mant = m;
+	  uint32_t e_shift = 0;
+	  bool zero = false;
+	  while(!(mant & count_mask)){
+		mant *= 2;
+		e_shift += 1;
+		if(e_shift == 10){
+		  zero = true;
+		  break;
+		}
+	  }
+	  e[m].exp_mask = zero ? 0 : ~(uint32_t)0;
+	  e[m].hi = zero ? (1023u << 20) : ((mant & mant_mask) << 10) - (e_shift << 20);
+	}
+  }
+};
+
+constexpr csi_mant_table csi_mant_lut;
+
+//reference decoder, one word at a time
+inline void csi_decode_scalar(const uint32_t* csi, double* csi_r, double* csi_i, size_t n){
+  uint64_t* c_r_buf = reinterpret_cast<uint64_t*>(csi_r);
+  uint64_t* c_i_buf = reinterpret_cast<uint64_t*>(csi_i);
+  uint64_t c_r, c_i;
+  for(size_t i = 0; i < n; ++i){
+
+	uint32_t c = (uint64_t)csi[i];
+	c_r=0;
+	c_i=0;
+	uint32_t exp = ((int32_t)(c & e_mask) - 31 + 1023);
+	uint32_t r_exp = exp;
+	uint32_t i_exp = exp;
+
+	uint32_t r_mant = (c&r_mant_mask) >> 18;
+	uint32_t i_mant = (c&i_mant_mask) >> 6;
+
+	//construct real mantissa
+	uint32_t e_shift = 0;
+	while(!(r_mant & count_mask)){
+	  r_mant *= 2;
+	  e_shift += 1;
+	  if(e_shift == 10){
+		r_exp = 1023;
+		e_shift = 0;
+		r_mant = 0;
+		break;
+	  }
+	}
+	r_exp -= e_shift;
+
+	//construct imaginary mantissa
+	e_shift = 0;
+	while(!(i_mant & count_mask)){
+	  i_mant *= 2;
+	  e_shift += 1;
+	  if(e_shift == 10){
+		i_exp = 1023;
+		e_shift = 0;
+		i_mant = 0;
+		break;
+	  }
+	}
+	i_exp -= e_shift;
+
+	//construct doubles
+	c_r |= (uint64_t)(c & r_sign_mask) << 34;
+	c_i |= (uint64_t)(c & i_sign_mask) << 46;
+
+	c_r |= ((uint64_t)(r_mant & mant_mask)) << 42;
+	c_i |= ((uint64_t)(i_mant & mant_mask)) << 42;
+
+	c_r |= ((uint64_t)r_exp)<<52;
+	c_i |= ((uint64_t)i_exp)<<52;
+
+	//place doubles
+	c_r_buf[i] = c_r;
+	c_i_buf[i] = c_i;
+  }
+}
+
+//The vector decoders below produce the same bits as csi_decode_scalar without the shift loops.
+//The low 32 bits of every decoded double are zero, so only the high word is computed:
+//  sign << 31 | exponent << 20 | 10-bit mantissa << 10
+//Converting the 11-bit mantissa m to float normalizes it in hardware: for m >= 2 with leading bit p,
+//the float's exponent field is 127 + p, and its fraction field shifted down by 13 is exactly the
+//mantissa the shift loop would produce, with the double's exponent being e - 31 + 1023 - (10 - p).
+//m < 2 is the shift loop's e_shift == 10 case, which yields exponent 1023 and a zero mantissa.
+
+#ifdef CSI_DECODE_X86
+
+__attribute__((target("sse4.1")))
+inline __m128i csi_hi_word_sse(__m128i e, __m128i m, __m128i sign){
+  __m128i fb = _mm_castps_si128(_mm_cvtepi32_ps(m));
+  __m128i exp = _mm_add_epi32(_mm_add_epi32(e, _mm_srli_epi32(fb, 23)), _mm_set1_epi32(1023 - 31 - 10 - 127));
+  __m128i mant = _mm_and_si128(_mm_srli_epi32(fb, 13), _mm_set1_epi32(mant_mask));
+  __m128i hi = _mm_or_si128(_mm_slli_epi32(exp, 20), _mm_slli_epi32(mant, 10));
+  __m128i zero = _mm_cmplt_epi32(m, _mm_set1_epi32(2));
+  hi = _mm_blendv_epi8(hi, _mm_set1_epi32(1023 << 20), zero);
+  return _mm_or_si128(hi, sign);
+}
+
+__attribute__((target("sse4.1")))
+inline void csi_store_hi_sse(double* out, __m128i hi){
+  _mm_storeu_si128((__m128i*)out, _mm_slli_epi64(_mm_cvtepu32_epi64(hi), 32));
+  _mm_storeu_si128((__m128i*)(out + 2), _mm_slli_epi64(_mm_cvtepu32_epi64(_mm_srli_si128(hi, 8)), 32));
+}
+
+__attribute__((target("sse4.1")))
+inline void csi_decode_sse41(const uint32_t* csi, double* csi_r, double* csi_i, size_t n){
+  const __m128i m11 = _mm_set1_epi32((1<<11) - 1);
+  const __m128i em = _mm_set1_epi32(e_mask);
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4){
+	__m128i c = _mm_loadu_si128((const __m128i*)(csi + i));
+	__m128i e = _mm_and_si128(c, em);
+	__m128i r_mant = _mm_and_si128(_mm_srli_epi32(c, 18), m11);
+	__m128i i_mant = _mm_and_si128(_mm_srli_epi32(c, 6), m11);
+	__m128i r_sign = _mm_slli_epi32(_mm_and_si128(c, _mm_set1_epi32(r_sign_mask)), 2);
+	__m128i i_sign = _mm_slli_epi32(_mm_and_si128(c, _mm_set1_epi32(i_sign_mask)), 14);
+	csi_store_hi_sse(csi_r + i, csi_hi_word_sse(e, r_mant, r_sign));
+	csi_store_hi_sse(csi_i + i, csi_hi_word_sse(e, i_mant, i_sign));
+  }
+  csi_decode_scalar(csi + i, csi_r + i, csi_i + i, n - i);
+}
+
+__attribute__((target("avx2")))
+inline __m256i csi_hi_word_avx2(__m256i e, __m256i m, __m256i sign){
+  __m256i fb = _mm256_castps_si256(_mm256_cvtepi32_ps(m));
+  __m256i exp = _mm256_add_epi32(_mm256_add_epi32(e, _mm256_srli_epi32(fb, 23)), _mm256_set1_epi32(1023 - 31 - 10 - 127));
+  __m256i mant = _mm256_and_si256(_mm256_srli_epi32(fb, 13), _mm256_set1_epi32(mant_mask));
+  __m256i hi = _mm256_or_si256(_mm256_slli_epi32(exp, 20), _mm256_slli_epi32(mant, 10));
+  __m256i zero = _mm256_cmpgt_epi32(_mm256_set1_epi32(2), m);
+  hi = _mm256_blendv_epi8(hi, _mm256_set1_epi32(1023 << 20), zero);
+  return _mm256_or_si256(hi, sign);
+}
+
+__attribute__((target("avx2")))
+inline void csi_store_hi_avx2(double* out, __m256i hi){
+  _mm256_storeu_si256((__m256i*)out, _mm256_slli_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(hi)), 32));
+  _mm256_storeu_si256((__m256i*)(out + 4), _mm256_slli_epi64(_mm256_cvtepu32_epi64(_mm256_extracti128_si256(hi, 1)), 32));
+}
+
+__attribute__((target("avx2")))
+inline void csi_decode_avx2(const uint32_t* csi, double* csi_r, double* csi_i, size_t n){
+  const __m256i m11 = _mm256_set1_epi32((1<<11) - 1);
+  const __m256i em = _mm256_set1_epi32(e_mask);
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8){
+	__m256i c = _mm256_loadu_si256((const __m256i*)(csi + i));
+	__m256i e = _mm256_and_si256(c, em);
+	__m256i r_mant = _mm256_and_si256(_mm256_srli_epi32(c, 18), m11);
+	__m256i i_mant = _mm256_and_si256(_mm256_srli_epi32(c, 6), m11);
+	__m256i r_sign = _mm256_slli_epi32(_mm256_and_si256(c, _mm256_set1_epi32(r_sign_mask)), 2);
+	__m256i i_sign = _mm256_slli_epi32(_mm256_and_si256(c, _mm256_set1_epi32(i_sign_mask)), 14);
+	csi_store_hi_avx2(csi_r + i, csi_hi_word_avx2(e, r_mant, r_sign));
+	csi_store_hi_avx2(csi_i + i, csi_hi_word_avx2(e, i_mant, i_sign));
+  }
+  csi_decode_scalar(csi + i, csi_r + i, csi_i + i, n - i);
+}
+
+#endif
+
+#ifdef CSI_DECODE_NEON
+
+inline uint32x4_t csi_hi_word_neon(uint32x4_t e, uint32x4_t m, uint32x4_t sign){
+  uint32x4_t fb = vreinterpretq_u32_f32(vcvtq_f32_u32(m));
+  uint32x4_t exp = vaddq_u32(vaddq_u32(e, vshrq_n_u32(fb, 23)), vdupq_n_u32(1023 - 31 - 10 - 127));
+  uint32x4_t mant = vandq_u32(vshrq_n_u32(fb, 13), vdupq_n_u32(mant_mask));
+  uint32x4_t hi = vorrq_u32(vshlq_n_u32(exp, 20), vshlq_n_u32(mant, 10));
+  uint32x4_t zero = vcltq_u32(m, vdupq_n_u32(2));
+  hi = vbslq_u32(zero, vdupq_n_u32(1023 << 20), hi);
+  return vorrq_u32(hi, sign);
+}
+
+inline void csi_store_hi_neon(double* out, uint32x4_t hi){
+  //interleaving zeros below each high word gives the little-endian doubles
+  uint32x4_t z = vdupq_n_u32(0);
+  vst1q_u32((uint32_t*)out, vzip1q_u32(z, hi));
+  vst1q_u32((uint32_t*)(out + 2), vzip2q_u32(z, hi));
+}
+
+inline void csi_decode_neon(const uint32_t* csi, double* csi_r, double* csi_i, size_t n){
+  const uint32x4_t m11 = vdupq_n_u32((1<<11) - 1);
+  const uint32x4_t em = vdupq_n_u32(e_mask);
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4){
+	uint32x4_t c = vld1q_u32(csi + i);
+	uint32x4_t e = vandq_u32(c, em);
+	uint32x4_t r_mant = vandq_u32(vshrq_n_u32(c, 18), m11);
+	uint32x4_t i_mant = vandq_u32(vshrq_n_u32(c, 6), m11);
+	uint32x4_t r_sign = vshlq_n_u32(vandq_u32(c, vdupq_n_u32(r_sign_mask)), 2);
+	uint32x4_t i_sign = vshlq_n_u32(vandq_u32(c, vdupq_n_u32(i_sign_mask)), 14);
+	csi_store_hi_neon(csi_r + i, csi_hi_word_neon(e, r_mant, r_sign));
+	csi_store_hi_neon(csi_i + i, csi_hi_word_neon(e, i_mant, i_sign));
+  }
+  csi_decode_scalar(csi + i, csi_r + i, csi_i + i, n - i);
+}
+
+#endif
+
+//branch-free scalar decoder using the compile-time mantissa table
+inline void csi_decode_lut(const uint32_t* csi, double* csi_r, double* csi_i, size_t n){
+  uint64_t* c_r_buf = reinterpret_cast<uint64_t*>(csi_r);
+  uint64_t* c_i_buf = reinterpret_cast<uint64_t*>(csi_i);
+  for(size_t i = 0; i < n; ++i){
+	uint32_t c = csi[i];
+	uint32_t exp = ((c & e_mask) - 31 + 1023) << 20;
+	const csi_mant_entry &r = csi_mant_lut.e[(c & r_mant_mask) >> 18];
+	const csi_mant_entry &im = csi_mant_lut.e[(c & i_mant_mask) >> 6];
+	uint32_t r_hi = ((exp & r.exp_mask) + r.hi) | ((c & r_sign_mask) << 2);
+	uint32_t i_hi = ((exp & im.exp_mask) + im.hi) | ((c & i_sign_mask) << 14);
+	c_r_buf[i] = (uint64_t)r_hi << 32;
+	c_i_buf[i] = (uint64_t)i_hi << 32;
+  }
+}
+
+//Per-bandwidth frame kernels. The fft-shift is folded into the decode by writing the first half of
+//the subcarriers to the second half of the output and vice versa, and with the size known at compile
+//time the word loops have constant trip counts the compiler can unroll.
+
+template<int BW>
+inline void csi_frame_lut(const uint32_t* csi, double* csi_r, double* csi_i){
+  csi_decode_lut(csi, csi_r + csi_bw<BW>::half, csi_i + csi_bw<BW>::half, csi_bw<BW>::half);
+  csi_decode_lut(csi + csi_bw<BW>::half, csi_r, csi_i, csi_bw<BW>::half);
+}
+
+#ifdef CSI_DECODE_X86
+template<int BW>
+__attribute__((target("sse4.1")))
+inline void csi_frame_sse41(const uint32_t* csi, double* csi_r, double* csi_i){
+  csi_decode_sse41(csi, csi_r + csi_bw<BW>::half, csi_i + csi_bw<BW>::half, csi_bw<BW>::half);
+  csi_decode_sse41(csi + csi_bw<BW>::half, csi_r, csi_i, csi_bw<BW>::half);
+}
+
+template<int BW>
+__attribute__((target("avx2")))
+inline void csi_frame_avx2(const uint32_t* csi, double* csi_r, double* csi_i){
+  csi_decode_avx2(csi, csi_r + csi_bw<BW>::half, csi_i + csi_bw<BW>::half, csi_bw<BW>::half);
+  csi_decode_avx2(csi + csi_bw<BW>::half, csi_r, csi_i, csi_bw<BW>::half);
+}
+#endif
+
+#ifdef CSI_DECODE_NEON
+template<int BW>
+inline void csi_frame_neon(const uint32_t* csi, double* csi_r, double* csi_i){
+  csi_decode_neon(csi, csi_r + csi_bw<BW>::half, csi_i + csi_bw<BW>::half, csi_bw<BW>::half);
+  csi_decode_neon(csi + csi_bw<BW>::half, csi_r, csi_i, csi_bw<BW>::half);
+}
+#endif
+
+//fft-shift an already decoded frame
+template<int BW>
+inline void csi_fftshift(const double* in, double* out){
+  memcpy(out + csi_bw<BW>::half, in, csi_bw<BW>::half * sizeof(double));
+  memcpy(out, in + csi_bw<BW>::half, csi_bw<BW>::half * sizeof(double));
+}
+
+//picks the fastest decoder this cpu supports, use_simd=false forces the scalar one
+inline csi_decode_fn csi_decode_select(bool use_simd, const char** name){
+  const char* dummy;
+  if(!name) name = &dummy;
+  if(use_simd){
+#ifdef CSI_DECODE_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){
+	  *name = "avx2";
+	  return csi_decode_avx2;
+	}
+	if(__builtin_cpu_supports("sse4.1")){
+	  *name = "sse4.1";
+	  return csi_decode_sse41;
+	}
+#endif
+#ifdef CSI_DECODE_NEON
+	//always present on aarch64
+	*name = "neon";
+	return csi_decode_neon;
+#endif
+  }
+  *name = "scalar";
+  return csi_decode_scalar;
+}
+
+#define CSI_FRAME_TABLE(kernel, table)			\
+  do{											\
+	table[2] = kernel<20>;						\
+	table[3] = kernel<40>;						\
+	table[4] = kernel<80>;						\
+	table[5] = kernel<160>;						\
+  }while(0)
+
+//fills table (indexed by chanspec bandwidth bits) with the fastest frame kernels this cpu supports.
+//entries for invalid bandwidths are left NULL.
+inline void csi_frame_select(bool use_simd, csi_frame_fn table[8], const char** name){
+  const char* dummy;
+  if(!name) name = &dummy;
+  for(int i = 0; i < 8; ++i) table[i] = NULL;
+  if(use_simd){
+#ifdef CSI_DECODE_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){
+	  *name = "avx2";
+	  CSI_FRAME_TABLE(csi_frame_avx2, table);
+	  return;
+	}
+	if(__builtin_cpu_supports("sse4.1")){
+	  *name = "sse4.1";
+	  CSI_FRAME_TABLE(csi_frame_sse41, table);
+	  return;
+	}
+#endif
+#ifdef CSI_DECODE_NEON
+	*name = "neon";
+	CSI_FRAME_TABLE(csi_frame_neon, table);
+	return;
+#endif
+  }
+  *name = "scalar";
+  CSI_FRAME_TABLE(csi_frame_lut, table);
+}
+
+#endif
@@ -0,0 +1,177 @@
+//
+// table of allowed and denied transmitter MACs, with an optional topic per entry
+//
+
+#ifndef WIROS_CSI_MAC_TABLE_H
+#define WIROS_CSI_MAC_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <regex>
+#include <unordered_map>
+#include "utils.h"
+
+//one entry: frames whose source MAC starts with prefix are kept, or dropped if deny is set.
+//kept frames go to topic if it isn't empty
+struct csi_mac_rule
+{
+  mac_filter prefix;
+  bool deny = false;
+  std::string topic;
+};
+
+//parses "[!]aa:bb:cc:*:*:*[=topic]", ! marks a deny entry. false if it isn't valid
+inline bool csi_mac_rule_str(const std::string &s, csi_mac_rule &out){
+  static const std::regex rule_ex("\\s*(!?)\\s*([0-9a-fA-F]{2}|\\*)((:([0-9a-fA-F]{2}|\\*)){5})\\s*(=\\s*(\\S+))?\\s*");
+  std::smatch m;
+  if(!std::regex_match(s, m, rule_ex)) return false;
+  out.deny = m[1].length() > 0;
+  out.prefix = mac_filter_str(m[2].str() + m[3].str());
+  out.topic = m[7].str();
+  return !(out.deny && !out.topic.empty());
+}
+
+//human readable entry, in the format csi_mac_rule_str parses
+inline std::string hr_mac_rule(const csi_mac_rule &r){
+  std::string out = (r.deny ? "!" : "") + hr_mac_filt(r.prefix);
+  if(!r.topic.empty()) out += "=" + r.topic;
+  return out;
+}
+
+//exact MACs are looked up in a hash map, shorter prefixes by walking a byte trie at most 5 levels deep,
+//so matching costs the same however many entries there are. the most specific entry wins. frames no
+//entry matches are kept if there are no allow entries, i.e. a table of only deny entries drops just those.
+//built once and then only read, replace the whole table to change it.
+class csi_mac_table
+{
+public:
+  csi_mac_table(){
+    nodes.push_back(trie_node());
+  }
+
+  //adds an entry, replacing any entry with the same prefix
+  void add(const csi_mac_rule &r){
+    size_t len = r.prefix.len > 6 ? 6 : r.prefix.len;
+    int* slot;
+    if(len == 6){
+      slot = &exact.insert(std::make_pair(key(r.prefix.mac), -1)).first->second;
+    }
+    else{
+      size_t n = 0;
+      for(size_t i = 0; i < len; ++i){
+        int32_t c = nodes[n].child[r.prefix.mac[i]];
+        if(c < 0){
+          c = nodes.size();
+          nodes[n].child[r.prefix.mac[i]] = c;
+          nodes.push_back(trie_node());
+        }
+        n = c;
+      }
+      slot = &nodes[n].rule;
+    }
+    if(*slot >= 0){
+      n_allow -= !entries[*slot].deny;
+      entries[*slot] = r;
+    }
+    else{
+      *slot = entries.size();
+      entries.push_back(r);
+    }
+    entries[*slot].prefix.len = len;
+    n_allow += !r.deny;
+  }
+
+  //index of the most specific entry matching mac, -1 if none does
+  int match(const unsigned char* mac) const{
+    if(!exact.empty()){
+      std::unordered_map<uint64_t, int>::const_iterator it = exact.find(key(mac));
+      if(it != exact.end()) return it->second;
+    }
+    int best = nodes[0].rule;
+    size_t n = 0;
+    for(size_t i = 0; i < 5; ++i){
+      int32_t c = nodes[n].child[mac[i]];
+      if(c < 0) break;
+      n = c;
+      if(nodes[n].rule >= 0) best = nodes[n].rule;
+    }
+    return best;
+  }
+
+  //true if frames from mac are kept, rule is set to the matching entry or -1
+  bool accepts(const unsigned char* mac, int &rule) const{
+    rule = match(mac);
+    if(rule >= 0) return !entries[rule].deny;
+    return n_allow == 0;
+  }
+
+  //true if the table keeps every frame
+  bool accepts_all() const{
+    for(size_t i = 0; i < entries.size(); ++i){
+      if(entries[i].deny) return false;
+    }
+    for(size_t i = 0; i < entries.size(); ++i){
+      if(entries[i].prefix.len == 0) return true;
+    }
+    return n_allow == 0;
+  }
+
+  size_t size() const{
+    return entries.size();
+  }
+  const csi_mac_rule &rule(size_t i) const{
+    return entries[i];
+  }
+  size_t allow_count() const{
+    return n_allow;
+  }
+
+private:
+  struct trie_node
+  {
+    int32_t child[256];
+    int rule;
+    trie_node() : rule(-1){
+      for(int i = 0; i < 256; ++i) child[i] = -1;
+    }
+  };
+
+  static uint64_t key(const unsigned char* mac){
+    uint64_t k = 0;
+    for(int i = 0; i < 6; ++i) k = k << 8 | mac[i];
+    return k;
+  }
+
+  std::vector<csi_mac_rule> entries;
+  std::unordered_map<uint64_t, int> exact;
+  std::vector<trie_node> nodes;
+  size_t n_allow = 0;
+};
+
+//builds a table from entries in the csi_mac_rule_str format. false if one is invalid, which is copied to bad
+inline bool csi_mac_table_parse(const std::vector<std::string> &entries, csi_mac_table &out, std::string &bad){
+  for(size_t i = 0; i < entries.size(); ++i){
+    csi_mac_rule r;
+    if(!csi_mac_rule_str(entries[i], r)){
+      bad = entries[i];
+      return false;
+    }
+    out.add(r);
+  }
+  return true;
+}
+
+//human readable table, every entry if there are any
+inline std::string hr_mac_table(const csi_mac_table &t){
+  if(t.size() == 0) return hr_mac_filt(mac_filter());
+  std::string out;
+  for(size_t i = 0; i < t.size(); ++i){
+    if(i) out += ", ";
+    out += hr_mac_rule(t.rule(i));
+  }
+  return out;
+}
+
+#endif
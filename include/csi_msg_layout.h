@@ -0,0 +1,258 @@
+//
+// reads individual fields out of serialized ROS messages without deserializing them
+//
+
+#ifndef WIROS_CSI_MSG_LAYOUT_H
+#define WIROS_CSI_MSG_LAYOUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//one field of a message type
+struct csi_msg_field {
+  std::string name;
+  //base type, without the array suffix, e.g. "uint8" or "std_msgs/Header"
+  std::string type;
+  //bytes of one element for fixed size primitives, 0 for string, -1 for a nested message
+  int size;
+  //index of the nested message type, -1 for primitives
+  int nested;
+  //-1 if not an array, 0 for a variable length array, otherwise the fixed length
+  int array;
+};
+
+struct csi_msg_type {
+  std::string name;
+  std::vector<csi_msg_field> fields;
+};
+
+//bytes of a fixed size primitive, 0 for string, -1 if it isn't a primitive
+inline int csi_msg_primitive_size(const std::string &t){
+  if(t == "bool" || t == "int8" || t == "uint8" || t == "byte" || t == "char") return 1;
+  if(t == "int16" || t == "uint16") return 2;
+  if(t == "int32" || t == "uint32" || t == "float32") return 4;
+  if(t == "int64" || t == "uint64" || t == "float64" || t == "time" || t == "duration") return 8;
+  if(t == "string") return 0;
+  return -1;
+}
+
+//the layout of a message type, built at runtime from its full definition (the message_definition a
+//bag stores for every connection). fields are found by walking the serialized bytes: arrays of
+//primitives are skipped by their length prefix, so finding a field after the CSI arrays costs the
+//same as finding one before them.
+class csi_msg_layout
+{
+public:
+  //parses the definition, the first type in it is the message itself. false with err set if a field
+  //type can't be resolved
+  bool parse(const std::string &definition, std::string &err){
+    types.clear();
+    std::vector<std::string> pkgs;
+    types.push_back(csi_msg_type());
+    pkgs.push_back("");
+    std::istringstream in(definition);
+    std::string line;
+    while(std::getline(in, line)){
+      size_t hash = line.find('#');
+      if(hash != std::string::npos) line.erase(hash);
+      std::istringstream ls(line);
+      std::string type, name;
+      if(!(ls >> type)) continue;
+      if(type.compare(0, 3, "===") == 0) continue;
+      if(type == "MSG:"){
+        ls >> name;
+        types.push_back(csi_msg_type());
+        types.back().name = name;
+        pkgs.push_back(name.substr(0, name.find('/')));
+        continue;
+      }
+      //constants take no space in the message
+      if(!(ls >> name) || line.find('=') != std::string::npos) continue;
+      csi_msg_field f;
+      f.name = name;
+      f.array = -1;
+      size_t br = type.find('[');
+      if(br != std::string::npos){
+        f.array = atoi(type.c_str() + br + 1);
+        type.erase(br);
+      }
+      f.type = type;
+      f.size = csi_msg_primitive_size(type);
+      f.nested = -1;
+      types.back().fields.push_back(f);
+    }
+    //resolve nested types by their full name, their name in the same package, or Header
+    for(size_t t = 0; t < types.size(); ++t){
+      for(size_t i = 0; i < types[t].fields.size(); ++i){
+        csi_msg_field &f = types[t].fields[i];
+        if(f.size >= 0) continue;
+        std::string full = f.type;
+        if(full == "Header") full = "std_msgs/Header";
+        else if(full.find('/') == std::string::npos) full = pkgs[t] + "/" + full;
+        for(size_t n = 1; n < types.size(); ++n){
+          if(types[n].name == full || types[n].name == f.type) f.nested = n;
+        }
+        if(f.nested < 0){
+          err = "no definition for " + f.type + " " + f.name;
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  //the field indices leading to a dotted field name, e.g. "header.stamp", empty if there is none
+  std::vector<int> path(const std::string &dotted) const{
+    std::vector<int> out;
+    int t = 0;
+    size_t start = 0;
+    while(start <= dotted.size()){
+      size_t dot = dotted.find('.', start);
+      std::string name = dotted.substr(start, dot == std::string::npos ? std::string::npos : dot - start);
+      if(t < 0) return std::vector<int>();
+      int idx = -1;
+      for(size_t i = 0; i < types[t].fields.size(); ++i){
+        if(types[t].fields[i].name == name) idx = i;
+      }
+      if(idx < 0) return std::vector<int>();
+      out.push_back(idx);
+      const csi_msg_field &f = types[t].fields[idx];
+      //only the fields of a single nested message can be reached
+      t = f.array < 0 ? f.nested : -1;
+      if(dot == std::string::npos) break;
+      start = dot + 1;
+    }
+    return out;
+  }
+
+  //the field at the end of a path, which must not be empty
+  const csi_msg_field &field(const std::vector<int> &p) const{
+    int t = 0;
+    for(size_t i = 0; i + 1 < p.size(); ++i) t = types[t].fields[p[i]].nested;
+    return types[t].fields[p.back()];
+  }
+
+  //offset of the field at the end of a path in a serialized message, false if the message is too short
+  bool locate(const uint8_t* data, size_t len, const std::vector<int> &p, size_t &off) const{
+    off = 0;
+    int t = 0;
+    for(size_t i = 0; i < p.size(); ++i){
+      for(int k = 0; k < p[i]; ++k){
+        if(!skip_field(types[t].fields[k], data, len, off)) return false;
+      }
+      t = types[t].fields[p[i]].nested;
+    }
+    return off <= len;
+  }
+
+  //an integer, bool, time or duration field (times as ns) at off
+  static bool read_int(const uint8_t* data, size_t len, size_t off, const csi_msg_field &f, int64_t &v){
+    if(f.array >= 0 || f.size <= 0 || off + f.size > len) return false;
+    const uint8_t* p = data + off;
+    const std::string &t = f.type;
+    if(t == "time" || t == "duration"){
+      int32_t sec, nsec;
+      memcpy(&sec, p, 4);
+      memcpy(&nsec, p + 4, 4);
+      v = (t == "time" ? (int64_t)(uint32_t)sec : (int64_t)sec) * 1000000000ll + nsec;
+      return true;
+    }
+    if(t == "float32" || t == "float64") return false;
+    bool sign = t[0] == 'i';
+    switch(f.size){
+    case 1: v = sign ? (int64_t)(int8_t)p[0] : (int64_t)p[0]; return true;
+    case 2: { uint16_t x; memcpy(&x, p, 2); v = sign ? (int64_t)(int16_t)x : (int64_t)x; return true; }
+    case 4: { uint32_t x; memcpy(&x, p, 4); v = sign ? (int64_t)(int32_t)x : (int64_t)x; return true; }
+    default: memcpy(&v, p, 8); return true;
+    }
+  }
+
+  //the elements of a primitive array, or the characters of a string, at off
+  static bool read_array(const uint8_t* data, size_t len, size_t off, const csi_msg_field &f, const uint8_t* &p, size_t &count){
+    if(f.array < 0 && f.size != 0) return false;
+    if(f.array >= 0 && f.size <= 0) return false;
+    if(f.array > 0){
+      count = f.array;
+    }
+    else{
+      uint32_t n;
+      if(off + 4 > len) return false;
+      memcpy(&n, data + off, 4);
+      count = n;
+      off += 4;
+    }
+    size_t elem = f.size > 0 ? f.size : 1;
+    if(off + count * elem > len) return false;
+    p = data + off;
+    return true;
+  }
+
+  //locate and read in one step, false if the path is empty or the field can't be read
+  bool get_int(const uint8_t* data, size_t len, const std::vector<int> &p, int64_t &v) const{
+    size_t off;
+    if(p.empty() || !locate(data, len, p, off)) return false;
+    return read_int(data, len, off, field(p), v);
+  }
+  bool get_array(const uint8_t* data, size_t len, const std::vector<int> &p, const uint8_t* &a, size_t &count) const{
+    size_t off;
+    if(p.empty() || !locate(data, len, p, off)) return false;
+    return read_array(data, len, off, field(p), a, count);
+  }
+
+  size_t n_types() const{
+    return types.size();
+  }
+  const csi_msg_type &type(size_t i) const{
+    return types[i];
+  }
+
+private:
+  bool skip_one(const csi_msg_field &f, const uint8_t* data, size_t len, size_t &off) const{
+    if(f.size > 0){
+      off += f.size;
+    }
+    else if(f.size == 0){
+      uint32_t n;
+      if(off + 4 > len) return false;
+      memcpy(&n, data + off, 4);
+      off += 4 + (size_t)n;
+    }
+    else{
+      const csi_msg_type &t = types[f.nested];
+      for(size_t i = 0; i < t.fields.size(); ++i){
+        if(!skip_field(t.fields[i], data, len, off)) return false;
+      }
+    }
+    return off <= len;
+  }
+
+  bool skip_field(const csi_msg_field &f, const uint8_t* data, size_t len, size_t &off) const{
+    if(f.array < 0) return skip_one(f, data, len, off);
+    size_t count = f.array;
+    if(f.array == 0){
+      uint32_t n;
+      if(off + 4 > len) return false;
+      memcpy(&n, data + off, 4);
+      count = n;
+      off += 4;
+    }
+    //arrays of fixed size elements are skipped in one step
+    if(f.size > 0){
+      off += count * f.size;
+      return off <= len;
+    }
+    for(size_t i = 0; i < count; ++i){
+      if(!skip_one(f, data, len, off)) return false;
+    }
+    return true;
+  }
+
+  std::vector<csi_msg_type> types;
+};
+
+#endif
@@ -0,0 +1,103 @@
+//
+// NumPy .npy files of a known shape, sized up front and filled through a shared mapping
+//
+
+#ifndef WIROS_CSI_NPY_H
+#define WIROS_CSI_NPY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <string>
+#include <vector>
+
+//the data starts this far into the file, so numpy.load(mmap_mode='r') gets aligned arrays
+#define CSI_NPY_ALIGN 64
+
+//version 1.0 header for a little endian, C ordered array, padded to CSI_NPY_ALIGN
+inline std::string csi_npy_header(const char* descr, const std::vector<size_t> &shape){
+  std::string dims;
+  for(size_t i = 0; i < shape.size(); ++i){
+    if(i) dims += ", ";
+    dims += std::to_string(shape[i]);
+  }
+  if(shape.size() == 1) dims += ",";
+  std::string dict = std::string("{'descr': '") + descr + "', 'fortran_order': False, 'shape': (" + dims + "), }";
+  size_t total = 10 + dict.size() + 1;
+  total = (total + CSI_NPY_ALIGN - 1) / CSI_NPY_ALIGN * CSI_NPY_ALIGN;
+  dict.append(total - 10 - dict.size() - 1, ' ');
+  dict += '\n';
+  std::string h("\x93NUMPY\x01\x00", 8);
+  uint16_t len = dict.size();
+  h += (char)(len & 0xff);
+  h += (char)(len >> 8);
+  return h + dict;
+}
+
+//one output array. created at its final size, then any number of threads fill disjoint parts of it
+class csi_npy_file
+{
+public:
+  csi_npy_file() : fd(-1), map(NULL), map_len(0), header_len(0){}
+  ~csi_npy_file(){
+    close();
+  }
+
+  //creates path holding an array of the given numpy type (e.g. "<u8") and shape, elem bytes per element.
+  //false with err set if it can't
+  bool create(const std::string &path, const char* descr, const std::vector<size_t> &shape, size_t elem, std::string &err){
+    std::string h = csi_npy_header(descr, shape);
+    size_t n = 1;
+    for(size_t i = 0; i < shape.size(); ++i) n *= shape[i];
+    header_len = h.size();
+    map_len = header_len + n * elem;
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0){
+      err = path + ": " + strerror(errno);
+      return false;
+    }
+    if(ftruncate(fd, map_len) != 0){
+      err = path + ": " + strerror(errno);
+      return false;
+    }
+    void* m = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(m == MAP_FAILED){
+      err = path + ": mmap: " + strerror(errno);
+      map_len = 0;
+      return false;
+    }
+    map = (uint8_t*)m;
+    memcpy(map, h.data(), header_len);
+    return true;
+  }
+
+  //the array, uninitialized parts read as zero
+  template<typename T>
+  T* data(){
+    return reinterpret_cast<T*>(map + header_len);
+  }
+
+  //unmaps the file, the kernel writes it back
+  void close(){
+    if(map) munmap(map, map_len);
+    if(fd >= 0) ::close(fd);
+    map = NULL;
+    fd = -1;
+  }
+
+private:
+  csi_npy_file(const csi_npy_file&);
+  csi_npy_file& operator=(const csi_npy_file&);
+
+  int fd;
+  uint8_t* map;
+  size_t map_len;
+  size_t header_len;
+};
+
+#endif
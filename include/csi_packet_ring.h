@@ -0,0 +1,195 @@
+//
+// zero-copy CSI capture from a TPACKET_V3 memory-mapped packet ring
+//
+
+#ifndef WIROS_CSI_PACKET_RING_H
+#define WIROS_CSI_PACKET_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <atomic>
+#include <string>
+
+struct csi_ring_config {
+  std::string iface;
+  //bytes per block, rounded up to a power of two number of pages
+  size_t block_size = 1 << 20;
+  size_t blocks = 64;
+  //a block is handed over when it is full or this long after its first packet
+  unsigned block_timeout_ms = 8;
+};
+
+//an AF_PACKET socket whose receive ring is shared with the kernel. the kernel fills a block with packets
+//and retires it to us, we read the udp payloads in place and hand the block back, so packets are never
+//copied out of the ring. it sees the interface's traffic before the ip stack, so broadcasts the host would
+//not deliver to a udp socket still arrive.
+class csi_packet_ring
+{
+public:
+  csi_packet_ring() : fd(-1), map(NULL), map_len(0), n_blocks(0), block_size(0), cur(0){}
+  ~csi_packet_ring(){
+    if(map) munmap(map, map_len);
+    if(fd >= 0) close(fd);
+  }
+
+  //opens the socket and maps the ring, false with errno set and what describing the failed step.
+  //nothing is captured until bind(), so a filter attached in between sees every packet
+  bool open(const csi_ring_config &c, std::string &what){
+    //protocol 0 receives nothing, a socket opened for ETH_P_IP would queue packets before the filter is attached
+    fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if(fd < 0){
+      what = "socket";
+      return false;
+    }
+    int version = TPACKET_V3;
+    if(setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0){
+      what = "PACKET_VERSION";
+      return false;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    block_size = page;
+    while(block_size < c.block_size) block_size <<= 1;
+    n_blocks = c.blocks ? c.blocks : 1;
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size;
+    req.tp_block_nr = n_blocks;
+    //v3 packs packets of any size into a block, the frame size only has to divide it
+    req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+    req.tp_frame_nr = block_size / req.tp_frame_size * n_blocks;
+    req.tp_retire_blk_tov = c.block_timeout_ms;
+    if(setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0){
+      what = "PACKET_RX_RING";
+      return false;
+    }
+    map_len = block_size * n_blocks;
+    void* m = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+    if(m == MAP_FAILED){
+      //MAP_LOCKED needs RLIMIT_MEMLOCK headroom, the ring works without it
+      m = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if(m == MAP_FAILED){
+      what = "mmap";
+      map_len = 0;
+      return false;
+    }
+    map = (uint8_t*)m;
+    return true;
+  }
+
+  //starts capturing ip packets on the interface, false with errno set and what describing the failed step
+  bool bind(const std::string &iface, std::string &what){
+    struct sockaddr_ll ll;
+    memset(&ll, 0, sizeof(ll));
+    ll.sll_family = AF_PACKET;
+    ll.sll_protocol = htons(ETH_P_IP);
+    ll.sll_ifindex = if_nametoindex(iface.c_str());
+    if(ll.sll_ifindex == 0){
+      what = "interface " + iface;
+      return false;
+    }
+    if(::bind(fd, (struct sockaddr*)&ll, sizeof(ll)) < 0){
+      what = "bind";
+      return false;
+    }
+    return true;
+  }
+
+  //waits up to timeout_ms for a retired block, then calls f(payload, len, udp_dst_port, kernel_ns) for every
+  //ipv4 udp packet in the ready blocks and hands them back. kernel_ns is the kernel's CLOCK_REALTIME receive
+  //time. the payload points into the ring and is only valid during the call. returns the number of packets
+  //seen, or -1 with errno set
+  template<typename F>
+  int read(int timeout_ms, F f){
+    if(!ready(cur)){
+      struct pollfd p;
+      p.fd = fd;
+      p.events = POLLIN | POLLERR;
+      p.revents = 0;
+      if(poll(&p, 1, timeout_ms) < 0) return errno == EINTR ? 0 : -1;
+    }
+    int n = 0;
+    while(ready(cur)){
+      struct tpacket_block_desc* b = block(cur);
+      uint8_t* pkt = (uint8_t*)b + b->hdr.bh1.offset_to_first_pkt;
+      for(uint32_t i = 0; i < b->hdr.bh1.num_pkts; ++i){
+        struct tpacket3_hdr* h = (struct tpacket3_hdr*)pkt;
+        udp_payload(h, f);
+        ++n;
+        pkt += h->tp_next_offset;
+      }
+      //hand the block back to the kernel once everything in it has been read
+      __atomic_store_n(&b->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+      cur = (cur + 1) % n_blocks;
+    }
+    return n;
+  }
+
+  //packets the kernel dropped because the ring was full, since the last call
+  uint64_t drops(){
+    struct tpacket_stats_v3 st;
+    socklen_t len = sizeof(st);
+    if(getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0) return 0;
+    return st.tp_drops;
+  }
+
+  size_t ring_bytes() const{
+    return map_len;
+  }
+
+  int fd;
+
+private:
+  csi_packet_ring(const csi_packet_ring&);
+  csi_packet_ring& operator=(const csi_packet_ring&);
+
+  struct tpacket_block_desc* block(size_t i){
+    return (struct tpacket_block_desc*)(map + i*block_size);
+  }
+  bool ready(size_t i){
+    return __atomic_load_n(&block(i)->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER;
+  }
+
+  template<typename F>
+  void udp_payload(struct tpacket3_hdr* h, F &f){
+    uint8_t* frame = (uint8_t*)h + h->tp_mac;
+    size_t caplen = h->tp_snaplen;
+    size_t net = h->tp_net - h->tp_mac;
+    if(caplen < net + sizeof(struct iphdr)) return;
+    const struct iphdr* ip = (const struct iphdr*)(frame + net);
+    size_t ihl = ip->ihl * 4;
+    if(ip->version != 4 || ip->protocol != IPPROTO_UDP || ihl < sizeof(struct iphdr)) return;
+    if(ntohs(ip->frag_off) & 0x1fff) return;
+    if(caplen < net + ihl + sizeof(struct udphdr)) return;
+    const struct udphdr* udp = (const struct udphdr*)(frame + net + ihl);
+    size_t len = ntohs(udp->len);
+    if(len < sizeof(struct udphdr)) return;
+    len -= sizeof(struct udphdr);
+    size_t avail = caplen - net - ihl - sizeof(struct udphdr);
+    if(len > avail) len = avail;
+    uint64_t kernel_ns = (uint64_t)h->tp_sec*1000000000ull + h->tp_nsec;
+    f(frame + net + ihl + sizeof(struct udphdr), len, ntohs(udp->dest), kernel_ns);
+  }
+
+  uint8_t* map;
+  size_t map_len;
+  size_t n_blocks;
+  size_t block_size;
+  size_t cur;
+};
+
+#endif
@@ -0,0 +1,113 @@
+//
+// decoding and grouping of nexmon CSI udp payloads, shared by csi_node and the offline tools
+//
+
+#ifndef WIROS_CSI_PARSER_H
+#define WIROS_CSI_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <ros/ros.h>
+//https://github.com/ucsdwcsng/rf_msgs.git
+#include "rf_msgs/Wifi.h"
+#include "wiros_csi_node/CsiCompact.h"
+#include "wiros_csi_node/CsiRaw.h"
+#include "wiros_csi_node/CsiBatch.h"
+#include "csi_decode.h"
+#include "csi_pool.h"
+
+//one decoded frame (a single tx/rx chain). move-only, the CSI itself lives in a pool slot
+//that is recycled when the instance is destroyed after publishing.
+class csi_instance
+{
+public:
+    uint8_t source_mac[6];
+    uint16_t seq_num;
+    int8_t rssi;
+    uint8_t tx;
+    uint8_t rx;
+    uint8_t channel;
+    uint8_t bw;
+    size_t n_sub;
+    csi_slot buf;
+    uint16_t seq;
+    uint8_t fc;
+    //capture time from the pcap stream, zero if the frame should be stamped when published
+    ros::Time stamp;
+    //monotonic time the frame arrived, and was decoded, for latency stats
+    uint64_t rx_ns;
+    uint64_t ready_ns;
+    csi_instance(){}
+    csi_instance(csi_instance&&) = default;
+    csi_instance& operator=(csi_instance&&) = default;
+};
+
+struct csi_udp_frame {
+    uint8_t kk1;//magic number
+    uint8_t id;
+    int8_t rssi;//rssi
+    uint8_t fc; //frame control
+    uint8_t src_mac[6];//source mac
+    uint16_t seqCnt;//frame sequence number
+    uint16_t csiconf;// core + spatial stream
+    uint16_t chanspec;//chanspec
+    uint16_t chip;//chip version
+
+    //then follows the csi bytes, for 80MHZ:
+    //uint32_t csi_values[512];
+};
+
+enum csi_frame_status {
+  CSI_FRAME_OK,
+  CSI_FRAME_BAD_BW,     //chanspec holds a bandwidth we have no decoder for
+  CSI_FRAME_TRUNCATED,  //fewer bytes than the bandwidth needs
+  CSI_FRAME_NO_SLOT     //the frame pool is exhausted
+};
+
+//decodes CSI udp payloads with the fastest kernels the cpu supports. stateless once built,
+//so one parser can be shared by any number of threads.
+class csi_parser
+{
+public:
+  explicit csi_parser(bool use_simd = true);
+
+  //checks the header without decoding, on success bw_code holds the chanspec bandwidth code
+  csi_frame_status check(const unsigned char* data, size_t nbytes, uint8_t &bw_code) const;
+
+  //decodes one frame into a slot from pool, fft-shifted
+  csi_frame_status decode(const unsigned char* data, size_t nbytes, const ros::Time &stamp,
+                          csi_pool &pool, csi_instance &out) const;
+
+  //like decode, but copies the packed nexmon words to the slot as they are (see csi_slot::words)
+  csi_frame_status copy(const unsigned char* data, size_t nbytes, const ros::Time &stamp,
+                        csi_pool &pool, csi_instance &out) const;
+
+  const char* decoder_name() const{
+    return name;
+  }
+
+private:
+  void fill_header(const unsigned char* data, uint8_t bw_code, const ros::Time &stamp, csi_instance &out) const;
+
+  csi_frame_fn frame_decoders[8];
+  const char* name;
+};
+
+//builds a 4x4 Wifi message from one measurement. chains are laid out tx-major, missing ones are zero.
+//frames with a capture time stamp the message, otherwise it is stamped now.
+void csi_fill_msg(const std::vector<csi_instance> &group, const std::string &rx_id, rf_msgs::Wifi &msg);
+
+//builds a CsiCompact message from one measurement, with only the chains it holds, as float32.
+//stamped like csi_fill_msg.
+void csi_fill_compact(const std::vector<csi_instance> &group, const std::string &rx_id, wiros_csi_node::CsiCompact &msg);
+
+//builds a CsiRaw message from one measurement of frames read with csi_parser::copy, holding the
+//packed words of the chains it has. stamped like csi_fill_msg.
+void csi_fill_raw(const std::vector<csi_instance> &group, const std::string &rx_id, wiros_csi_node::CsiRaw &msg);
+
+//appends one measurement to a CsiBatch as its next entry, stamped like csi_fill_msg
+void csi_append_batch(const std::vector<csi_instance> &group, wiros_csi_node::CsiBatch &msg);
+
+#endif
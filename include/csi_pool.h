@@ -0,0 +1,171 @@
+#ifndef CSI_POOL_H
+#define CSI_POOL_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "csi_decode.h"
+
+#define CSI_POOL_NONE 0xffffffffu
+
+//storage for one decoded frame, real parts followed by imaginary parts, cache-line aligned
+struct csi_pool_slot
+{
+  double csi_r[CSI_MAX_NSUB];
+  double csi_i[CSI_MAX_NSUB];
+};
+
+class csi_pool;
+
+//move-only handle to a slot, the slot goes back to its pool when the handle is destroyed
+class csi_slot
+{
+public:
+  double* csi_r;
+  double* csi_i;
+
+  csi_slot() : csi_r(NULL), csi_i(NULL), pool(NULL), idx(CSI_POOL_NONE){}
+  csi_slot(csi_slot&& o) : csi_r(o.csi_r), csi_i(o.csi_i), pool(o.pool), idx(o.idx){
+    o.detach();
+  }
+  csi_slot& operator=(csi_slot&& o);
+  ~csi_slot();
+
+  bool valid() const{
+    return idx != CSI_POOL_NONE;
+  }
+  //the packed nexmon words of a frame read with csi_parser::copy, stored in place of the decoded values
+  uint32_t* words() const{
+    return reinterpret_cast<uint32_t*>(csi_r);
+  }
+  //return the slot to the pool early
+  void release();
+
+private:
+  friend class csi_pool;
+  csi_slot(const csi_slot&);
+  csi_slot& operator=(const csi_slot&);
+  void detach(){
+    csi_r = NULL;
+    csi_i = NULL;
+    pool = NULL;
+    idx = CSI_POOL_NONE;
+  }
+
+  csi_pool* pool;
+  uint32_t idx;
+};
+
+//fixed-capacity pool of frame slots allocated once at startup. slots are handed out and returned
+//through a lock-free stack, so frames can be acquired on one thread and released on another.
+class csi_pool
+{
+public:
+  explicit csi_pool(size_t n){
+    capacity = n;
+    void* mem = NULL;
+    if(posix_memalign(&mem, 64, n * sizeof(csi_pool_slot)) != 0) mem = NULL;
+    slots = static_cast<csi_pool_slot*>(mem);
+    if(!slots) capacity = 0;
+    next = new std::atomic<uint32_t>[n];
+    for(size_t i = 0; i < capacity; ++i){
+      next[i].store(i + 1 < capacity ? i + 1 : CSI_POOL_NONE, std::memory_order_relaxed);
+    }
+    head.store(capacity ? 0 : CSI_POOL_NONE, std::memory_order_relaxed);
+    used.store(0, std::memory_order_relaxed);
+    high_water.store(0, std::memory_order_relaxed);
+    exhausted.store(0, std::memory_order_relaxed);
+  }
+  ~csi_pool(){
+    free(slots);
+    delete[] next;
+  }
+
+  //hands out a free slot, returns false (and counts it) if every slot is in use
+  bool acquire(csi_slot &s){
+    s.release();
+    uint64_t h = head.load(std::memory_order_acquire);
+    for(;;){
+      uint32_t i = (uint32_t)h;
+      if(i == CSI_POOL_NONE){
+        exhausted.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      //the upper 32 bits count pops so a stale head can't be swapped back in (ABA)
+      uint64_t nh = ((h >> 32) + 1) << 32 | next[i].load(std::memory_order_relaxed);
+      if(head.compare_exchange_weak(h, nh, std::memory_order_acquire, std::memory_order_acquire)){
+        s.pool = this;
+        s.idx = i;
+        s.csi_r = slots[i].csi_r;
+        s.csi_i = slots[i].csi_i;
+        break;
+      }
+    }
+    size_t u = used.fetch_add(1, std::memory_order_relaxed) + 1;
+    size_t hw = high_water.load(std::memory_order_relaxed);
+    while(u > hw && !high_water.compare_exchange_weak(hw, u, std::memory_order_relaxed));
+    return true;
+  }
+
+  void release(uint32_t i){
+    uint64_t h = head.load(std::memory_order_relaxed);
+    for(;;){
+      next[i].store((uint32_t)h, std::memory_order_relaxed);
+      uint64_t nh = (h & 0xffffffff00000000ull) | i;
+      if(head.compare_exchange_weak(h, nh, std::memory_order_release, std::memory_order_relaxed))
+        break;
+    }
+    used.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  size_t size() const{
+    return capacity;
+  }
+  size_t in_use() const{
+    return used.load(std::memory_order_relaxed);
+  }
+  //most slots ever in use at once
+  size_t high_water_mark() const{
+    return high_water.load(std::memory_order_relaxed);
+  }
+  //number of times a frame was dropped because no slot was free
+  uint64_t exhaustions() const{
+    return exhausted.load(std::memory_order_relaxed);
+  }
+
+private:
+  csi_pool(const csi_pool&);
+  csi_pool& operator=(const csi_pool&);
+
+  csi_pool_slot* slots;
+  size_t capacity;
+  std::atomic<uint32_t>* next;
+  std::atomic<uint64_t> head;
+  std::atomic<size_t> used;
+  std::atomic<size_t> high_water;
+  std::atomic<uint64_t> exhausted;
+};
+
+inline csi_slot& csi_slot::operator=(csi_slot&& o){
+  if(this != &o){
+    release();
+    csi_r = o.csi_r;
+    csi_i = o.csi_i;
+    pool = o.pool;
+    idx = o.idx;
+    o.detach();
+  }
+  return *this;
+}
+
+inline csi_slot::~csi_slot(){
+  release();
+}
+
+inline void csi_slot::release(){
+  if(pool) pool->release(idx);
+  detach();
+}
+
+#endif
@@ -0,0 +1,99 @@
+//
+// on-demand decoding of the packed nexmon words in CsiRaw messages. header-only and free of ROS, it
+// uses the node's decoders, so the values match rf_msgs/Wifi and CsiCompact exactly
+//
+
+#ifndef WIROS_CSI_RAW_H
+#define WIROS_CSI_RAW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <complex>
+#include "csi_decode.h"
+
+//the fastest word decoder this cpu supports, picked on first use
+inline csi_decode_fn csi_raw_decoder(){
+  static const csi_decode_fn fn = csi_decode_select(true, NULL);
+  return fn;
+}
+
+//read-only view of the CSI of one measurement. subcarrier indices are fft-shifted, as in the decoded
+//messages, and the view decodes only what is asked for.
+//
+//  csi_raw_view v(*msg);
+//  double re[64], im[64];
+//  if(v.decode(0, 1, 96, 64, re, im)) ...
+class csi_raw_view
+{
+public:
+  csi_raw_view(const uint32_t* words, size_t n_words, size_t n_sub, uint16_t chain_mask)
+    : words(words), n_words(n_words), nsub(n_sub), mask(chain_mask){}
+
+  //any message with csi, n_sub and chain_mask fields, i.e. wiros_csi_node::CsiRaw
+  template<typename M>
+  explicit csi_raw_view(const M &msg) : csi_raw_view(msg.csi.data(), msg.csi.size(), msg.n_sub, msg.chain_mask){}
+
+  //false if the words don't hold n_sub subcarriers for every chain in the mask
+  bool valid() const{
+    return nsub > 0 && nsub % 2 == 0 && n_words == n_chains() * nsub;
+  }
+
+  size_t n_sub() const{
+    return nsub;
+  }
+  uint16_t chain_mask() const{
+    return mask;
+  }
+  size_t n_chains() const{
+    return __builtin_popcount(mask);
+  }
+  bool has(int tx, int rx) const{
+    return tx >= 0 && tx < 4 && rx >= 0 && rx < 4 && (mask & (1 << (tx*4 + rx)));
+  }
+
+  //the packed words of a chain, in nexmon's order, NULL if the measurement doesn't hold it
+  const uint32_t* chain(int tx, int rx) const{
+    if(!has(tx, rx) || !valid()) return NULL;
+    int b = tx*4 + rx;
+    return words + __builtin_popcount(mask & ((1u << b) - 1)) * nsub;
+  }
+
+  //decodes subcarriers [first, first + count) of a chain into re and im.
+  //false if the chain is missing or the range is out of bounds
+  bool decode(int tx, int rx, size_t first, size_t count, double* re, double* im) const{
+    const uint32_t* c = chain(tx, rx);
+    if(!c || first > nsub || count > nsub - first) return false;
+    //the first half of the output is the second half of the words, and vice versa
+    size_t half = nsub / 2, end = first + count;
+    csi_decode_fn fn = csi_raw_decoder();
+    if(first < half){
+      size_t n = (end < half ? end : half) - first;
+      fn(c + half + first, re, im, n);
+      re += n;
+      im += n;
+      first += n;
+    }
+    if(first < end) fn(c + first - half, re, im, end - first);
+    return true;
+  }
+
+  //decodes a whole chain, n_sub values each
+  bool decode(int tx, int rx, double* re, double* im) const{
+    return decode(tx, rx, 0, nsub, re, im);
+  }
+
+  //one subcarrier, zero if the chain is missing or k is out of range
+  std::complex<double> at(int tx, int rx, size_t k) const{
+    double re = 0, im = 0;
+    decode(tx, rx, k, 1, &re, &im);
+    return std::complex<double>(re, im);
+  }
+
+private:
+  const uint32_t* words;
+  size_t n_words;
+  size_t nsub;
+  uint16_t mask;
+};
+
+#endif
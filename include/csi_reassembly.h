@@ -0,0 +1,295 @@
+//
+// groups decoded CSI frames into measurements, per transmitter and sequence number
+//
+
+#ifndef WIROS_CSI_REASSEMBLY_H
+#define WIROS_CSI_REASSEMBLY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+#include "csi_parser.h"
+
+#define CSI_REASM_NONE 0xffff
+//transmitters whose chain masks are remembered
+#define CSI_REASM_TX_SLOTS 1024
+//slots a transmitter can be in, the least recently seen of them is evicted to make room
+#define CSI_REASM_TX_WAYS 8
+//partial groups in a row after which a transmitter's chains are learned again from those groups
+#define CSI_REASM_RELEARN 8
+
+//fixed-capacity table of in-flight measurements keyed by (transmitter MAC, sequence number).
+//groups live in a preallocated array; an open-addressing index (linear probing, backward-shift
+//deletion) finds them and an intrusive list keeps them in creation order for expiry. nothing is
+//allocated once it is built. not thread safe, each instance belongs to one thread.
+//frame_t is anything with source_mac, seq, tx and rx: csi_instance in the node, or just the headers of
+//capture records in the offline tools, so they group exactly like the node.
+//
+//a group is emitted when:
+//  - it holds every chain its transmitter has been seen to send (complete). a transmitter that sends
+//    fewer chains than that (rate adaptation, a core mask change) has its chains learned again from its
+//    next CSI_REASM_RELEARN partial groups, and forget() drops what was learned, e.g. on reconfiguring
+//  - a chain it already holds arrives again, i.e. the transmitter reused the sequence number
+//  - it is older than the timeout
+//  - the table is full and it is the oldest group
+//emit(frames, complete) is handed the frames, which are cleared afterwards
+template<typename frame_t>
+class csi_reassembler_t
+{
+public:
+  csi_reassembler_t(size_t max_groups, uint64_t timeout_ns){
+    if(max_groups < 1) max_groups = 1;
+    if(max_groups > 4096) max_groups = 4096;
+    n_groups = max_groups;
+    timeout = timeout_ns;
+    groups = new csi_group[n_groups];
+    free_ids.reserve(n_groups);
+    for(size_t i = n_groups; i-- > 0;){
+      groups[i].frames.reserve(16);
+      free_ids.push_back(i);
+    }
+    //at most half full, so probes stay short
+    index_cap = 1;
+    while(index_cap < 2*n_groups) index_cap <<= 1;
+    index = new uint16_t[index_cap];
+    for(size_t i = 0; i < index_cap; ++i) index[i] = CSI_REASM_NONE;
+    memset(txs, 0, sizeof(txs));
+    forget_pending = false;
+    oldest = CSI_REASM_NONE;
+    newest = CSI_REASM_NONE;
+  }
+  ~csi_reassembler_t(){
+    delete[] groups;
+    delete[] index;
+  }
+
+  //adds a frame, taking ownership of its slot. now is monotonic ns
+  template<typename F>
+  void add(frame_t &f, uint64_t now, F emit){
+    if(forget_pending.exchange(false, std::memory_order_acquire)) memset(txs, 0, sizeof(txs));
+    expire(now, emit);
+    uint16_t bit = 1 << ((f.tx & 3)*4 + (f.rx & 3));
+    size_t pos;
+    uint16_t id = find(f.source_mac, f.seq, pos);
+    if(id != CSI_REASM_NONE && (groups[id].mask & bit)){
+      //the sequence number was reused, this chain starts the next measurement
+      finish(id, emit);
+      id = CSI_REASM_NONE;
+      find(f.source_mac, f.seq, pos);
+    }
+    if(id == CSI_REASM_NONE){
+      if(free_ids.empty()){
+        finish(oldest, emit);
+        find(f.source_mac, f.seq, pos);
+      }
+      id = create(f.source_mac, f.seq, now, pos);
+    }
+    csi_group &g = groups[id];
+    g.mask |= bit;
+    g.frames.push_back(std::move(f));
+    csi_tx* t = tx(g.mac, now);
+    if(t && t->mask && (g.mask & t->mask) == t->mask) finish(id, emit);
+  }
+
+  //emits every group older than the timeout
+  template<typename F>
+  void expire(uint64_t now, F emit){
+    while(oldest != CSI_REASM_NONE && now >= groups[oldest].first_ns + timeout) finish(oldest, emit);
+  }
+
+  //emits everything, e.g. on shutdown
+  template<typename F>
+  void flush(F emit){
+    while(oldest != CSI_REASM_NONE) finish(oldest, emit);
+  }
+
+  //drops everything without emitting, returning the frames' pool slots
+  void clear(){
+    while(oldest != CSI_REASM_NONE){
+      groups[oldest].frames.clear();
+      remove(oldest);
+    }
+  }
+
+  //drops the chains learned for every transmitter before the next frame is added. safe to call from
+  //any thread
+  void forget(){
+    forget_pending.store(true, std::memory_order_release);
+  }
+
+  //when the oldest group times out, UINT64_MAX if there is none
+  uint64_t deadline() const{
+    return oldest == CSI_REASM_NONE ? UINT64_MAX : groups[oldest].first_ns + timeout;
+  }
+
+  size_t in_flight() const{
+    return n_groups - free_ids.size();
+  }
+
+  //groups emitted so far, and those of them that were missing chains
+  uint64_t emitted() const{
+    return n_emitted;
+  }
+  uint64_t incomplete() const{
+    return n_incomplete;
+  }
+
+private:
+  csi_reassembler_t(const csi_reassembler_t&);
+  csi_reassembler_t& operator=(const csi_reassembler_t&);
+
+  //one in-flight measurement
+  struct csi_group {
+    uint8_t mac[6];
+    uint16_t seq;
+    //bit tx*4 + rx is set for every chain received
+    uint16_t mask;
+    uint64_t first_ns;
+    //creation order, oldest first
+    uint16_t prev;
+    uint16_t next;
+    std::vector<frame_t> frames;
+  };
+
+  static size_t hash(const uint8_t mac[6], uint16_t seq){
+    uint64_t k = seq;
+    for(int i = 0; i < 6; ++i) k = k << 8 | mac[i];
+    k *= 0x9e3779b97f4a7c15ull;
+    return k >> 32;
+  }
+
+  //id of the group with this key, or CSI_REASM_NONE with pos set to the free index slot to insert at
+  uint16_t find(const uint8_t mac[6], uint16_t seq, size_t &pos) const{
+    size_t mask = index_cap - 1;
+    for(pos = hash(mac, seq) & mask; index[pos] != CSI_REASM_NONE; pos = (pos + 1) & mask){
+      const csi_group &g = groups[index[pos]];
+      if(g.seq == seq && memcmp(g.mac, mac, 6) == 0) return index[pos];
+    }
+    return CSI_REASM_NONE;
+  }
+
+  uint16_t create(const uint8_t mac[6], uint16_t seq, uint64_t now, size_t pos){
+    uint16_t id = free_ids.back();
+    free_ids.pop_back();
+    csi_group &g = groups[id];
+    memcpy(g.mac, mac, 6);
+    g.seq = seq;
+    g.mask = 0;
+    g.first_ns = now;
+    index[pos] = id;
+    //append to the creation order
+    g.prev = newest;
+    g.next = CSI_REASM_NONE;
+    if(newest != CSI_REASM_NONE) groups[newest].next = id;
+    else oldest = id;
+    newest = id;
+    return id;
+  }
+
+  template<typename F>
+  void finish(uint16_t id, F &emit){
+    csi_group &g = groups[id];
+    //a transmitter's full set of chains is every chain it has been seen to send
+    bool complete = true;
+    csi_tx* t = tx(g.mac, 0);
+    if(t){
+      bool grown = (g.mask & ~t->mask) != 0;
+      t->mask |= g.mask;
+      complete = g.mask == t->mask;
+      if(complete || grown){
+        t->misses = 0;
+        t->recent = 0;
+      }
+      else{
+        //keep what the latest partial groups held, if they keep coming it is all the transmitter sends now
+        t->recent |= g.mask;
+        if(++t->misses >= CSI_REASM_RELEARN){
+          t->mask = t->recent;
+          t->misses = 0;
+          t->recent = 0;
+        }
+      }
+    }
+    ++n_emitted;
+    if(!complete) ++n_incomplete;
+    emit(g.frames, complete);
+    g.frames.clear();
+    remove(id);
+  }
+
+  void remove(uint16_t id){
+    csi_group &g = groups[id];
+    size_t pos;
+    find(g.mac, g.seq, pos);
+    //find() stops at the group's own slot, delete it and shift later probes back so no tombstones are needed
+    size_t mask = index_cap - 1;
+    size_t hole = pos;
+    for(size_t i = (hole + 1) & mask; index[i] != CSI_REASM_NONE; i = (i + 1) & mask){
+      const csi_group &o = groups[index[i]];
+      size_t home = hash(o.mac, o.seq) & mask;
+      //move it if its home slot is not cyclically between the hole and where it sits
+      if(((i - home) & mask) >= ((i - hole) & mask)){
+        index[hole] = index[i];
+        hole = i;
+      }
+    }
+    index[hole] = CSI_REASM_NONE;
+
+    if(g.prev != CSI_REASM_NONE) groups[g.prev].next = g.next;
+    else oldest = g.next;
+    if(g.next != CSI_REASM_NONE) groups[g.next].prev = g.prev;
+    else newest = g.prev;
+    free_ids.push_back(id);
+  }
+
+  //what is learned about a transmitter. mac 0 is a free slot
+  struct csi_tx {
+    uint64_t mac;
+    uint64_t last_ns;
+    uint16_t mask;
+    //chains of the partial groups since the last complete one
+    uint16_t recent;
+    uint16_t misses;
+  };
+
+  //a transmitter's entry. with now set it is refreshed, or added in place of the least recently seen
+  //transmitter of its slots. NULL if it isn't known, and for 00:00:00:00:00:00
+  csi_tx* tx(const uint8_t mac[6], uint64_t now){
+    uint64_t k = 0;
+    for(int i = 0; i < 6; ++i) k = k << 8 | mac[i];
+    if(k == 0) return NULL;
+    //every transmitter lives in one of CSI_REASM_TX_WAYS slots, so a lookup never probes further
+    size_t base = ((k * 0x9e3779b97f4a7c15ull) >> 32) & (CSI_REASM_TX_SLOTS - CSI_REASM_TX_WAYS);
+    csi_tx* victim = &txs[base];
+    for(size_t i = base; i < base + CSI_REASM_TX_WAYS; ++i){
+      if(txs[i].mac == k){
+        if(now) txs[i].last_ns = now;
+        return &txs[i];
+      }
+      if(txs[i].mac == 0 || (victim->mac != 0 && txs[i].last_ns < victim->last_ns)) victim = &txs[i];
+    }
+    if(!now) return NULL;
+    memset(victim, 0, sizeof(*victim));
+    victim->mac = k;
+    victim->last_ns = now;
+    return victim;
+  }
+
+  csi_group* groups;
+  size_t n_groups;
+  uint64_t timeout;
+  std::vector<uint16_t> free_ids;
+  uint16_t* index;
+  size_t index_cap;
+  uint16_t oldest, newest;
+  csi_tx txs[CSI_REASM_TX_SLOTS];
+  std::atomic<bool> forget_pending;
+  uint64_t n_emitted = 0;
+  uint64_t n_incomplete = 0;
+};
+
+typedef csi_reassembler_t<csi_instance> csi_reassembler;
+
+#endif
@@ -0,0 +1,132 @@
+//
+// on-disk layout of csi_node recordings, shared by the recorder and the reader
+//
+// a recording is a series of segment files, prefix_00000.csir, prefix_00001.csir, ... each one is
+// preallocated and filled front to back with 8 byte aligned blocks:
+//   - a csi_rec_segment_header at offset 0
+//   - a csi_rec_header and its CSI for every measurement
+//   - every index_interval measurements, and when the segment is closed, an index block: a
+//     csi_rec_index_header followed by a csi_rec_index_entry for each measurement since the last one
+// a block's type is written last, so a block that was cut short by a crash reads as type 0 and ends
+// the segment. all fields are little endian.
+//
+
+#ifndef WIROS_CSI_RECORD_FORMAT_H
+#define WIROS_CSI_RECORD_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+
+#define CSI_REC_MAGIC 0x52495343u  //"CSIR"
+#define CSI_REC_VERSION 1
+#define CSI_REC_SUFFIX ".csir"
+#define CSI_REC_ALIGN 8
+
+//segment flags
+#define CSI_REC_SEG_CLOSED 1  //the recorder finished the segment, everything in it is indexed
+
+enum csi_rec_type {
+  CSI_REC_NONE = 0,   //unwritten space
+  CSI_REC_CSI = 1,    //one measurement
+  CSI_REC_INDEX = 2   //index of the measurements before it
+};
+
+enum csi_rec_format {
+  CSI_REC_FLOAT32 = 1  //per chain in the mask, lowest bit first: n_sub float32 real parts, then n_sub imaginary
+};
+
+struct __attribute__((packed)) csi_rec_segment_header {
+  uint32_t magic;
+  uint32_t version;
+  //position of the segment in the recording
+  uint32_t segment;
+  uint32_t flags;
+  //bytes from the start of the file known to be on disk, always a block boundary. a reader can go
+  //further, up to the first block of type 0, if the recorder did not close the segment
+  uint64_t committed;
+  //measurements within committed, and the earliest and latest of their stamps
+  uint64_t records;
+  uint64_t first_ns;
+  uint64_t last_ns;
+  //offset of the last index block within committed, 0 if there is none
+  uint64_t last_index;
+  //random, the same in every segment of a recording. segments with another id are left over from an
+  //earlier recording with the same prefix and are not part of this one
+  uint64_t recording;
+};
+
+//the first 8 bytes of every block after the segment header
+struct __attribute__((packed)) csi_rec_block {
+  uint16_t type;
+  uint16_t format;
+  //whole block including this header, a multiple of CSI_REC_ALIGN
+  uint32_t size;
+};
+
+struct __attribute__((packed)) csi_rec_header {
+  uint16_t type;
+  uint16_t format;
+  uint32_t size;
+  //message stamp, ns since the epoch
+  uint64_t stamp_ns;
+  uint8_t mac[6];
+  uint16_t seq;
+  uint8_t chan;
+  //bandwidth in MHz
+  uint8_t bw;
+  int8_t rssi;
+  uint8_t fc;
+  //bit tx*4 + rx is set for every chain stored
+  uint16_t chain_mask;
+  uint16_t n_sub;
+};
+
+struct __attribute__((packed)) csi_rec_index_header {
+  uint16_t type;
+  uint16_t format;
+  uint32_t size;
+  //earliest and latest stamp of the entries
+  uint64_t first_ns;
+  uint64_t last_ns;
+  //offset of the previous index block in the segment, 0 for the first
+  uint64_t prev;
+  uint32_t count;
+  uint32_t pad;
+};
+
+struct __attribute__((packed)) csi_rec_index_entry {
+  uint64_t stamp_ns;
+  //offset of the measurement's csi_rec_header in the segment
+  uint64_t offset;
+  uint8_t mac[6];
+  uint16_t seq;
+};
+
+static_assert(sizeof(csi_rec_segment_header) == 64, "segment header layout");
+static_assert(sizeof(csi_rec_header) == 32, "record header layout");
+static_assert(sizeof(csi_rec_index_header) == 40, "index header layout");
+static_assert(sizeof(csi_rec_index_entry) == 24, "index entry layout");
+
+inline size_t csi_rec_align(size_t n){
+  return (n + CSI_REC_ALIGN - 1) & ~(size_t)(CSI_REC_ALIGN - 1);
+}
+
+//bytes of a measurement record with this many chains
+inline size_t csi_rec_size(size_t n_chains, size_t n_sub){
+  return csi_rec_align(sizeof(csi_rec_header) + n_chains * n_sub * 2 * sizeof(float));
+}
+
+//segments are prefix_00000.csir, prefix_00001.csir, ...
+inline std::string csi_rec_segment_path(const std::string &prefix, uint32_t segment){
+  char n[16];
+  snprintf(n, sizeof(n), "_%05u", segment);
+  return prefix + n + CSI_REC_SUFFIX;
+}
+
+inline size_t csi_rec_chains(uint16_t chain_mask){
+  return __builtin_popcount(chain_mask);
+}
+
+#endif
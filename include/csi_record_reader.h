@@ -0,0 +1,298 @@
+//
+// reads csi_node recordings, see csi_record_format.h. needs nothing from ROS.
+//
+
+#ifndef WIROS_CSI_RECORD_READER_H
+#define WIROS_CSI_RECORD_READER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "csi_record_format.h"
+
+//a measurement found through the index
+struct csi_rec_entry {
+  uint64_t stamp_ns;
+  uint8_t mac[6];
+  uint16_t seq;
+  uint32_t segment;
+  uint64_t offset;
+};
+
+//maps every segment of a recording read-only. opening reads only the segment headers and the index
+//blocks, so finding measurements by time or transmitter never touches the CSI itself. segments the
+//recorder did not close (it crashed, or is still writing) are read up to the last complete block.
+class csi_record_reader
+{
+public:
+  csi_record_reader(){}
+  ~csi_record_reader(){
+    for(size_t i = 0; i < segs.size(); ++i) munmap((void*)segs[i].map, segs[i].len);
+  }
+
+  //opens prefix_00000.csir onwards, up to the first missing segment or one left over from another
+  //recording. false with err set if there are none or one is not a recording
+  bool open(const std::string &prefix, std::string &err){
+    for(uint32_t n = 0;; ++n){
+      std::string path = csi_rec_segment_path(prefix, n);
+      int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if(fd < 0){
+        if(errno == ENOENT && n > 0) break;
+        err = path + ": " + strerror(errno);
+        return false;
+      }
+      struct stat st;
+      if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(csi_rec_segment_header)){
+        err = path + ": too short to be a recording";
+        ::close(fd);
+        return false;
+      }
+      void* m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if(m == MAP_FAILED){
+        err = path + ": mmap: " + strerror(errno);
+        return false;
+      }
+      segs.push_back(seg());
+      seg &s = segs.back();
+      s.map = (const uint8_t*)m;
+      s.len = st.st_size;
+      const csi_rec_segment_header* h = header(s);
+      if(h->magic != CSI_REC_MAGIC || h->version != CSI_REC_VERSION){
+        err = path + ": not a version " + std::to_string(CSI_REC_VERSION) + " recording";
+        return false;
+      }
+      if(n > 0 && h->recording != header(segs[0])->recording){
+        munmap(m, st.st_size);
+        segs.pop_back();
+        break;
+      }
+      load_index(s);
+    }
+    return true;
+  }
+
+  size_t segments() const{
+    return segs.size();
+  }
+  //measurements in the recording, and the range of their stamps
+  uint64_t records() const{
+    uint64_t n = 0;
+    for(size_t i = 0; i < segs.size(); ++i) n += segs[i].records;
+    return n;
+  }
+  uint64_t first_ns() const{
+    uint64_t t = UINT64_MAX;
+    for(size_t i = 0; i < segs.size(); ++i) if(segs[i].records) t = std::min(t, segs[i].first_ns);
+    return t == UINT64_MAX ? 0 : t;
+  }
+  uint64_t last_ns() const{
+    uint64_t t = 0;
+    for(size_t i = 0; i < segs.size(); ++i) if(segs[i].records) t = std::max(t, segs[i].last_ns);
+    return t;
+  }
+
+  //measurements stamped in [t0, t1), in recording order, only from mac if it isn't NULL. segments and
+  //index blocks outside the range are skipped without being read
+  std::vector<csi_rec_entry> find(uint64_t t0, uint64_t t1, const uint8_t* mac = NULL) const{
+    std::vector<csi_rec_entry> out;
+    for(size_t i = 0; i < segs.size(); ++i){
+      const seg &s = segs[i];
+      if(!s.records || s.last_ns < t0 || s.first_ns >= t1) continue;
+      for(size_t b = 0; b < s.blocks.size(); ++b){
+        const index_block &ib = s.blocks[b];
+        if(ib.last_ns < t0 || ib.first_ns >= t1) continue;
+        for(size_t k = 0; k < ib.count; ++k){
+          const csi_rec_index_entry &e = ib.entries[k];
+          if(e.stamp_ns < t0 || e.stamp_ns >= t1) continue;
+          if(mac && memcmp(e.mac, mac, 6) != 0) continue;
+          out.push_back(entry(e, i));
+        }
+      }
+    }
+    return out;
+  }
+
+  //every measurement from one transmitter
+  std::vector<csi_rec_entry> find_mac(const uint8_t* mac) const{
+    return find(0, UINT64_MAX, mac);
+  }
+
+  //the first measurement stamped at or after t, false if there is none
+  bool seek(uint64_t t, csi_rec_entry &out) const{
+    bool found = false;
+    for(size_t i = 0; i < segs.size(); ++i){
+      const seg &s = segs[i];
+      if(!s.records || s.last_ns < t) continue;
+      for(size_t b = 0; b < s.blocks.size(); ++b){
+        const index_block &ib = s.blocks[b];
+        if(ib.last_ns < t) continue;
+        for(size_t k = 0; k < ib.count; ++k){
+          const csi_rec_index_entry &e = ib.entries[k];
+          if(e.stamp_ns >= t && (!found || e.stamp_ns < out.stamp_ns)){
+            out = entry(e, i);
+            found = true;
+          }
+        }
+      }
+    }
+    return found;
+  }
+
+  //the measurement an entry refers to, NULL if it is damaged
+  const csi_rec_header* record(const csi_rec_entry &e) const{
+    if(e.segment >= segs.size()) return NULL;
+    const seg &s = segs[e.segment];
+    if(e.offset + sizeof(csi_rec_header) > s.end) return NULL;
+    const csi_rec_header* h = reinterpret_cast<const csi_rec_header*>(s.map + e.offset);
+    if(h->type != CSI_REC_CSI || e.offset + h->size > s.end) return NULL;
+    if(csi_rec_size(csi_rec_chains(h->chain_mask), h->n_sub) > h->size) return NULL;
+    return h;
+  }
+
+  //the real parts of chain tx*4 + rx, followed by n_sub imaginary parts. NULL if it wasn't received
+  static const float* chain(const csi_rec_header* h, int tx, int rx){
+    int b = (tx & 3)*4 + (rx & 3);
+    if(!(h->chain_mask & (1 << b))) return NULL;
+    size_t before = __builtin_popcount(h->chain_mask & ((1u << b) - 1));
+    return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(h) + sizeof(csi_rec_header)) + before * 2 * h->n_sub;
+  }
+
+  //calls f(entry, header) for every measurement in recording order
+  template<typename F>
+  void scan(F f) const{
+    for(size_t i = 0; i < segs.size(); ++i){
+      for(size_t b = 0; b < segs[i].blocks.size(); ++b){
+        const index_block &ib = segs[i].blocks[b];
+        for(size_t k = 0; k < ib.count; ++k){
+          csi_rec_entry e = entry(ib.entries[k], i);
+          const csi_rec_header* h = record(e);
+          if(h) f(e, h);
+        }
+      }
+    }
+  }
+
+private:
+  csi_record_reader(const csi_record_reader&);
+  csi_record_reader& operator=(const csi_record_reader&);
+
+  struct index_block {
+    uint64_t first_ns;
+    uint64_t last_ns;
+    const csi_rec_index_entry* entries;
+    size_t count;
+  };
+  struct seg {
+    const uint8_t* map;
+    size_t len;
+    //end of the readable blocks
+    uint64_t end;
+    uint64_t records;
+    uint64_t first_ns;
+    uint64_t last_ns;
+    std::vector<index_block> blocks;
+    //entries rebuilt for measurements after the last index block
+    std::vector<csi_rec_index_entry> tail;
+  };
+
+  static const csi_rec_segment_header* header(const seg &s){
+    return reinterpret_cast<const csi_rec_segment_header*>(s.map);
+  }
+
+  static csi_rec_entry entry(const csi_rec_index_entry &e, size_t segment){
+    csi_rec_entry out;
+    out.stamp_ns = e.stamp_ns;
+    memcpy(out.mac, e.mac, 6);
+    out.seq = e.seq;
+    out.segment = segment;
+    out.offset = e.offset;
+    return out;
+  }
+
+  //the block at off, NULL if there is no complete block there
+  static const csi_rec_block* block_at(const seg &s, uint64_t off){
+    if(off + sizeof(csi_rec_block) > s.len) return NULL;
+    const csi_rec_block* b = reinterpret_cast<const csi_rec_block*>(s.map + off);
+    if(b->type == CSI_REC_NONE || b->size < sizeof(csi_rec_block) || b->size % CSI_REC_ALIGN) return NULL;
+    if(off + b->size > s.len) return NULL;
+    return b;
+  }
+
+  void load_index(seg &s){
+    const csi_rec_segment_header* h = header(s);
+    s.end = std::min<uint64_t>(h->committed, s.len);
+    //follow the chain of index blocks back from the last one, then put them in order
+    for(uint64_t off = h->last_index; off != 0;){
+      const csi_rec_block* b = block_at(s, off);
+      if(!b || b->type != CSI_REC_INDEX || off + b->size > s.end) break;
+      const csi_rec_index_header* ih = reinterpret_cast<const csi_rec_index_header*>(b);
+      if(sizeof(csi_rec_index_header) + ih->count * sizeof(csi_rec_index_entry) > ih->size) break;
+      index_block ib;
+      ib.first_ns = ih->first_ns;
+      ib.last_ns = ih->last_ns;
+      ib.entries = reinterpret_cast<const csi_rec_index_entry*>(s.map + off + sizeof(csi_rec_index_header));
+      ib.count = ih->count;
+      s.blocks.push_back(ib);
+      if(ih->prev >= off) break;
+      off = ih->prev;
+    }
+    std::reverse(s.blocks.begin(), s.blocks.end());
+
+    //an unclosed segment can hold complete blocks past committed, and measurements after the last
+    //index block. walk them, indexing the measurements as we go
+    uint64_t off = h->last_index ? h->last_index : sizeof(csi_rec_segment_header);
+    if(h->last_index){
+      const csi_rec_block* b = block_at(s, off);
+      off = b ? off + b->size : s.end;
+    }
+    if(!(h->flags & CSI_REC_SEG_CLOSED)){
+      while(const csi_rec_block* b = block_at(s, off)){
+        if(b->type == CSI_REC_CSI && b->size >= sizeof(csi_rec_header)){
+          const csi_rec_header* rh = reinterpret_cast<const csi_rec_header*>(b);
+          csi_rec_index_entry e;
+          e.stamp_ns = rh->stamp_ns;
+          e.offset = off;
+          memcpy(e.mac, rh->mac, 6);
+          e.seq = rh->seq;
+          s.tail.push_back(e);
+        }
+        off += b->size;
+      }
+      s.end = std::max(s.end, off);
+    }
+    if(!s.tail.empty()){
+      index_block ib;
+      ib.first_ns = UINT64_MAX;
+      ib.last_ns = 0;
+      for(size_t i = 0; i < s.tail.size(); ++i){
+        ib.first_ns = std::min(ib.first_ns, s.tail[i].stamp_ns);
+        ib.last_ns = std::max(ib.last_ns, s.tail[i].stamp_ns);
+      }
+      ib.entries = s.tail.data();
+      ib.count = s.tail.size();
+      s.blocks.push_back(ib);
+    }
+
+    s.records = 0;
+    s.first_ns = UINT64_MAX;
+    s.last_ns = 0;
+    for(size_t i = 0; i < s.blocks.size(); ++i){
+      s.records += s.blocks[i].count;
+      s.first_ns = std::min(s.first_ns, s.blocks[i].first_ns);
+      s.last_ns = std::max(s.last_ns, s.blocks[i].last_ns);
+    }
+  }
+
+  std::vector<seg> segs;
+};
+
+#endif
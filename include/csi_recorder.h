@@ -0,0 +1,339 @@
+//
+// writes measurements to a segmented, memory-mapped recording, see csi_record_format.h
+//
+
+#ifndef WIROS_CSI_RECORDER_H
+#define WIROS_CSI_RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "csi_parser.h"
+#include "csi_record_format.h"
+
+struct csi_recorder_config {
+  //segments are prefix_00000.csir, prefix_00001.csir, ...
+  std::string prefix;
+  //space preallocated per segment
+  size_t segment_bytes = 256ull << 20;
+  //measurements per index block
+  size_t index_interval = 256;
+  //seconds between flushes of what has been written to disk, 0 leaves it to the kernel
+  double sync_period = 1.0;
+};
+
+//appends measurements to the current segment's mapping, and starts a new segment when it is full. a
+//background thread flushes the written range every sync_period and only then advances the segment
+//header's committed size, so the data path never waits on the disk and a crash loses at most one
+//period. safe to call from several threads, which take turns.
+class csi_recorder
+{
+public:
+  explicit csi_recorder(const csi_recorder_config &c) : cfg(c), cur(NULL), n_segments(0), recording_id(0), n_records(0),
+                                                         n_bytes(0), stopping(false){
+    if(cfg.index_interval < 1) cfg.index_interval = 1;
+    index_reserve = csi_rec_align(sizeof(csi_rec_index_header) + cfg.index_interval * sizeof(csi_rec_index_entry));
+    pending.reserve(cfg.index_interval);
+  }
+  ~csi_recorder(){
+    close();
+  }
+
+  //creates the first segment, false with err set if it can't
+  bool open(std::string &err){
+    //the largest measurement and a full index block have to fit after the header
+    size_t need = sizeof(csi_rec_segment_header) + csi_rec_size(16, CSI_MAX_NSUB) + index_reserve;
+    if(cfg.segment_bytes < need){
+      err = "segment size below " + std::to_string(need) + " bytes";
+      return false;
+    }
+    std::random_device rd;
+    recording_id = (uint64_t)rd() << 32 | rd();
+    std::lock_guard<std::mutex> lk(lock);
+    if(!start_segment(err)) return false;
+    if(cfg.sync_period > 0) sync_thread = std::thread(&csi_recorder::sync_loop, this);
+    return true;
+  }
+
+  //appends one measurement, false if it could not be written
+  bool write(const std::vector<csi_instance> &group, uint64_t stamp_ns){
+    const csi_instance &c0 = group.at(0);
+    const csi_instance* chains[16] = {NULL};
+    uint16_t mask = 0;
+    for(size_t i = 0; i < group.size(); ++i){
+      const csi_instance &c = group[i];
+      if(c.n_sub != c0.n_sub) continue;
+      int b = (c.tx & 3)*4 + (c.rx & 3);
+      chains[b] = &c;
+      mask |= 1 << b;
+    }
+    size_t size = csi_rec_size(csi_rec_chains(mask), c0.n_sub);
+
+    std::lock_guard<std::mutex> lk(lock);
+    if(!cur) return false;
+    if(cur->used + size + index_reserve > cfg.segment_bytes){
+      std::string err;
+      if(!roll(err)){
+        last_error = err;
+        return false;
+      }
+    }
+    uint64_t offset = cur->used;
+    uint8_t* p = cur->map + offset;
+    float* out = reinterpret_cast<float*>(p + sizeof(csi_rec_header));
+    for(int b = 0; b < 16; ++b){
+      if(!chains[b]) continue;
+      for(size_t k = 0; k < c0.n_sub; ++k) out[k] = (float)chains[b]->buf.csi_r[k];
+      out += c0.n_sub;
+      for(size_t k = 0; k < c0.n_sub; ++k) out[k] = (float)chains[b]->buf.csi_i[k];
+      out += c0.n_sub;
+    }
+    csi_rec_header* h = reinterpret_cast<csi_rec_header*>(p);
+    h->format = CSI_REC_FLOAT32;
+    h->size = size;
+    h->stamp_ns = stamp_ns;
+    memcpy(h->mac, c0.source_mac, 6);
+    h->seq = c0.seq;
+    h->chan = c0.channel;
+    h->bw = c0.bw;
+    h->rssi = c0.rssi;
+    h->fc = c0.fc;
+    h->chain_mask = mask;
+    h->n_sub = c0.n_sub;
+    __atomic_store_n(&h->type, (uint16_t)CSI_REC_CSI, __ATOMIC_RELEASE);
+    cur->used += size;
+
+    csi_rec_index_entry e;
+    e.stamp_ns = stamp_ns;
+    e.offset = offset;
+    memcpy(e.mac, c0.source_mac, 6);
+    e.seq = c0.seq;
+    pending.push_back(e);
+    if(cur->records == 0 || stamp_ns < cur->first_ns) cur->first_ns = stamp_ns;
+    if(cur->records == 0 || stamp_ns > cur->last_ns) cur->last_ns = stamp_ns;
+    ++cur->records;
+    ++n_records;
+    n_bytes += size;
+    if(pending.size() >= cfg.index_interval) write_index();
+    return true;
+  }
+
+  //indexes and flushes everything, closes the last segment and stops the sync thread
+  void close(){
+    {
+      std::lock_guard<std::mutex> lk(lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    if(sync_thread.joinable()) sync_thread.join();
+    std::lock_guard<std::mutex> lk(lock);
+    if(cur){
+      write_index();
+      retired.push_back(cur);
+      cur = NULL;
+    }
+    finish(retired);
+  }
+
+  uint64_t records(){
+    std::lock_guard<std::mutex> lk(lock);
+    return n_records;
+  }
+  uint64_t bytes(){
+    std::lock_guard<std::mutex> lk(lock);
+    return n_bytes;
+  }
+  uint32_t segments(){
+    std::lock_guard<std::mutex> lk(lock);
+    return n_segments;
+  }
+  //why the last write failed
+  std::string error(){
+    std::lock_guard<std::mutex> lk(lock);
+    return last_error;
+  }
+
+private:
+  csi_recorder(const csi_recorder&);
+  csi_recorder& operator=(const csi_recorder&);
+
+  struct segment {
+    int fd;
+    uint8_t* map;
+    uint32_t index;
+    uint64_t used;
+    uint64_t records;
+    uint64_t first_ns;
+    uint64_t last_ns;
+    uint64_t last_index;
+    //flushed to disk and recorded in the header
+    uint64_t synced;
+  };
+
+  //called with lock held
+  bool start_segment(std::string &err){
+    std::string path = csi_rec_segment_path(cfg.prefix, n_segments);
+    //never overwrite an earlier recording. later segments may be left over from a longer one, the
+    //recording id tells readers they don't belong to this one
+    int flags = O_RDWR | O_CREAT | O_CLOEXEC | (n_segments == 0 ? O_EXCL : O_TRUNC);
+    int fd = ::open(path.c_str(), flags, 0644);
+    if(fd < 0){
+      err = path + ": " + strerror(errno);
+      if(errno == EEXIST) err += ", remove it or choose another prefix";
+      return false;
+    }
+    //reserve the blocks now so the disk can't fill up under the mapping
+    int r = posix_fallocate(fd, 0, cfg.segment_bytes);
+    if(r != 0){
+      err = path + ": preallocating: " + strerror(r);
+      ::close(fd);
+      return false;
+    }
+    void* m = mmap(NULL, cfg.segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(m == MAP_FAILED){
+      err = path + ": mmap: " + strerror(errno);
+      ::close(fd);
+      return false;
+    }
+    madvise(m, cfg.segment_bytes, MADV_SEQUENTIAL);
+    segment* s = new segment();
+    s->fd = fd;
+    s->map = (uint8_t*)m;
+    s->index = n_segments++;
+    s->used = sizeof(csi_rec_segment_header);
+    s->records = 0;
+    s->first_ns = 0;
+    s->last_ns = 0;
+    s->last_index = 0;
+    s->synced = 0;
+    csi_rec_segment_header* h = reinterpret_cast<csi_rec_segment_header*>(s->map);
+    memset(h, 0, sizeof(*h));
+    h->magic = CSI_REC_MAGIC;
+    h->version = CSI_REC_VERSION;
+    h->segment = s->index;
+    h->committed = s->used;
+    h->recording = recording_id;
+    cur = s;
+    return true;
+  }
+
+  //called with lock held
+  bool roll(std::string &err){
+    write_index();
+    retired.push_back(cur);
+    cur = NULL;
+    //without a sync thread nobody else will close it
+    if(cfg.sync_period <= 0) finish(retired);
+    else wake.notify_all();
+    return start_segment(err);
+  }
+
+  //indexes the measurements written since the last index block. called with lock held
+  void write_index(){
+    if(!cur || pending.empty()) return;
+    size_t size = csi_rec_align(sizeof(csi_rec_index_header) + pending.size() * sizeof(csi_rec_index_entry));
+    uint8_t* p = cur->map + cur->used;
+    csi_rec_index_header* h = reinterpret_cast<csi_rec_index_header*>(p);
+    h->format = 0;
+    h->size = size;
+    h->first_ns = pending[0].stamp_ns;
+    h->last_ns = pending[0].stamp_ns;
+    for(size_t i = 1; i < pending.size(); ++i){
+      if(pending[i].stamp_ns < h->first_ns) h->first_ns = pending[i].stamp_ns;
+      if(pending[i].stamp_ns > h->last_ns) h->last_ns = pending[i].stamp_ns;
+    }
+    h->prev = cur->last_index;
+    h->count = pending.size();
+    h->pad = 0;
+    memcpy(p + sizeof(csi_rec_index_header), pending.data(), pending.size() * sizeof(csi_rec_index_entry));
+    __atomic_store_n(&h->type, (uint16_t)CSI_REC_INDEX, __ATOMIC_RELEASE);
+    cur->last_index = cur->used;
+    cur->used += size;
+    pending.clear();
+  }
+
+  //flushes s up to used, then records it in the header. the lock is not held while waiting on the disk
+  static void flush(segment* s, uint64_t used, uint64_t records, uint64_t first_ns, uint64_t last_ns,
+                    uint64_t last_index, bool closed){
+    //msync wants a page aligned start
+    size_t page = sysconf(_SC_PAGESIZE);
+    uint64_t from = s->synced & ~(uint64_t)(page - 1);
+    if(used > from) msync(s->map + from, used - from, MS_SYNC);
+    csi_rec_segment_header* h = reinterpret_cast<csi_rec_segment_header*>(s->map);
+    h->records = records;
+    h->first_ns = first_ns;
+    h->last_ns = last_ns;
+    h->last_index = last_index;
+    h->committed = used;
+    if(closed) h->flags |= CSI_REC_SEG_CLOSED;
+    msync(s->map, page, MS_SYNC);
+    s->synced = used;
+  }
+
+  //flushes, trims and closes finished segments, which nothing writes to any more
+  void finish(std::vector<segment*> &done){
+    for(size_t i = 0; i < done.size(); ++i){
+      segment* s = done[i];
+      flush(s, s->used, s->records, s->first_ns, s->last_ns, s->last_index, true);
+      munmap(s->map, cfg.segment_bytes);
+      if(ftruncate(s->fd, s->used) != 0){}
+      ::close(s->fd);
+      delete s;
+    }
+    done.clear();
+  }
+
+  void sync_loop(){
+    std::unique_lock<std::mutex> lk(lock);
+    std::vector<segment*> done;
+    while(!stopping){
+      wake.wait_for(lk, std::chrono::duration<double>(cfg.sync_period));
+      if(stopping) break;
+      done.swap(retired);
+      segment* s = cur;
+      uint64_t used = 0, records = 0, first_ns = 0, last_ns = 0, last_index = 0;
+      if(s){
+        used = s->used;
+        records = s->records;
+        first_ns = s->first_ns;
+        last_ns = s->last_ns;
+        last_index = s->last_index;
+      }
+      //writers carry on while the disk catches up. only this thread and close() (which waits for it)
+      //unmap segments, so s stays mapped even if it is retired meanwhile
+      lk.unlock();
+      finish(done);
+      if(s && used != s->synced) flush(s, used, records, first_ns, last_ns, last_index, false);
+      lk.lock();
+    }
+  }
+
+  csi_recorder_config cfg;
+  size_t index_reserve;
+  std::mutex lock;
+  std::condition_variable wake;
+  segment* cur;
+  std::vector<segment*> retired;
+  std::vector<csi_rec_index_entry> pending;
+  uint32_t n_segments;
+  uint64_t recording_id;
+  uint64_t n_records;
+  uint64_t n_bytes;
+  bool stopping;
+  std::thread sync_thread;
+  std::string last_error;
+};
+
+#endif
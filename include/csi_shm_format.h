@@ -0,0 +1,92 @@
+//
+// layout of the POSIX shared memory ring csi_node writes measurements to, shared by the writer and readers
+//
+// /dev/shm/<name> holds a csi_shm_header, CSI_SHM_MAX_READERS csi_shm_reader_entry, then n_slots slots of
+// slot_size bytes starting at data_offset. a slot is a csi_shm_slot_header followed by max_chains rows of
+// max_nsub complex64 values (float32 real, imaginary). the chains in chain_mask fill the first rows in
+// increasing order of tx*4 + rx, each holding n_sub values.
+//
+// measurement n (counting from 0) goes to slot n % n_slots. the slot's version is 2n+1 while it is
+// written and 2n+2 once it is complete, then head is set to n+1. a reader copies slot n out and checks
+// the version before and after, so a slot the writer lapped or is rewriting is detected, never waited
+// for. the writer never looks at the readers, they only report their position for diagnostics.
+// all fields are little endian and naturally aligned, so a slot maps directly onto a numpy dtype.
+//
+
+#ifndef WIROS_CSI_SHM_FORMAT_H
+#define WIROS_CSI_SHM_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CSI_SHM_MAGIC 0x4d485343u  //"CSHM"
+#define CSI_SHM_VERSION 1
+#define CSI_SHM_MAX_READERS 32
+#define CSI_SHM_ALIGN 64
+
+struct csi_shm_header {
+  //written last by the writer, a reader must not use the ring before it reads CSI_SHM_MAGIC
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_slots;
+  uint32_t slot_size;
+  uint16_t max_chains;
+  uint16_t max_nsub;
+  uint32_t data_offset;
+  uint32_t writer_pid;
+  uint8_t pad0[36];
+  //measurements written, on a cache line of its own
+  uint64_t head;
+  uint8_t pad1[56];
+};
+
+//one registered reader. pid is 0 for a free entry
+struct csi_shm_reader_entry {
+  uint32_t pid;
+  uint32_t pad0;
+  //the next measurement the reader will read
+  uint64_t next;
+  //times the reader fell a whole ring behind, and the measurements it lost to that
+  uint64_t overruns;
+  uint64_t lost;
+  uint8_t pad1[32];
+};
+
+struct csi_shm_slot_header {
+  uint64_t version;
+  //message stamp, ns since the epoch
+  uint64_t stamp_ns;
+  uint8_t mac[6];
+  //raw 802.11 sequence control, as in rf_msgs/Wifi
+  uint16_t seq;
+  uint8_t chan;
+  uint8_t fc;
+  int8_t rssi;
+  uint8_t n_chains;
+  //bandwidth in MHz
+  uint16_t bw;
+  //bit tx*4 + rx is set for every chain stored
+  uint16_t chain_mask;
+  uint16_t n_sub;
+  uint8_t pad[30];
+};
+
+static_assert(sizeof(csi_shm_header) == 128, "shm header layout");
+static_assert(sizeof(csi_shm_reader_entry) == 64, "shm reader layout");
+static_assert(sizeof(csi_shm_slot_header) == 64, "shm slot header layout");
+
+inline size_t csi_shm_slot_size(size_t max_chains, size_t max_nsub){
+  size_t n = sizeof(csi_shm_slot_header) + max_chains * max_nsub * 2 * sizeof(float);
+  return (n + CSI_SHM_ALIGN - 1) & ~(size_t)(CSI_SHM_ALIGN - 1);
+}
+
+inline size_t csi_shm_data_offset(){
+  return sizeof(csi_shm_header) + CSI_SHM_MAX_READERS * sizeof(csi_shm_reader_entry);
+}
+
+//version of a slot once measurement n is complete in it
+inline uint64_t csi_shm_done(uint64_t n){
+  return 2*n + 2;
+}
+
+#endif
@@ -0,0 +1,209 @@
+//
+// reads measurements from csi_node's shared memory ring, see csi_shm_format.h. header-only with no ROS
+// dependency, so any program on the host can read CSI without subscribing.
+//
+
+#ifndef WIROS_CSI_SHM_READER_H
+#define WIROS_CSI_SHM_READER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "csi_shm_format.h"
+
+//one measurement copied out of the ring
+struct csi_shm_measurement {
+  csi_shm_slot_header hdr;
+  //hdr.n_chains rows of hdr.n_sub complex values, float32 real and imaginary interleaved
+  std::vector<float> csi;
+
+  //the row of a chain, NULL if the measurement doesn't hold it
+  const float* chain(int tx, int rx) const{
+    int b = tx*4 + rx;
+    if(tx < 0 || tx > 3 || rx < 0 || rx > 3 || !(hdr.chain_mask & (1 << b))) return NULL;
+    size_t row = __builtin_popcount(hdr.chain_mask & ((1u << b) - 1));
+    if(row >= hdr.n_chains) return NULL;
+    return csi.data() + row * hdr.n_sub * 2;
+  }
+};
+
+//follows the ring from its own position. the writer never waits for it: if it falls more than a ring
+//behind, the measurements it missed are counted as lost and it carries on from the oldest one left.
+//
+//  csi_shm_reader r;
+//  std::string err;
+//  if(!r.open("/csi", err)) ...
+//  csi_shm_measurement m;
+//  while(r.wait(m, 1.0)) ...
+class csi_shm_reader
+{
+public:
+  csi_shm_reader() : fd(-1), map(NULL), map_len(0), entry(NULL), pos(0), n_overruns(0), n_lost(0){}
+  ~csi_shm_reader(){
+    close();
+  }
+
+  //maps the ring and registers as a reader. reading starts with the next measurement written, or with
+  //from_oldest the oldest one still in the ring. false with err set if the ring isn't there
+  bool open(const std::string &name, std::string &err, bool from_oldest = false){
+    close();
+    fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if(fd < 0){
+      err = name + ": " + strerror(errno);
+      return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < csi_shm_data_offset()){
+      err = name + ": not a CSI ring";
+      close();
+      return false;
+    }
+    map_len = st.st_size;
+    void* m = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(m == MAP_FAILED){
+      err = name + ": mmap: " + strerror(errno);
+      close();
+      return false;
+    }
+    map = (uint8_t*)m;
+    hdr = reinterpret_cast<csi_shm_header*>(map);
+    if(__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != CSI_SHM_MAGIC || hdr->version != CSI_SHM_VERSION ||
+       hdr->data_offset + (size_t)hdr->n_slots * hdr->slot_size > map_len ||
+       csi_shm_slot_size(hdr->max_chains, hdr->max_nsub) > hdr->slot_size){
+      err = name + ": not a CSI ring, or an unsupported version";
+      close();
+      return false;
+    }
+    uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    pos = head;
+    if(from_oldest) pos = head > hdr->n_slots ? head - hdr->n_slots : 0;
+    n_overruns = 0;
+    n_lost = 0;
+    //a reader that finds no free entry still works, it just isn't reported
+    csi_shm_reader_entry* tab = reinterpret_cast<csi_shm_reader_entry*>(map + sizeof(csi_shm_header));
+    for(int i = 0; i < CSI_SHM_MAX_READERS && !entry; ++i){
+      uint32_t free_pid = 0;
+      if(__atomic_compare_exchange_n(&tab[i].pid, &free_pid, (uint32_t)getpid(), false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        entry = &tab[i];
+    }
+    report();
+    return true;
+  }
+
+  //copies the next measurement to out, false if there is none yet. never blocks
+  bool read(csi_shm_measurement &out){
+    if(!map) return false;
+    for(;;){
+      uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+      if(pos >= head) return false;
+      if(head - pos > hdr->n_slots) skip(head - hdr->n_slots - pos);
+      const uint8_t* slot = map + hdr->data_offset + (pos % hdr->n_slots) * hdr->slot_size;
+      const csi_shm_slot_header* s = reinterpret_cast<const csi_shm_slot_header*>(slot);
+      uint64_t v = __atomic_load_n(&s->version, __ATOMIC_ACQUIRE);
+      if(v != csi_shm_done(pos)){
+        //the writer has moved on to this slot's next measurement
+        skip(1);
+        continue;
+      }
+      memcpy(&out.hdr, s, sizeof(out.hdr));
+      //a torn header can hold anything, so bound it before copying
+      size_t chains = out.hdr.n_chains < hdr->max_chains ? out.hdr.n_chains : hdr->max_chains;
+      size_t n_sub = out.hdr.n_sub < hdr->max_nsub ? out.hdr.n_sub : hdr->max_nsub;
+      out.csi.resize(chains * n_sub * 2);
+      const float* in = reinterpret_cast<const float*>(slot + sizeof(csi_shm_slot_header));
+      for(size_t r = 0; r < chains; ++r)
+        memcpy(out.csi.data() + r * n_sub * 2, in + r * hdr->max_nsub * 2, n_sub * 2 * sizeof(float));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if(__atomic_load_n(&s->version, __ATOMIC_RELAXED) != v){
+        skip(1);
+        continue;
+      }
+      ++pos;
+      report();
+      return true;
+    }
+  }
+
+  //polls read until a measurement arrives or timeout_s passes
+  bool wait(csi_shm_measurement &out, double timeout_s, int poll_us = 100){
+    auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout_s);
+    while(!read(out)){
+      if(std::chrono::steady_clock::now() >= end || stale()) return false;
+      std::this_thread::sleep_for(std::chrono::microseconds(poll_us));
+    }
+    return true;
+  }
+
+  //measurements written that haven't been read yet
+  uint64_t lag() const{
+    if(!map) return 0;
+    uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    return head > pos ? head - pos : 0;
+  }
+  //times the reader fell behind the writer, and the measurements it missed because of it
+  uint64_t overruns() const{
+    return n_overruns;
+  }
+  uint64_t lost() const{
+    return n_lost;
+  }
+
+  //true once the writer removed the ring (or replaced it on restart), open it again to carry on
+  bool stale() const{
+    struct stat st;
+    return fd < 0 || fstat(fd, &st) != 0 || st.st_nlink == 0;
+  }
+
+  //ring geometry
+  const csi_shm_header* header() const{
+    return map ? hdr : NULL;
+  }
+
+  //unregisters and unmaps
+  void close(){
+    if(entry) __atomic_store_n(&entry->pid, 0u, __ATOMIC_RELEASE);
+    entry = NULL;
+    if(map) munmap(map, map_len);
+    map = NULL;
+    if(fd >= 0) ::close(fd);
+    fd = -1;
+  }
+
+private:
+  csi_shm_reader(const csi_shm_reader&);
+  csi_shm_reader& operator=(const csi_shm_reader&);
+
+  void skip(uint64_t n){
+    pos += n;
+    n_lost += n;
+    ++n_overruns;
+    report();
+  }
+
+  void report(){
+    if(!entry) return;
+    __atomic_store_n(&entry->next, pos, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->overruns, n_overruns, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->lost, n_lost, __ATOMIC_RELAXED);
+  }
+
+  int fd;
+  uint8_t* map;
+  size_t map_len;
+  csi_shm_header* hdr;
+  csi_shm_reader_entry* entry;
+  uint64_t pos;
+  uint64_t n_overruns;
+  uint64_t n_lost;
+};
+
+#endif
@@ -0,0 +1,204 @@
+//
+// writes measurements to a POSIX shared memory ring for consumers on the same host, see csi_shm_format.h
+//
+
+#ifndef WIROS_CSI_SHM_WRITER_H
+#define WIROS_CSI_SHM_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "csi_parser.h"
+#include "csi_shm_format.h"
+
+struct csi_shm_config {
+  //shm_open name, e.g. "/csi"
+  std::string name;
+  uint32_t n_slots = 1024;
+  //largest measurement a slot holds, chains beyond max_chains are left out and wider
+  //measurements are not written
+  uint16_t max_chains = 16;
+  uint16_t max_nsub = 256;
+};
+
+//a reader's position, as it last reported it
+struct csi_shm_reader_info {
+  uint32_t pid;
+  //measurements written that it hasn't read yet
+  uint64_t lag;
+  uint64_t overruns;
+  uint64_t lost;
+};
+
+//overwrites the oldest slot with every measurement, without regard for the readers. safe to call from
+//several threads, which take turns.
+class csi_shm_writer
+{
+public:
+  explicit csi_shm_writer(const csi_shm_config &c) : cfg(c), map(NULL), map_len(0), n_written(0), n_skipped(0){}
+  ~csi_shm_writer(){
+    close();
+  }
+
+  //creates the ring, replacing any left behind by an earlier run. false with err set if it can't
+  bool open(std::string &err){
+    if(cfg.n_slots < 2 || cfg.max_chains < 1 || cfg.max_chains > 16 || cfg.max_nsub < 1){
+      err = "invalid ring size";
+      return false;
+    }
+    slot_size = csi_shm_slot_size(cfg.max_chains, cfg.max_nsub);
+    map_len = csi_shm_data_offset() + (size_t)cfg.n_slots * slot_size;
+    //readers of an old ring keep their mapping, and notice it was unlinked
+    shm_unlink(cfg.name.c_str());
+    int fd = shm_open(cfg.name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fd < 0){
+      err = cfg.name + ": " + strerror(errno);
+      return false;
+    }
+    if(ftruncate(fd, map_len) != 0){
+      err = cfg.name + ": " + strerror(errno);
+      ::close(fd);
+      shm_unlink(cfg.name.c_str());
+      return false;
+    }
+    void* m = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(m == MAP_FAILED){
+      err = cfg.name + ": mmap: " + strerror(errno);
+      shm_unlink(cfg.name.c_str());
+      return false;
+    }
+    map = (uint8_t*)m;
+    hdr = reinterpret_cast<csi_shm_header*>(map);
+    readers_tab = reinterpret_cast<csi_shm_reader_entry*>(map + sizeof(csi_shm_header));
+    hdr->version = CSI_SHM_VERSION;
+    hdr->n_slots = cfg.n_slots;
+    hdr->slot_size = slot_size;
+    hdr->max_chains = cfg.max_chains;
+    hdr->max_nsub = cfg.max_nsub;
+    hdr->data_offset = csi_shm_data_offset();
+    hdr->writer_pid = getpid();
+    hdr->head = 0;
+    __atomic_store_n(&hdr->magic, CSI_SHM_MAGIC, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  //writes one measurement, false if it is too wide for the slots
+  bool write(const std::vector<csi_instance> &group, uint64_t stamp_ns){
+    const csi_instance &c0 = group.at(0);
+    if(c0.n_sub > cfg.max_nsub){
+      std::lock_guard<std::mutex> lk(lock);
+      ++n_skipped;
+      return false;
+    }
+    const csi_instance* chains[16] = {NULL};
+    for(size_t i = 0; i < group.size(); ++i){
+      const csi_instance &c = group[i];
+      if(c.n_sub == c0.n_sub) chains[(c.tx & 3)*4 + (c.rx & 3)] = &c;
+    }
+
+    std::lock_guard<std::mutex> lk(lock);
+    if(!map) return false;
+    uint64_t n = n_written;
+    csi_shm_slot_header* s = reinterpret_cast<csi_shm_slot_header*>(map + hdr->data_offset + (n % cfg.n_slots) * slot_size);
+    //odd while the slot is being rewritten, the fence keeps the data writes after it
+    __atomic_store_n(&s->version, csi_shm_done(n) - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    float* out = reinterpret_cast<float*>(s + 1);
+    uint16_t mask = 0;
+    size_t row = 0;
+    for(int b = 0; b < 16 && row < cfg.max_chains; ++b){
+      if(!chains[b]) continue;
+      const double* re = chains[b]->buf.csi_r;
+      const double* im = chains[b]->buf.csi_i;
+      float* o = out + row * cfg.max_nsub * 2;
+      for(size_t k = 0; k < c0.n_sub; ++k){
+        o[2*k] = (float)re[k];
+        o[2*k + 1] = (float)im[k];
+      }
+      mask |= 1 << b;
+      ++row;
+    }
+    s->stamp_ns = stamp_ns;
+    memcpy(s->mac, c0.source_mac, 6);
+    s->seq = c0.seq;
+    s->chan = c0.channel;
+    s->fc = c0.fc;
+    s->rssi = c0.rssi;
+    s->n_chains = row;
+    s->bw = c0.bw;
+    s->chain_mask = mask;
+    s->n_sub = c0.n_sub;
+    __atomic_store_n(&s->version, csi_shm_done(n), __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->head, n + 1, __ATOMIC_RELEASE);
+    n_written = n + 1;
+    return true;
+  }
+
+  //the registered readers. entries of readers that exited without unregistering are freed
+  std::vector<csi_shm_reader_info> readers(){
+    std::vector<csi_shm_reader_info> out;
+    std::lock_guard<std::mutex> lk(lock);
+    if(!map) return out;
+    for(int i = 0; i < CSI_SHM_MAX_READERS; ++i){
+      csi_shm_reader_entry &e = readers_tab[i];
+      uint32_t pid = __atomic_load_n(&e.pid, __ATOMIC_ACQUIRE);
+      if(!pid) continue;
+      if(kill(pid, 0) != 0 && errno == ESRCH){
+        __atomic_compare_exchange_n(&e.pid, &pid, 0u, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+        continue;
+      }
+      uint64_t next = __atomic_load_n(&e.next, __ATOMIC_RELAXED);
+      csi_shm_reader_info r;
+      r.pid = pid;
+      r.lag = n_written > next ? n_written - next : 0;
+      r.overruns = __atomic_load_n(&e.overruns, __ATOMIC_RELAXED);
+      r.lost = __atomic_load_n(&e.lost, __ATOMIC_RELAXED);
+      out.push_back(r);
+    }
+    return out;
+  }
+
+  uint64_t written(){
+    std::lock_guard<std::mutex> lk(lock);
+    return n_written;
+  }
+  //measurements too wide for the slots
+  uint64_t skipped(){
+    std::lock_guard<std::mutex> lk(lock);
+    return n_skipped;
+  }
+
+  //unmaps and removes the ring, readers keep what they have mapped
+  void close(){
+    std::lock_guard<std::mutex> lk(lock);
+    if(!map) return;
+    munmap(map, map_len);
+    shm_unlink(cfg.name.c_str());
+    map = NULL;
+  }
+
+private:
+  csi_shm_writer(const csi_shm_writer&);
+  csi_shm_writer& operator=(const csi_shm_writer&);
+
+  csi_shm_config cfg;
+  std::mutex lock;
+  uint8_t* map;
+  size_t map_len;
+  size_t slot_size;
+  csi_shm_header* hdr;
+  csi_shm_reader_entry* readers_tab;
+  uint64_t n_written;
+  uint64_t n_skipped;
+};
+
+#endif
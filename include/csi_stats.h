@@ -0,0 +1,211 @@
+//
+// lock-free counters and latency histograms for the CSI data path
+//
+
+#ifndef WIROS_CSI_STATS_H
+#define WIROS_CSI_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+//16 sub-buckets per power of two, so a recorded value is off by at most 1/16
+#define CSI_HIST_SUB_BITS 4
+#define CSI_HIST_SUB (1 << CSI_HIST_SUB_BITS)
+//values are nanoseconds, anything above 2^40 (~18 minutes) lands in the last bucket
+#define CSI_HIST_MAX_BITS 40
+#define CSI_HIST_BUCKETS ((CSI_HIST_MAX_BITS - CSI_HIST_SUB_BITS + 1) * CSI_HIST_SUB)
+
+inline uint64_t csi_mono_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+//wall clock, the clock kernel receive timestamps and message stamps are on
+inline uint64_t csi_real_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+//single-writer add: only the owning thread writes, readers load whenever they like
+inline void csi_stat_add(std::atomic<uint64_t> &c, uint64_t n){
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+//log-linear (HDR-style) histogram of nanosecond values, written by one thread
+class csi_histogram
+{
+public:
+  csi_histogram(){
+    for(size_t i = 0; i < CSI_HIST_BUCKETS; ++i) counts[i].store(0, std::memory_order_relaxed);
+  }
+
+  static size_t bucket(uint64_t v){
+    if(v < CSI_HIST_SUB) return v;
+    int msb = 63 - __builtin_clzll(v);
+    if(msb >= CSI_HIST_MAX_BITS) return CSI_HIST_BUCKETS - 1;
+    int shift = msb - CSI_HIST_SUB_BITS;
+    return (shift + 1) * CSI_HIST_SUB + ((v >> shift) & (CSI_HIST_SUB - 1));
+  }
+  //smallest value that lands in bucket i
+  static uint64_t bucket_floor(size_t i){
+    if(i < CSI_HIST_SUB) return i;
+    int shift = i / CSI_HIST_SUB - 1;
+    return (uint64_t)(CSI_HIST_SUB + i % CSI_HIST_SUB) << shift;
+  }
+
+  void record(uint64_t v){
+    csi_stat_add(counts[bucket(v)], 1);
+  }
+
+  std::atomic<uint64_t> counts[CSI_HIST_BUCKETS];
+};
+
+//counts summed over histograms, e.g. every thread's, or the difference between two reports
+struct csi_hist_snapshot
+{
+  std::vector<uint64_t> counts;
+  csi_hist_snapshot() : counts(CSI_HIST_BUCKETS, 0){}
+
+  void add(const csi_histogram &h){
+    for(size_t i = 0; i < CSI_HIST_BUCKETS; ++i) counts[i] += h.counts[i].load(std::memory_order_relaxed);
+  }
+  uint64_t total() const{
+    uint64_t n = 0;
+    for(size_t i = 0; i < CSI_HIST_BUCKETS; ++i) n += counts[i];
+    return n;
+  }
+  //value at quantile q (0-1), reported as the midpoint of its bucket
+  uint64_t quantile(double q) const{
+    uint64_t n = total();
+    if(n == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (n - 1)) + 1;
+    uint64_t seen = 0;
+    for(size_t i = 0; i < CSI_HIST_BUCKETS; ++i){
+      seen += counts[i];
+      if(seen < rank) continue;
+      uint64_t lo = csi_histogram::bucket_floor(i);
+      return i + 1 < CSI_HIST_BUCKETS ? (lo + csi_histogram::bucket_floor(i + 1)) / 2 : lo;
+    }
+    return csi_histogram::bucket_floor(CSI_HIST_BUCKETS - 1);
+  }
+  //counts recorded since prev
+  csi_hist_snapshot since(const csi_hist_snapshot &prev) const{
+    csi_hist_snapshot d;
+    for(size_t i = 0; i < CSI_HIST_BUCKETS; ++i) d.counts[i] = counts[i] - prev.counts[i];
+    return d;
+  }
+};
+
+enum csi_counter {
+  CSI_STAT_FRAMES_RECEIVED,
+  CSI_STAT_MAC_FILTERED,
+  CSI_STAT_BAD_BW,
+  CSI_STAT_TRUNCATED,
+  CSI_STAT_POOL_EXHAUSTED,
+  CSI_STAT_QUEUE_DROPPED,
+  CSI_STAT_PARTIAL_FLUSHED,
+  CSI_STAT_MSGS_PUBLISHED,
+  CSI_STAT_N_COUNTERS
+};
+
+enum csi_latency {
+  CSI_LAT_SOCKET_TO_DECODE,  //datagram received until its decode starts, i.e. time queued
+  CSI_LAT_DECODE,            //decoding one frame
+  CSI_LAT_REASSEMBLY,        //first frame of a measurement decoded until the measurement is complete
+  CSI_LAT_PUBLISH,           //building, serializing and publishing one message
+  CSI_LAT_ARRIVAL,           //first frame of a measurement received until its message is published
+  CSI_LAT_N
+};
+
+inline const char* csi_counter_name(int c){
+  static const char* names[CSI_STAT_N_COUNTERS] = {
+    "frames received", "frames dropped by MAC filter", "bad bandwidth frames", "truncated frames",
+    "frames dropped, pool exhausted", "frames dropped, queue full", "partial measurements flushed", "messages published"
+  };
+  return names[c];
+}
+
+inline const char* csi_latency_name(int l){
+  static const char* names[CSI_LAT_N] = {"socket to decode", "decode", "reassembly wait", "publish", "arrival to publish"};
+  return names[l];
+}
+
+//everything one thread records, cache-line aligned so threads never share a line
+struct alignas(64) csi_thread_stats
+{
+  std::atomic<uint64_t> counters[CSI_STAT_N_COUNTERS];
+  csi_histogram latency[CSI_LAT_N];
+  csi_thread_stats(){
+    for(int i = 0; i < CSI_STAT_N_COUNTERS; ++i) counters[i].store(0, std::memory_order_relaxed);
+  }
+  void count(csi_counter c, uint64_t n = 1){
+    csi_stat_add(counters[c], n);
+  }
+};
+
+//per-thread stats blocks, created the first time a thread records anything. recording never
+//locks or shares a cache line, reporting sums every block.
+class csi_stats
+{
+public:
+  csi_stats() : id(next_id().fetch_add(1) + 1){}
+  ~csi_stats(){
+    for(size_t i = 0; i < blocks.size(); ++i){
+      blocks[i]->~csi_thread_stats();
+      free(blocks[i]);
+    }
+  }
+
+  //the calling thread's block
+  csi_thread_stats &local(){
+    //keyed by id rather than address, a new csi_stats can reuse a deleted one's address
+    static thread_local uint64_t owner = 0;
+    static thread_local csi_thread_stats* block = NULL;
+    if(owner != id){
+      std::lock_guard<std::mutex> lk(lock);
+      //plain new doesn't honour the alignment before c++17
+      void* mem = NULL;
+      if(posix_memalign(&mem, 64, sizeof(csi_thread_stats)) != 0) throw std::bad_alloc();
+      block = new(mem) csi_thread_stats();
+      blocks.push_back(block);
+      owner = id;
+    }
+    return *block;
+  }
+
+  //totals over every thread
+  void counters(uint64_t out[CSI_STAT_N_COUNTERS]){
+    std::lock_guard<std::mutex> lk(lock);
+    for(int c = 0; c < CSI_STAT_N_COUNTERS; ++c){
+      out[c] = 0;
+      for(size_t i = 0; i < blocks.size(); ++i) out[c] += blocks[i]->counters[c].load(std::memory_order_relaxed);
+    }
+  }
+  void latency(csi_latency l, csi_hist_snapshot &out){
+    std::lock_guard<std::mutex> lk(lock);
+    out = csi_hist_snapshot();
+    for(size_t i = 0; i < blocks.size(); ++i) out.add(blocks[i]->latency[l]);
+  }
+
+private:
+  csi_stats(const csi_stats&);
+  csi_stats& operator=(const csi_stats&);
+  static std::atomic<uint64_t> &next_id(){
+    static std::atomic<uint64_t> n(0);
+    return n;
+  }
+
+  uint64_t id;
+  std::mutex lock;
+  std::vector<csi_thread_stats*> blocks;
+};
+
+#endif
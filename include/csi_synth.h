@@ -0,0 +1,254 @@
+//
+// synthetic nexmon CSI udp traffic, a stand-in for the ASUS when load testing csi_node
+//
+
+#ifndef WIROS_CSI_SYNTH_H
+#define WIROS_CSI_SYNTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+#include "csi_parser.h"
+
+#define CSI_SYNTH_MAX_FRAME (sizeof(csi_udp_frame) + CSI_MAX_NSUB*sizeof(uint32_t))
+//datagrams handed to the kernel per sendmmsg call
+#define CSI_SYNTH_BATCH 64
+
+enum csi_synth_seq {
+  CSI_SEQ_INC,     //sequence number increments every measurement, like a real transmitter
+  CSI_SEQ_CONST,   //every measurement has the same sequence number, only repeated chains split them
+  CSI_SEQ_RANDOM   //random sequence number per measurement
+};
+
+struct csi_synth_config {
+  int bw = 80;
+  int channel = 157;
+  //chains to report, bit i of core_mask is rx core i, bit i of nss_mask is spatial stream (tx) i
+  uint8_t core_mask = 0x0f;
+  uint8_t nss_mask = 0x0f;
+  //number of transmitters, with MACs 02:00:00:00:xx:xx
+  int n_macs = 1;
+  csi_synth_seq seq_mode = CSI_SEQ_INC;
+  //probability of dropping a frame, and of swapping a frame with one of the next reorder_depth frames
+  double loss = 0.0;
+  double reorder = 0.0;
+  int reorder_depth = 4;
+  uint64_t seed = 1;
+};
+
+inline bool csi_synth_seq_mode(const std::string &s, csi_synth_seq &mode){
+  if(s == "inc") mode = CSI_SEQ_INC;
+  else if(s == "const") mode = CSI_SEQ_CONST;
+  else if(s == "random") mode = CSI_SEQ_RANDOM;
+  else return false;
+  return true;
+}
+
+struct csi_synth_frame {
+  size_t len;
+  //transmitter index and sequence number (without the fragment bits) of the measurement
+  uint16_t mac_idx;
+  uint16_t seq;
+  //the first frame of its measurement that wasn't dropped
+  bool first;
+  unsigned char data[CSI_SYNTH_MAX_FRAME];
+};
+
+//generates the frames nexmon would send for a stream of measurements, with optional loss and reordering
+class csi_synth
+{
+public:
+  explicit csi_synth(const csi_synth_config &c) : cfg(c), rng(c.seed ? c.seed : 1){
+    uint8_t bw_code = 0;
+    for(uint8_t i = 0; i < 8; ++i){
+      if(csi_bw_mhz[i] == cfg.bw) bw_code = i;
+    }
+    valid = bw_code != 0 && cfg.n_macs > 0 && cfg.n_macs <= 65536 && (cfg.core_mask & 0x0f) && (cfg.nss_mask & 0x0f);
+    n_sub = csi_bw_nsub[bw_code];
+    //bits 14-15 are the band, 5GHz above channel 14
+    chanspec = (cfg.channel > 14 ? 0xc000 : 0) | (bw_code << 11) | (cfg.channel & 0xff);
+    seqs.assign(cfg.n_macs > 0 ? cfg.n_macs : 1, 0);
+    //one block of CSI words per chain, reused for every measurement
+    for(int b = 0; b < 16; ++b){
+      for(size_t k = 0; k < CSI_MAX_NSUB; ++k) csi_words[b][k] = (uint32_t)next_rand();
+    }
+    mac_next = 0;
+    generated = 0;
+    lost = 0;
+  }
+
+  //false if the bandwidth, chain masks or MAC count can't be generated
+  bool ok() const{
+    return valid;
+  }
+
+  //copies the next frame to send into f
+  void next(csi_synth_frame &f){
+    while(window.size() <= (size_t)cfg.reorder_depth) generate();
+    if(cfg.reorder > 0 && window.size() > 1 && uniform() < cfg.reorder){
+      size_t j = 1 + next_rand() % (window.size() - 1);
+      std::swap(window[0], window[j]);
+    }
+    memcpy(&f, &window.front(), offsetof(csi_synth_frame, data) + window.front().len);
+    window.pop_front();
+  }
+
+  //frames generated, and frames of those dropped by the loss setting
+  uint64_t frames_generated() const{
+    return generated;
+  }
+  uint64_t frames_lost() const{
+    return lost;
+  }
+  uint16_t subcarriers() const{
+    return n_sub;
+  }
+
+private:
+  //appends one measurement from the next transmitter
+  void generate(){
+    uint16_t mac_idx = mac_next;
+    mac_next = (mac_next + 1) % cfg.n_macs;
+    uint16_t seq = seqs[mac_idx];
+    if(cfg.seq_mode == CSI_SEQ_INC) seqs[mac_idx] = (seq + 1) & 0x0fff;
+    else if(cfg.seq_mode == CSI_SEQ_RANDOM) seq = next_rand() & 0x0fff;
+
+    bool first = true;
+    for(int tx = 0; tx < 4; ++tx){
+      if(!(cfg.nss_mask & (1 << tx))) continue;
+      for(int rx = 0; rx < 4; ++rx){
+        if(!(cfg.core_mask & (1 << rx))) continue;
+        ++generated;
+        if(cfg.loss > 0 && uniform() < cfg.loss){
+          ++lost;
+          continue;
+        }
+        window.emplace_back();
+        csi_synth_frame &f = window.back();
+        f.mac_idx = mac_idx;
+        f.seq = seq;
+        f.first = first;
+        first = false;
+
+        csi_udp_frame hdr;
+        hdr.kk1 = 0x11;
+        hdr.id = 0x11;
+        hdr.rssi = -40 - (int8_t)(next_rand() % 30);
+        hdr.fc = 0x08;
+        hdr.src_mac[0] = 0x02;
+        hdr.src_mac[1] = 0;
+        hdr.src_mac[2] = 0;
+        hdr.src_mac[3] = 0;
+        hdr.src_mac[4] = mac_idx >> 8;
+        hdr.src_mac[5] = mac_idx & 0xff;
+        //802.11 sequence control, the low 4 bits are the fragment number
+        hdr.seqCnt = seq << 4;
+        hdr.csiconf = (tx << 11) | (rx << 8);
+        hdr.chanspec = chanspec;
+        hdr.chip = 0x4366;
+        memcpy(f.data, &hdr, sizeof(hdr));
+        memcpy(f.data + sizeof(hdr), csi_words[tx*4 + rx], n_sub*sizeof(uint32_t));
+        f.len = sizeof(hdr) + n_sub*sizeof(uint32_t);
+      }
+    }
+  }
+
+  //xorshift64, deterministic for a given seed
+  uint64_t next_rand(){
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+  }
+  double uniform(){
+    return (next_rand() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  csi_synth_config cfg;
+  uint64_t rng;
+  bool valid;
+  uint16_t n_sub;
+  uint16_t chanspec;
+  uint16_t mac_next;
+  std::vector<uint16_t> seqs;
+  std::deque<csi_synth_frame> window;
+  uint32_t csi_words[16][CSI_MAX_NSUB];
+  uint64_t generated;
+  uint64_t lost;
+};
+
+inline uint64_t csi_synth_now_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+//sends frames to dst on fd at rate frames per second for duration seconds (0 to run until stop is set),
+//in batches of up to CSI_SYNTH_BATCH. on_sent(frame, time_ns) is called for every frame once it is sent.
+//returns the number of frames sent.
+template<typename F>
+uint64_t csi_synth_send(csi_synth &synth, int fd, const struct sockaddr_in &dst, double rate, double duration,
+                        const std::atomic<bool> &stop, F on_sent){
+  std::vector<csi_synth_frame> batch(CSI_SYNTH_BATCH);
+  struct mmsghdr msgs[CSI_SYNTH_BATCH];
+  struct iovec iovs[CSI_SYNTH_BATCH];
+  memset(msgs, 0, sizeof(msgs));
+  for(int i = 0; i < CSI_SYNTH_BATCH; ++i){
+    iovs[i].iov_base = batch[i].data;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = const_cast<struct sockaddr_in*>(&dst);
+    msgs[i].msg_hdr.msg_namelen = sizeof(dst);
+  }
+
+  uint64_t start = csi_synth_now_ns();
+  uint64_t end = duration > 0 ? start + (uint64_t)(duration*1e9) : UINT64_MAX;
+  uint64_t sent = 0;
+  while(!stop){
+    uint64_t now = csi_synth_now_ns();
+    if(now >= end) break;
+    //frames that should have gone out by now
+    uint64_t due = (uint64_t)((now - start) * 1e-9 * rate) + 1;
+    if(due <= sent){
+      uint64_t wake = start + (uint64_t)((sent / rate) * 1e9);
+      struct timespec ts;
+      ts.tv_sec = wake / 1000000000ull;
+      ts.tv_nsec = wake % 1000000000ull;
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+      continue;
+    }
+    int n = due - sent < CSI_SYNTH_BATCH ? (int)(due - sent) : CSI_SYNTH_BATCH;
+    for(int i = 0; i < n; ++i){
+      synth.next(batch[i]);
+      iovs[i].iov_len = batch[i].len;
+    }
+    int done = 0;
+    while(done < n){
+      int r = sendmmsg(fd, msgs + done, n - done, 0);
+      if(r < 0){
+        //the socket buffer is full, wait for the kernel to drain it
+        if(errno == EAGAIN || errno == ENOBUFS || errno == EINTR){
+          usleep(10);
+          continue;
+        }
+        return sent;
+      }
+      uint64_t t = csi_synth_now_ns();
+      for(int i = done; i < done + r; ++i) on_sent(batch[i], t);
+      done += r;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+#endif
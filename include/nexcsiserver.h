@@ -12,6 +12,10 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <ros/ros.h>
@@ -23,156 +27,483 @@
 #include <stdio.h>
 #include <ctime>
 #include <regex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <pthread.h>
+#include <algorithm>
 
 //https://github.com/ucsdwcsng/rf_msgs.git
 #include "rf_msgs/Wifi.h"
 #include "shutils.h"
 #include "utils.h"
+#include "spsc_queue.h"
+#include "csi_decode.h"
+#include "csi_pool.h"
+#include "csi_parser.h"
+#include "pcap_stream.h"
+#include "csi_stats.h"
+#include "csi_reassembly.h"
+#include "csi_mac_table.h"
+#include "csi_bpf.h"
+#include "csi_packet_ring.h"
+#include "csi_recorder.h"
+#include "csi_shm_writer.h"
+#include "csi_batcher.h"
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include "wiros_csi_node/ConfigureCSI.h"
 #include "rf_msgs/Station.h"
 #include "rf_msgs/AccessPoints.h"
 
 #define SA struct sockaddr
 
-#define MAXLINE 1024
 #define CSI_BUF_SIZE 4096
 #define PORT 5500
 #define PORT_TCP 50005
-#define CSI_HDR_START_CMP "\x0a\x0a\x0a\x0a\xff\xff\xff\xff"
-#define NO_HDR_IN_BUF -1
-#define NEW_CSI_HDR 8
-#define CSI_OFFSET 16
+//bytes requested from the tcpdump stream per read
+#define TCP_READ_SIZE 65536
+
+//batched udp receive: max datagrams drained per recvmmsg call
+#define RECV_BATCH_MAX 1024
+//room for the ancillary data (SO_RXQ_OVFL drop counter, SO_TIMESTAMPNS receive time) of each datagram
+#define CSI_CMSG_SIZE 128
 
 #define k_tof_unpack_sgn_mask (1<<31)
 #define H_OFFSET 64
 #define TIMESTAMP_BYTE_OFFSET 42
 
-#define stop() signal(2)
 
-const char* chan_arg = "-c";
-const char* bw_arg = "-b";
-const char* mac_arg = "-m";
-const char* rx_arg = "-r";
+const char* const chan_arg = "-c";
+const char* const bw_arg = "-b";
+const char* const mac_arg = "-m";
+const char* const rx_arg = "-r";
 
+//pre-allocated frame slots for draining many udp datagrams per recvmmsg call
+class csi_rx_batch
+{
+public:
+    size_t n_slots;
+    unsigned char* frames;
+    unsigned char* ctrl;
+    struct mmsghdr* msgs;
+    struct iovec* iovs;
+    csi_rx_batch(size_t n){
+      n_slots = n;
+      frames = new unsigned char[n*CSI_BUF_SIZE];
+      ctrl = new unsigned char[n*CSI_CMSG_SIZE];
+      msgs = new struct mmsghdr[n];
+      iovs = new struct iovec[n];
+      memset(msgs, 0, n*sizeof(struct mmsghdr));
+      for(size_t i = 0; i < n; ++i){
+        iovs[i].iov_base = frames + i*CSI_BUF_SIZE;
+        iovs[i].iov_len = CSI_BUF_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+      reset();
+    }
+    ~csi_rx_batch(){
+      delete[] frames;
+      delete[] ctrl;
+      delete[] msgs;
+      delete[] iovs;
+    }
+    //the kernel overwrites msg_controllen on every call, so restore it before the next one
+    void reset(){
+      for(size_t i = 0; i < n_slots; ++i){
+        msgs[i].msg_hdr.msg_control = ctrl + i*CSI_CMSG_SIZE;
+        msgs[i].msg_hdr.msg_controllen = CSI_CMSG_SIZE;
+        msgs[i].msg_len = 0;
+      }
+    }
+    unsigned char* frame(size_t i){
+      return frames + i*CSI_BUF_SIZE;
+    }
+};
 
-//111111 - exponent of 
-const uint32_t e_mask = (1<<6)-1;
-//111111111111
-const uint32_t mantissa_mask = (1<<12)-1;
-//1
-const uint32_t sign_mask = 1;
-//111111111111000000
-const uint32_t r_mant_mask = (((1<<11) - 1) << 18);
-//same for imag
-const uint32_t i_mant_mask = (((1<<11) - 1) << 6);
-//
-const uint32_t r_sign_mask = (1<<29);
-const uint32_t i_sign_mask = (1<<17);
+//a received datagram waiting in the pipeline for the decode thread
+struct csi_raw_frame {
+    size_t len;
+    ros::Time stamp;
+    //monotonic time the datagram was received
+    uint64_t rx_ns;
+    //index of the sending router in multi-router mode
+    uint16_t router;
+    unsigned char data[CSI_BUF_SIZE];
+};
 
-const uint32_t count_mask = (1<<10);
-const uint32_t mant_mask = (1<<10)-1;
+//the MAC filter table, and a publisher for every entry with its own topic
+struct csi_mac_routing {
+  csi_mac_table table;
+  std::vector<ros::Publisher> pubs;
+};
 
-//holds the remote client's ssh process so we can shut it down properly
-FILE* cli_fp = NULL;
-//same for the TX process
-FILE* tx_fp = NULL;
+//one router in multi-router mode. a router is owned by a single worker thread, which decodes,
+//groups and publishes everything it sends.
+struct csi_router {
+    std::string ip;
+    in_addr_t addr;
+    int worker;
+    ros::Publisher pub;
+    //in-flight measurements, only touched by the owning worker
+    csi_reassembler* reassembly = NULL;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> msgs;
+    uint64_t frames_reported = 0;
+    //tcp_forward: this router's tcpdump process, connection and pcap stream
+    FILE* cli_fp = NULL;
+    int connfd = -1;
+    pcap_stream stream;
+    csi_router() : frames(0), msgs(0){}
+    ~csi_router(){
+      delete reassembly;
+    }
+};
 
-class csi_instance
+//the CSI receiver: configures the asus, reads CSI from it and publishes it.
+//shared by the standalone csi_node executable and the nodelet.
+class csi_server
 {
 public:
-    uint8_t source_mac[6];
-    uint16_t seq_num;
-    int8_t rssi;
-    uint8_t tx;
-    uint8_t rx;
-    uint8_t channel;
-    uint8_t bw;
-    size_t n_sub;
-    double* csi_r;
-    double* csi_i;
-    uint16_t seq;
-    uint8_t fc;
-    ~csi_instance(){
-      if(!csi_r)
-        delete csi_r;
-      if(!csi_i)
-        delete csi_i;
-    }
-};
+  //params, services and topics all live under nh
+  explicit csi_server(ros::NodeHandle nh);
+  ~csi_server();
 
+  //reads params, configures the asus and opens the socket, returns false on a fatal error
+  bool start();
 
-struct csi_udp_frame {
-    uint8_t kk1;//magic number
-    uint8_t id;
-    int8_t rssi;//rssi
-    uint8_t fc; //frame control
-    uint8_t src_mac[6];//source mac
-    uint16_t seqCnt;//frame sequence number
-    uint16_t csiconf;// core + spatial stream
-    uint16_t chanspec;//chanspec
-    uint16_t chip;//chip version
+  //receives and publishes CSI until stop() is called or ros shuts down
+  void run();
 
-    //then follows the csi bytes, for 80MHZ:
-    //uint32_t csi_values[512];
-};
+  //makes run() return, and start() if it is still waiting for the router
+  void stop();
 
-//main functions
+  //true once stop() has been called
+  bool stopped() const{
+    return !running;
+  }
 
-//sets up rosparams
-void setup_params(ros::NodeHandle& nh);
+  //close the active processes on asus
+  void shutdown_router();
+
+private:
+  //sets up rosparams
+  void setup_params();
+
+  //single-router tcp_forward: accepts the connection from the router's tcpdump into connfd
+  bool accept_tcp();
+
+  //parses csi from bytes, then groups and publishes it on the calling thread
+  void parse_csi(unsigned char* data, size_t nbytes, uint64_t rx_ns, const ros::Time &stamp);
 
-//parses csi from bytes
-void parse_csi(unsigned char* data, size_t nbytes);
+  //decodes one CSI frame, returns false if the frame was filtered out or invalid
+  bool decode_csi(unsigned char* data, size_t nbytes, uint64_t rx_ns, const ros::Time &stamp, csi_instance &out);
 
-//create ros message
-void publish_csi(std::vector<csi_instance> &channel_current);
+  //records the reassembly wait of a finished group, and whether it is missing chains
+  void count_group(const std::vector<csi_instance> &group, bool complete);
 
-//close the active processes on asus
-void handle_shutdown(int sig);
+  //groups frames from the same measurement, emits each group once it is complete or expires
+  void assemble_csi(csi_instance &out);
 
-//update CSI filter settings on asus
-std::string reconfigure();
+  //emits groups that have waited longer than the reassembly timeout, for when no frames arrive
+  void expire_groups();
 
-void setup_tcpdump(std::string hostIP);
+  //how long the receive thread may block waiting for frames: recv_timeout_ms, and without the pipeline
+  //(the receive thread then owns the reassembler) no later than the oldest waiting group's deadline
+  uint64_t recv_wait_ns() const;
+  //true without the pipeline while a group is waiting for chains, so receiving must not block past its deadline
+  bool groups_waiting() const;
+  //sleeps until fd is readable or recv_wait_ns() has passed
+  void wait_readable(int fd);
 
-bool set_chanspec(int s_chan, int s_bw);
+  //hands a finished group to the publisher
+  void emit_group(std::vector<csi_instance> &group, bool complete);
 
-bool set_mac_filter(std::vector<int> filt);
-bool set_mac_filter(const uint8_t* mac);
+  //create ros message
+  void publish_csi(std::vector<csi_instance> &channel_current);
 
-bool config_csi_callback(wiros_csi_node::ConfigureCSI::Request &req, wiros_csi_node::ConfigureCSI::Response &resp);
+  //appends a finished group to the recording
+  void record_group(const std::vector<csi_instance> &group);
+  //writes a finished group to the shared memory ring
+  void share_group(const std::vector<csi_instance> &group);
 
-void ap_info_callback(const rf_msgs::AccessPoints::ConstPtr& msg);
+  //builds the message for a group and publishes it on pub, or the topic its MAC is routed to
+  void send_group(const std::vector<csi_instance> &group, const std::string &rx_id, const ros::Publisher &pub);
+  //advertises a CSI topic with the message type in use
+  ros::Publisher advertise_csi(const std::string &topic);
+
+  //hands a received frame to the decoder, either inline or through the pipeline
+  //rx_ns is the monotonic arrival time, stamp the arrival or capture time, or zero to stamp the message when it is published
+  void ingest_csi(unsigned char* data, size_t nbytes, uint64_t rx_ns, const ros::Time &stamp = ros::Time());
+
+  //receive loops for udp broadcast and tcpdump forwarding
+  void run_udp();
+  void run_tcp();
+
+  //packet ring capture: opens the ring on ring_iface, and reads it
+  bool setup_ring();
+  void run_ring();
+  //decodes a frame in place in the ring, with the pipeline it goes straight to the assemble stage
+  void ingest_ring(unsigned char* data, size_t nbytes, uint64_t rx_ns, const ros::Time &stamp);
+
+  //multi-router mode: one epoll-driven receive loop that hands frames to per-router workers
+  bool setup_routers();
+  void run_routers();
+  //hands a frame from router r to its worker
+  void dispatch_router(int r, const unsigned char* data, size_t nbytes, uint64_t rx_ns, const ros::Time &stamp);
+  //index of the router with this address, -1 if it isn't one of ours
+  int find_router(in_addr_t addr) const;
+  //tcp_forward: accept a router's connection, read from it
+  void accept_router(int epfd);
+  void read_router(int epfd, int r);
+  void router_worker(int w);
+  void publish_router(csi_router &r, std::vector<csi_instance> &group);
+  void report_routers(const ros::TimerEvent& e);
+
+  //pipeline stages, each runs on its own thread
+  void decode_stage();
+  void assemble_stage();
+  void publish_stage();
+
+  //start/stop the receive->decode->assemble->publish threads
+  void start_pipeline();
+  void stop_pipeline();
+
+  //logs the depth and overflow counts of the pipeline queues
+  void report_pipeline(const ros::TimerEvent& e);
+
+  //publishes counters and latency percentiles on /diagnostics
+  void publish_diagnostics(const ros::TimerEvent& e);
+
+  //update CSI filter settings on the asus, or on every router in multi-router mode
+  std::string reconfigure();
+  std::string configure_router(const std::string &ip);
+
+  //starts tcpdump on the router at ip, forwarding to hostIP
+  FILE* setup_tcpdump(const std::string &ip, std::string hostIP);
+
+  //warns if the kernel dropped frames since the last call
+  void warn_kernel_drops();
+
+  //apply receive buffer/busy-poll/timeout options to the udp socket
+  void setup_udp_socket(int sockfd);
+
+  //pull the kernel's SO_RXQ_OVFL drop counter and receive timestamp out of a datagram's ancillary data.
+  //mono_ns/real_ns are when recvmmsg returned, rx_ns and stamp are set to when the datagram arrived.
+  void read_ancillary(struct msghdr* hdr, uint64_t mono_ns, uint64_t real_ns, uint64_t &rx_ns, ros::Time &stamp);
+  //sets rx_ns and stamp from a kernel receive time on the realtime clock, if it is before real_ns
+  void stamp_arrival(uint64_t kernel_ns, uint64_t mono_ns, uint64_t real_ns, uint64_t &rx_ns, ros::Time &stamp);
+
+  bool set_chanspec(int s_chan, int s_bw);
+
+  bool set_mac_filter(mac_filter filt);
+  void set_mac_table(const csi_mac_table &table);
+
+  //attaches the MAC table to the udp socket, and decides whether the decoder still has to check it
+  void apply_mac_filter();
+
+  //the two byte prefix the asus can filter on for the current table, len 0 if there is none
+  mac_filter router_filter();
+
+  //the publisher for a transmitter: its table entry's topic if it has one, otherwise def
+  ros::Publisher route(const unsigned char* mac, const ros::Publisher &def);
+
+  bool config_csi_callback(wiros_csi_node::ConfigureCSI::Request &req, wiros_csi_node::ConfigureCSI::Response &resp);
+
+  void ap_info_callback(const rf_msgs::AccessPoints::ConstPtr& msg);
+
+  ros::NodeHandle nh;
+  std::atomic<bool> running;
+
+  //CSI-Buffering related state: in-flight measurements keyed by (transmitter, sequence number)
+  csi_reassembler* reassembly = NULL;
+  int reassembly_groups;
+  uint64_t reassembly_timeout_ns;
+
+  //per-thread counters and latency histograms, published as diagnostics
+  csi_stats stats;
+  bool latency_stats = true;
+  double diag_period;
+  ros::Publisher pub_diag;
+  ros::Timer diag_timer;
+  uint64_t diag_prev[CSI_STAT_N_COUNTERS] = {0};
+  csi_hist_snapshot diag_prev_lat[CSI_LAT_N];
+  ros::WallTime diag_prev_t;
+
+  //fixed set of frame buffers shared by the decoder and publisher, no allocation per packet
+  csi_pool* frame_pool = NULL;
+  int pool_size;
+
+  //rate-limited per-measurement logging
+  bool log_packets = false;
+  double log_period;
+
+  //Info about the ASUS that the node is connected to
+  std::string rx_ip;
+  std::string rx_pass;
+  std::string rx_host;
+  std::string hostIP;
+
+  //holds the remote client's ssh process so we can shut it down properly
+  FILE* cli_fp = NULL;
+  //same for the TX process
+  FILE* tx_fp = NULL;
+
+  //Forward the packets over tcpdump->netcat (older kernels won't receive the udp broadcasts)
+  bool use_tcp = false;
+  //stamp tcp_forward messages with the router's pcap capture time instead of the publish time
+  bool use_router_stamps = true;
+
+  //Don't configure
+  bool no_config = false;
+
+  //Info about the node itself
+  std::string hostname;
+
+  //publisher
+  ros::Publisher pub_csi;
+  ros::Subscriber sub_ap;
+  ros::ServiceServer set_chanspec_srv;
+  ros::Timer stats_timer;
+
+  //sockets
+  int sockfd = -1;
+  int connfd = -1;
+
+  //info about current wireless settings
+  int ch, bw;
+  double beacon;
+
+  //parameters that differ between 2.4GHz and 5GHz.
+  std::string iface;
+  int tx_nss;
+
+  //MACs to listen to or ignore, empty listens to everything. replaced as a whole so the decoder can read it without locking
+  std::shared_ptr<const csi_mac_routing> mac_routing;
+  //check frames against the table on the node, off when the kernel or the asus already dropped the rest
+  std::atomic<bool> use_software_mac_filter;
+  //some table entry has its own topic
+  std::atomic<bool> mac_routes;
+  //drop unwanted frames in the kernel with a BPF program on the udp socket
+  bool kernel_mac_filter;
+  bool kernel_filter_attached = false;
+
+  //if not "", the node will listen on the given topic for a list of APs and try to collect CSI from
+  //the first AP on the list.
+  std::string lock_topic;
+
+  //batched udp receive settings
+  int recv_batch;
+  int rcvbuf_size;
+  int busy_poll_us;
+  int recv_timeout_ms;
+
+  //zero-copy capture from a TPACKET_V3 ring on this interface instead of a udp socket, if set
+  std::string ring_iface;
+  csi_ring_config ring_config;
+  csi_packet_ring* ring = NULL;
+
+  //append every measurement to a memory-mapped recording at record_prefix, if set
+  csi_recorder_config record_config;
+  csi_recorder* recorder = NULL;
+  //only record, don't build or publish messages
+  bool record_only = false;
+
+  //write every measurement to a shared memory ring for local consumers, if shm_config.name is set
+  csi_shm_config shm_config;
+  csi_shm_writer* shm = NULL;
+  //measurements the ring's readers had lost at the last diagnostics
+  uint64_t shm_lost_reported = 0;
+
+  //publish wiros_csi_node/CsiCompact instead of rf_msgs/Wifi
+  bool compact_csi = false;
+  //skip decoding and publish the packed words as wiros_csi_node/CsiRaw
+  bool raw_csi = false;
+  //publish wiros_csi_node/CsiBatch messages of several measurements each
+  bool batch_csi = false;
+  csi_batch_config batch_config;
+  csi_batcher* batcher = NULL;
+
+  //datagrams dropped by the kernel because the socket receive queue was full (SO_RXQ_OVFL).
+  //written by the receive thread, read by the diagnostics timer
+  std::atomic<uint32_t> kernel_drops;
+  uint32_t kernel_drops_reported = 0;
+
+  //multi-threaded data path: receive -> decode -> assemble -> publish, joined by spsc queues
+  bool use_pipeline = true;
+  int pipeline_depth;
+  //cpus to pin the receive, decode, assemble and publish threads to
+  std::vector<int> pipeline_cpus;
+  double stats_period;
+  std::atomic<bool> pipeline_running;
+  spsc_queue<csi_raw_frame>* raw_q = NULL;
+  spsc_queue<csi_instance>* decoded_q = NULL;
+  spsc_queue<std::vector<csi_instance> >* group_q = NULL;
+  std::thread decode_thread, assemble_thread, publish_thread;
+  uint64_t raw_overflow_reported = 0;
+
+  //per-bandwidth CSI decoders, picked at startup for the cpu we are running on
+  bool use_simd_decode = true;
+  csi_parser* parser = NULL;
+
+  //multi-router mode, used when the 'routers' param lists any addresses
+  std::vector<std::string> router_ips;
+  std::vector<csi_router*> routers;
+  int n_workers;
+  //publish each router on its own topic instead of tagging messages on /csi with rx_id
+  bool router_topics = false;
+  //one queue and thread per worker, fed by the receive loop
+  std::vector<spsc_queue<csi_raw_frame>*> worker_q;
+  std::vector<std::thread> worker_threads;
+  std::vector<uint64_t> worker_overflow_reported;
+  //wakes the receive loop's epoll_wait when stop() is called
+  int wake_fd = -1;
+};
 
 //helper functions
 
-//search for new packets in the data stream
-inline bool is_csi_hdr(unsigned char* data){
-  for(int i = 0; i < NEW_CSI_HDR/2; ++i){
-    if (*(data + i) != (unsigned char)'\x0a'){
-      return false;
-    }
-  }
-  for(int i = 4; i < NEW_CSI_HDR; ++i){
-    if (*(data + i) != (unsigned char)'\xff'){
-      return false;
-    }
+//pin a thread to a cpu, cpu < 0 leaves it unpinned
+inline void pin_thread(pthread_t thread, int cpu, const char* name){
+  if(cpu < 0) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int err = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set);
+  if(err)
+    ROS_WARN("Could not pin %s thread to cpu %d: %s", name, cpu, strerror(err));
+}
+
+//back off while a pipeline queue is full: spin briefly, then yield, then sleep
+inline void stage_backoff(size_t &idle){
+  ++idle;
+  if(idle < 64) return;
+  if(idle < 256) std::this_thread::yield();
+  else usleep(50);
+}
+
+//true once a stage has found its input queue empty for long enough to sleep on it with wait():
+//spin briefly, then yield
+inline bool stage_idle(size_t &idle){
+  ++idle;
+  if(idle < 64) return false;
+  if(idle < 256){
+    std::this_thread::yield();
+    return false;
   }
   return true;
-};
+}
 
-//locate the start of a CSI udp packet in the received tcpdump data
-size_t find_csi_hdr(unsigned char* csidata){
-  size_t end = CSI_BUF_SIZE - NEW_CSI_HDR;
-  for(size_t i = NEW_CSI_HDR; i < end; ++i){
-    if(is_csi_hdr(csidata + i))
-      return i;
-  }
-  return NO_HDR_IN_BUF;
+//longest an idle stage sleeps before looking again. stopping wakes it early
+#define CSI_STAGE_PARK_NS 100000000ull
+
+//how long a stage may sleep before the earliest of its reassembly deadlines
+inline uint64_t stage_park_ns(uint64_t deadline, uint64_t now){
+  if(deadline <= now) return 0;
+  return std::min<uint64_t>(deadline - now, CSI_STAGE_PARK_NS);
 }
 
 //human readable mac address
-std::string hr_mac_filt(std::vector<int> filter)
+inline std::string hr_mac_filt(std::vector<int> filter)
 {
   char print_blk[6][4];
   for(int i = 0; i < 6; ++i){
@@ -186,7 +517,7 @@ std::string hr_mac_filt(std::vector<int> filter)
   return std::string(source_mac_str);
 }
 
-std::string u32_bits(uint32_t x){
+inline std::string u32_bits(uint32_t x){
   std::stringstream ss;
   for(int i = 31; i >= 0; --i){
     ss << (x>>i & 1) ? "1" : "0";
@@ -194,7 +525,7 @@ std::string u32_bits(uint32_t x){
   return ss.str();
 }
 
-std::string u32_bits_db(uint32_t x){
+inline std::string u32_bits_db(uint32_t x){
   std::stringstream ss;
   for(int i = 31; i >= 0; --i){
     if(i == 29 || i == 28 || i == 17 || i == 16 || i == 5)
@@ -205,7 +536,7 @@ std::string u32_bits_db(uint32_t x){
 }
 
 
-std::string u64_bits(uint64_t x){
+inline std::string u64_bits(uint64_t x){
   std::stringstream ss;
   for(int i = 63; i >= 0; --i){
     if(i == 62 || i == 51)
@@ -214,7 +545,7 @@ std::string u64_bits(uint64_t x){
   }
   return ss.str();
 }
-void dbg_csi_raw(uint32_t c){
+inline void dbg_csi_raw(uint32_t c){
   ROS_INFO("raw bits:\t%s", u32_bits(c).c_str());
   ROS_INFO("e:\t%s",u32_bits_db(c&e_mask).c_str());
   ROS_INFO("sr:\t%s",u32_bits_db(c&r_sign_mask).c_str());
@@ -224,7 +555,7 @@ void dbg_csi_raw(uint32_t c){
 }
 
 //two bytes to uint16_t
-uint16_t char2u16(char u, char l)
+inline uint16_t char2u16(char u, char l)
 {
   return (((uint16_t)u) << 8) | (0x00ff & l);
 };
@@ -0,0 +1,257 @@
+#ifndef PCAP_STREAM_H
+#define PCAP_STREAM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#define PCAP_GLOBAL_HDR 24
+#define PCAP_RECORD_HDR 16
+//tcpdump never captures more than this per packet, anything larger means the stream is corrupt
+#define PCAP_MAX_RECORD 262144
+
+#define PCAP_MAGIC_US 0xa1b2c3d4u
+#define PCAP_MAGIC_NS 0xa1b23c4du
+
+//link types tcpdump may write, depending on the interface it captures on
+#define PCAP_LINK_ETHERNET 1
+#define PCAP_LINK_RAW 101
+#define PCAP_LINK_LINUX_SLL 113
+#define PCAP_LINK_LINUX_SLL2 276
+
+//one captured packet. data points into the stream buffer and is only valid until the next write_ptr()
+struct pcap_record
+{
+  uint32_t ts_sec;
+  uint32_t ts_nsec;
+  uint32_t caplen;
+  uint32_t origlen;
+  const unsigned char* data;
+};
+
+inline uint32_t pcap_bswap32(uint32_t x){
+  return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+//byte order, timestamp resolution and link type from a capture's global header
+struct pcap_format
+{
+  bool swapped;
+  bool nsec;
+  uint32_t link;
+  uint32_t snap;
+};
+
+inline uint32_t pcap_field(const pcap_format &fmt, const unsigned char* p){
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return fmt.swapped ? pcap_bswap32(v) : v;
+}
+
+//reads the PCAP_GLOBAL_HDR bytes at g, false if they don't start a pcap file
+inline bool pcap_parse_global(const unsigned char* g, pcap_format &fmt){
+  uint32_t magic;
+  memcpy(&magic, g, 4);
+  if(magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS){
+    fmt.swapped = false;
+  }
+  else if(pcap_bswap32(magic) == PCAP_MAGIC_US || pcap_bswap32(magic) == PCAP_MAGIC_NS){
+    fmt.swapped = true;
+    magic = pcap_bswap32(magic);
+  }
+  else{
+    return false;
+  }
+  fmt.nsec = magic == PCAP_MAGIC_NS;
+  fmt.snap = pcap_field(fmt, g + 16);
+  fmt.link = pcap_field(fmt, g + 20) & 0x0fffffff;
+  return true;
+}
+
+//reads the PCAP_RECORD_HDR bytes at h, the packet data is expected to follow them.
+//false if the record claims an impossible length
+inline bool pcap_parse_record(const pcap_format &fmt, const unsigned char* h, pcap_record &rec){
+  rec.caplen = pcap_field(fmt, h + 8);
+  if(rec.caplen > PCAP_MAX_RECORD) return false;
+  rec.ts_sec = pcap_field(fmt, h);
+  rec.ts_nsec = fmt.nsec ? pcap_field(fmt, h + 4) : pcap_field(fmt, h + 4) * 1000;
+  rec.origlen = pcap_field(fmt, h + 12);
+  rec.data = h + PCAP_RECORD_HDR;
+  return true;
+}
+
+//incremental parser for a pcap file arriving over a byte stream (tcpdump -w -).
+//data is read straight into the buffer, records are parsed in place, and only the trailing partial
+//record is ever moved, once per buffer fill. the buffer grows if a record doesn't fit.
+class pcap_stream
+{
+public:
+  explicit pcap_stream(size_t initial_capacity = 1 << 18){
+    cap = initial_capacity < 2*PCAP_GLOBAL_HDR ? 2*PCAP_GLOBAL_HDR : initial_capacity;
+    buf = static_cast<unsigned char*>(malloc(cap));
+    reset();
+  }
+  ~pcap_stream(){
+    free(buf);
+  }
+
+  //forget all data, the next bytes are expected to start with a pcap global header
+  void reset(){
+    head = 0;
+    tail = 0;
+    need = PCAP_GLOBAL_HDR;
+    have_global = false;
+    corrupt = false;
+    fmt.swapped = false;
+    fmt.nsec = false;
+    fmt.link = 0;
+    fmt.snap = 0;
+  }
+
+  //room to read at least min_space more bytes into, pass the number read to commit()
+  unsigned char* write_ptr(size_t min_space){
+    if(head == tail){
+      head = 0;
+      tail = 0;
+    }
+    if(cap - tail < min_space || cap - head < need){
+      //move the unparsed remainder to the front, this is less than one record
+      memmove(buf, buf + head, tail - head);
+      tail -= head;
+      head = 0;
+      size_t want = tail + min_space > need ? tail + min_space : need;
+      if(want > cap){
+        size_t ncap = cap;
+        while(ncap < want) ncap <<= 1;
+        unsigned char* nbuf = static_cast<unsigned char*>(realloc(buf, ncap));
+        if(nbuf){
+          buf = nbuf;
+          cap = ncap;
+        }
+      }
+    }
+    return buf + tail;
+  }
+  size_t write_space() const{
+    return cap - tail;
+  }
+  void commit(size_t n){
+    tail += n;
+  }
+
+  //parses the next complete record, false if more data is needed or the stream is corrupt
+  bool next(pcap_record &rec){
+    if(corrupt) return false;
+    if(!have_global){
+      if(tail - head < PCAP_GLOBAL_HDR) return false;
+      if(!pcap_parse_global(buf + head, fmt)){
+        corrupt = true;
+        return false;
+      }
+      head += PCAP_GLOBAL_HDR;
+      have_global = true;
+    }
+    need = PCAP_RECORD_HDR;
+    if(tail - head < PCAP_RECORD_HDR) return false;
+    pcap_record r;
+    if(!pcap_parse_record(fmt, buf + head, r)){
+      corrupt = true;
+      return false;
+    }
+    need = PCAP_RECORD_HDR + r.caplen;
+    if(tail - head < need) return false;
+
+    rec = r;
+    head += need;
+    need = PCAP_RECORD_HDR;
+    return true;
+  }
+
+  //the global header was invalid or a record claimed an impossible length, the stream can't be resynchronized
+  bool bad() const{
+    return corrupt;
+  }
+  uint32_t link_type() const{
+    return fmt.link;
+  }
+  uint32_t snaplen() const{
+    return fmt.snap;
+  }
+  size_t capacity() const{
+    return cap;
+  }
+
+private:
+  pcap_stream(const pcap_stream&);
+  pcap_stream& operator=(const pcap_stream&);
+
+  unsigned char* buf;
+  size_t cap;
+  size_t head;
+  size_t tail;
+  //bytes from head that must be buffered before the next step of parsing can happen
+  size_t need;
+  bool have_global;
+  bool corrupt;
+  pcap_format fmt;
+};
+
+//locates the udp payload of a captured IPv4 packet. returns false for anything else, and for
+//non-initial IP fragments. the payload is clipped to what was captured.
+inline bool pcap_udp_payload(uint32_t link, const unsigned char* data, size_t len,
+                             const unsigned char** payload, size_t* payload_len){
+  size_t off;
+  uint16_t ethertype;
+  switch(link){
+  case PCAP_LINK_ETHERNET:
+    if(len < 14) return false;
+    off = 12;
+    ethertype = (data[off] << 8) | data[off + 1];
+    //skip 802.1Q / 802.1ad tags
+    while((ethertype == 0x8100 || ethertype == 0x88a8) && off + 6 <= len){
+      off += 4;
+      ethertype = (data[off] << 8) | data[off + 1];
+    }
+    off += 2;
+    break;
+  case PCAP_LINK_LINUX_SLL:
+    if(len < 16) return false;
+    ethertype = (data[14] << 8) | data[15];
+    off = 16;
+    break;
+  case PCAP_LINK_LINUX_SLL2:
+    if(len < 20) return false;
+    ethertype = (data[0] << 8) | data[1];
+    off = 20;
+    break;
+  case PCAP_LINK_RAW:
+  case 12:
+  case 14:
+    ethertype = 0x0800;
+    off = 0;
+    break;
+  default:
+    return false;
+  }
+  if(ethertype != 0x0800 || off + 20 > len) return false;
+
+  const unsigned char* ip = data + off;
+  if((ip[0] >> 4) != 4) return false;
+  size_t ihl = (ip[0] & 0x0f) * 4;
+  if(ihl < 20 || ip[9] != 17) return false;
+  //fragment offset, only the first fragment carries the udp header
+  if(((ip[6] & 0x1f) << 8 | ip[7]) != 0) return false;
+  off += ihl;
+  if(off + 8 > len) return false;
+
+  const unsigned char* udp = data + off;
+  size_t udp_len = (udp[4] << 8) | udp[5];
+  off += 8;
+  size_t avail = len - off;
+  *payload = data + off;
+  *payload_len = udp_len >= 8 && udp_len - 8 < avail ? udp_len - 8 : avail;
+  return true;
+}
+
+#endif
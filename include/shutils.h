@@ -8,7 +8,7 @@
 #include <fcntl.h>
 
 //run shell command
-void sh_exec(std::string cmd){
+inline void sh_exec(std::string cmd){
   char buf[256];
   //open process
   if(!popen(cmd.c_str(), "r"))
@@ -17,7 +17,7 @@ void sh_exec(std::string cmd){
 }
 
 //run shell command(blocking)
-std::string sh_exec_block(std::string cmd){
+inline std::string sh_exec_block(std::string cmd){
   char buf[256];
   //open process
   FILE* pipe = popen(cmd.c_str(), "r");
@@ -0,0 +1,128 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stddef.h>
+
+#define CACHE_LINE 64
+
+//bounded lock-free ring buffer between exactly one producer thread and one consumer thread.
+//elements live in the ring itself and are reused, so slots can own buffers that keep their capacity.
+//an idle consumer can sleep in wait(); push() only pays for waking it while it is actually asleep.
+template<typename T>
+class spsc_queue
+{
+public:
+  explicit spsc_queue(size_t min_capacity){
+    cap = 1;
+    while(cap < min_capacity) cap <<= 1;
+    mask = cap - 1;
+    slots = new T[cap];
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+    overflow.store(0, std::memory_order_relaxed);
+    cached_head = 0;
+    cached_tail = 0;
+    parked.store(false, std::memory_order_relaxed);
+    woken = false;
+  }
+  ~spsc_queue(){
+    delete[] slots;
+  }
+
+  //producer: slot to fill in place, NULL if the queue is full
+  T* write_slot(){
+    size_t t = tail.load(std::memory_order_relaxed);
+    if(t - cached_head >= cap){
+      cached_head = head.load(std::memory_order_acquire);
+      if(t - cached_head >= cap) return NULL;
+    }
+    return &slots[t & mask];
+  }
+  //producer: hand the slot from write_slot() to the consumer
+  void push(){
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    //pairs with the fence in wait(): either the consumer sees the new tail or we see it parked
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(parked.load(std::memory_order_relaxed)){
+      std::lock_guard<std::mutex> lock(park_lock);
+      park_cv.notify_one();
+    }
+  }
+  //producer: record that an element was dropped or had to wait because the queue was full
+  void mark_overflow(){
+    overflow.store(overflow.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  //consumer: oldest element, NULL if the queue is empty
+  T* read_slot(){
+    size_t h = head.load(std::memory_order_relaxed);
+    if(h == cached_tail){
+      cached_tail = tail.load(std::memory_order_acquire);
+      if(h == cached_tail) return NULL;
+    }
+    return &slots[h & mask];
+  }
+  //consumer: release the slot from read_slot() back to the producer
+  void pop(){
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+  //consumer: sleep until something is pushed, wake() is called or timeout_ns has passed
+  void wait(uint64_t timeout_ns){
+    std::unique_lock<std::mutex> lock(park_lock);
+    parked.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!woken && tail.load(std::memory_order_relaxed) == head.load(std::memory_order_relaxed))
+      park_cv.wait_for(lock, std::chrono::nanoseconds(timeout_ns));
+    parked.store(false, std::memory_order_relaxed);
+    woken = false;
+  }
+  //any thread: end the consumer's current or next wait(), e.g. to make it check for shutdown
+  void wake(){
+    std::lock_guard<std::mutex> lock(park_lock);
+    woken = true;
+    park_cv.notify_one();
+  }
+
+  //safe to call from any thread
+  size_t depth() const{
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+  }
+  size_t capacity() const{
+    return cap;
+  }
+  uint64_t overflows() const{
+    return overflow.load(std::memory_order_relaxed);
+  }
+
+private:
+  spsc_queue(const spsc_queue&);
+  spsc_queue& operator=(const spsc_queue&);
+
+  T* slots;
+  size_t cap;
+  size_t mask;
+
+  //keep the producer and consumer indices on separate cache lines. padding rather than alignas,
+  //since pre-C++17 operator new does not honour over-aligned types
+  char pad0[CACHE_LINE];
+  std::atomic<size_t> tail;
+  size_t cached_head;
+  std::atomic<uint64_t> overflow;
+  char pad1[CACHE_LINE];
+  std::atomic<size_t> head;
+  size_t cached_tail;
+  char pad2[CACHE_LINE];
+  //read by the producer on every push, so it stays off the consumer's line
+  std::atomic<bool> parked;
+  char pad3[CACHE_LINE];
+  std::mutex park_lock;
+  std::condition_variable park_cv;
+  bool woken;
+};
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef WIROS_CSI_UTILS_H
+#define WIROS_CSI_UTILS_H
+
 #include <vector>
 #include <regex>
 
@@ -29,7 +32,7 @@ inline bool sanitize_string(char c){
 }
 
 //human readable mac address
-std::string hr_mac(const unsigned char* source_mac)
+inline std::string hr_mac(const unsigned char* source_mac)
 {
   char source_mac_str[19];
   sprintf(source_mac_str, "%.2hhx:%.2hhx:%.2hhx:%.2hhx:%.2hhx:%.2hhx", source_mac[0], source_mac[1], source_mac[2], source_mac[3], source_mac[4], source_mac[5]);
@@ -37,14 +40,14 @@ std::string hr_mac(const unsigned char* source_mac)
 }
 
 //human readable ip address
-std::string hr_ip(unsigned char* source_ip)
+inline std::string hr_ip(unsigned char* source_ip)
 {
   char source_ip_str[19];
   sprintf(source_ip_str, "%d.%d.%d.%d", source_ip[0], source_ip[1], source_ip[2], source_ip[3]);
   return std::string(source_ip_str);
 }
 
-bool mac_cmp(const unsigned char* a, const mac_filter b){
+inline bool mac_cmp(const unsigned char* a, const mac_filter b){
   for(int i = 0; i < b.len; ++i){
 	if(a[i] != b.mac[i]) return false;
   }
@@ -53,7 +56,7 @@ bool mac_cmp(const unsigned char* a, const mac_filter b){
 
 
 //human readable mac address
-std::string hr_mac_filt(mac_filter filter)
+inline std::string hr_mac_filt(mac_filter filter)
 {
   char print_blk[6][4];
   for(int i = 0; i < 6; ++i){
@@ -68,7 +71,7 @@ std::string hr_mac_filt(mac_filter filter)
 }
 
 
-mac_filter mac_filter_str(std::string in_str){
+inline mac_filter mac_filter_str(std::string in_str){
   if(in_str == "") return mac_filter();
   
   std::smatch mac_match;
@@ -90,3 +93,5 @@ mac_filter mac_filter_str(std::string in_str){
   
   return ret;
 }
+
+#endif
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+import json
+import sys
+
+# compares two csi_bench JSON results, e.g. from before and after a change:
+#   python3 csi_bench_compare.py base.json new.json [threshold_percent]
+# exits with an error if any benchmark got slower by more than the threshold (default 10%)
+
+if len(sys.argv) < 3:
+    print("Must provide two csi_bench result files as arguments.")
+    sys.exit(1)
+
+with open(sys.argv[1]) as f:
+    base = json.load(f)
+with open(sys.argv[2]) as f:
+    new = json.load(f)
+threshold = 10.0 if len(sys.argv) < 4 else float(sys.argv[3])
+
+def key(r):
+    return (r['name'], r['fixture'])
+
+def cost(r):
+    # per-message benchmarks have no per-frame time
+    return r['ns_per_frame'] if r['ns_per_frame'] > 0 else r['ns_per_msg']
+
+def allocs(r):
+    return r['allocs_per_frame'] if r['ns_per_frame'] > 0 else r['allocs_per_msg']
+
+base_results = {key(r): r for r in base['results']}
+
+print(f"{base.get('label') or sys.argv[1]} ({base['decoder']}) -> {new.get('label') or sys.argv[2]} ({new['decoder']})")
+print(f"{'benchmark':<14} {'fixture':<24} {'base ns':>10} {'new ns':>10} {'change':>8} {'allocs':>14}")
+regressions = 0
+for r in new['results']:
+    b = base_results.get(key(r))
+    if b is None:
+        print(f"{r['name']:<14} {r['fixture']:<24} {'-':>10} {cost(r):>10.1f}")
+        continue
+    change = 100.0 * (cost(r) - cost(b)) / cost(b) if cost(b) > 0 else 0.0
+    alloc_change = f"{allocs(b):.2f}->{allocs(r):.2f}"
+    flag = ''
+    if change > threshold:
+        flag = ' SLOWER'
+        regressions += 1
+    elif allocs(r) > allocs(b) + 1e-3:
+        flag = ' MORE ALLOCS'
+        regressions += 1
+    print(f"{r['name']:<14} {r['fixture']:<24} {cost(b):>10.1f} {cost(r):>10.1f} {change:>+7.1f}% {alloc_change:>14}{flag}")
+
+if regressions:
+    print(f"{regressions} regressions over {threshold:.0f}%")
+    sys.exit(1)
@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+import mmap
+import os
+import sys
+import time
+
+import numpy as np
+
+# reads CSI from csi_node's shared memory ring (the shm_name param) with numpy, see include/csi_shm_format.h
+# for the layout. as a module:
+#   r = CsiShmReader('/csi')
+#   while True:
+#       m = r.read()      # a numpy record, or None if there is nothing new
+#       if m is None and r.stale():
+#           ...           # the node restarted or exited, open the ring again
+# or run it to print what arrives:
+#   python3 csi_shm_reader.py /csi
+
+MAGIC = 0x4d485343
+VERSION = 1
+MAX_READERS = 32
+HEADER = np.dtype([('magic', '<u4'), ('version', '<u4'), ('n_slots', '<u4'), ('slot_size', '<u4'),
+                   ('max_chains', '<u2'), ('max_nsub', '<u2'), ('data_offset', '<u4'), ('writer_pid', '<u4')])
+READER = np.dtype([('pid', '<u4'), ('pad0', '<u4'), ('next', '<u8'), ('overruns', '<u8'), ('lost', '<u8'),
+                   ('pad1', 'V32')])
+HEAD_OFFSET = 64
+READERS_OFFSET = 128
+
+
+def slot_dtype(max_chains, max_nsub, slot_size):
+    # csi holds n_chains rows of n_sub values, for the chains in chain_mask in increasing order of tx*4 + rx
+    return np.dtype({'names': ['version', 'stamp_ns', 'mac', 'seq', 'chan', 'fc', 'rssi', 'n_chains', 'bw',
+                               'chain_mask', 'n_sub', 'csi'],
+                     'formats': ['<u8', '<u8', ('u1', 6), '<u2', 'u1', 'u1', 'i1', 'u1', '<u2', '<u2', '<u2',
+                                 ('<c8', (max_chains, max_nsub))],
+                     'offsets': [0, 8, 16, 22, 24, 25, 26, 27, 28, 30, 32, 64],
+                     'itemsize': slot_size})
+
+
+class CsiShmReader:
+    def __init__(self, name, from_oldest=False):
+        path = '/dev/shm/' + name.lstrip('/')
+        self.fd = os.open(path, os.O_RDWR)
+        self.buf = mmap.mmap(self.fd, 0)
+        self.header = np.frombuffer(self.buf, HEADER, count=1)[0]
+        if self.header['magic'] != MAGIC or self.header['version'] != VERSION:
+            raise ValueError(path + ' is not a CSI ring, or an unsupported version')
+        self.n_slots = int(self.header['n_slots'])
+        self.slots = np.frombuffer(self.buf, slot_dtype(int(self.header['max_chains']), int(self.header['max_nsub']),
+                                                        int(self.header['slot_size'])),
+                                   count=self.n_slots, offset=int(self.header['data_offset']))
+        self.head = np.frombuffer(self.buf, '<u8', count=1, offset=HEAD_OFFSET)
+        head = int(self.head[0])
+        self.pos = max(head - self.n_slots, 0) if from_oldest else head
+        self.overruns = 0
+        self.lost = 0
+        # python has no compare-and-swap on shared memory. an entry is only kept if it still holds our
+        # pid a moment after writing it, so a reader that claimed it at the same time wins. two python
+        # readers can still both take an entry if their writes are further apart than their checks,
+        # which only mixes up the node's diagnostics
+        self.entry = None
+        readers = np.frombuffer(self.buf, READER, count=MAX_READERS, offset=READERS_OFFSET)
+        pid = os.getpid()
+        for e in readers:
+            if e['pid'] != 0:
+                continue
+            e['pid'] = pid
+            time.sleep(0.001)
+            if e['pid'] == pid:
+                self.entry = e
+                break
+        self._report()
+
+    def stale(self):
+        """true once the node removed the ring (or replaced it on restart), open it again to carry on"""
+        try:
+            return os.fstat(self.fd).st_nlink == 0
+        except OSError:
+            return True
+
+    def lag(self):
+        return max(int(self.head[0]) - self.pos, 0)
+
+    def read(self):
+        """the next measurement as a numpy record (a copy), or None if there is none yet"""
+        while True:
+            head = int(self.head[0])
+            if self.pos >= head:
+                return None
+            if head - self.pos > self.n_slots:
+                self._skip(head - self.n_slots - self.pos)
+            slot = self.slots[self.pos % self.n_slots]
+            version = int(slot['version'])
+            if version != 2 * self.pos + 2:
+                self._skip(1)
+                continue
+            out = slot.copy()
+            # the writer may have rewritten the slot while it was copied
+            if int(slot['version']) != version:
+                self._skip(1)
+                continue
+            self.pos += 1
+            self._report()
+            return out
+
+    def close(self):
+        if self.entry is not None:
+            self.entry['pid'] = 0
+            self.entry = None
+        if self.fd >= 0:
+            os.close(self.fd)
+            self.fd = -1
+
+    def _skip(self, n):
+        self.pos += n
+        self.lost += n
+        self.overruns += 1
+        self._report()
+
+    def _report(self):
+        if self.entry is not None:
+            self.entry['next'] = self.pos
+            self.entry['overruns'] = self.overruns
+            self.entry['lost'] = self.lost
+
+
+def chain(m, tx, rx):
+    """the CSI of one chain of a measurement read by CsiShmReader, None if it doesn't hold it"""
+    b = tx * 4 + rx
+    mask = int(m['chain_mask'])
+    if not mask & (1 << b):
+        return None
+    return m['csi'][bin(mask & ((1 << b) - 1)).count('1'), :m['n_sub']]
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        print("Must provide the ring's name, the shm_name param of csi_node.")
+        sys.exit(1)
+    r = CsiShmReader(sys.argv[1])
+    count = 0
+    last = time.time()
+    try:
+        while True:
+            m = r.read()
+            if m is None:
+                if r.stale():
+                    print("the ring was removed, waiting for the node")
+                    r.close()
+                    r = None
+                    while r is None:
+                        time.sleep(1.0)
+                        try:
+                            r = CsiShmReader(sys.argv[1])
+                        except (OSError, ValueError):
+                            pass
+                else:
+                    time.sleep(0.001)
+            else:
+                count += 1
+            now = time.time()
+            if now - last >= 1.0:
+                print(f"{count / (now - last):.0f} measurements/s, lag {r.lag()}, "
+                      f"{r.overruns} overruns ({r.lost} lost)")
+                count = 0
+                last = now
+    except KeyboardInterrupt:
+        pass
+    if r is not None:
+        r.close()
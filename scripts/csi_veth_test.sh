@@ -0,0 +1,25 @@
+#!/bin/sh
+# runs the load test through the packet ring capture on a local veth pair, needs root.
+#
+# csi_loadtest sends to an address on one end of the pair, which a static neighbour entry resolves,
+# so the frames cross to the other end. that end has no ip address, so the host's udp stack never
+# delivers them and only the packet ring sees them, like broadcasts from a router on another subnet.
+#
+# usage: csi_veth_test.sh [roslaunch args, e.g. rate:=50000 duration:=30]
+
+TX=csiveth0
+RX=csiveth1
+
+cleanup(){
+  ip link del $TX 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+cleanup
+ip link add $TX type veth peer name $RX || exit 1
+ip link set $TX up
+ip link set $RX up
+ip addr add 10.55.0.2/24 dev $TX
+ip neigh add 10.55.0.1 lladdr 02:00:00:00:55:01 dev $TX
+
+roslaunch wiros_csi_node loadtest.launch ring_iface:=$RX dest:=10.55.0.1 "$@"
@@ -0,0 +1,299 @@
+//summarizes the CSI in a rosbag: the transmitters, chanspecs and receivers in it, plus
+//each transmitter's rate, sequence number loss and time coverage. only the header fields are read out of
+//the serialized messages, the CSI arrays are skipped over, and slices of the bag are read in parallel.
+//
+//usage: csi_bag_info [-t topic] [-j threads] [-c bin_seconds] bag
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ros/ros.h>
+#include <ros/serialization.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include "csi_msg_layout.h"
+
+//time slices per thread, so a slow slice doesn't hold up the end of the run
+#define SLICES_PER_THREAD 8
+
+//what one slice of the bag saw from a transmitter
+struct tx_stats {
+  uint64_t count = 0;
+  int64_t first_ns = 0;
+  int64_t last_ns = 0;
+  //802.11 sequence numbers (without the fragment bits) of the first and last message
+  int first_seq = -1;
+  int last_seq = -1;
+  //sequence numbers skipped between consecutive messages, and messages that repeated one
+  uint64_t lost = 0;
+  uint64_t repeated = 0;
+  int64_t max_gap_ns = 0;
+  //coverage bins with at least one message
+  std::vector<uint32_t> bins;
+};
+
+struct slice_stats {
+  uint64_t msgs = 0;
+  uint64_t bytes = 0;
+  uint64_t unreadable = 0;
+  std::map<std::string, uint64_t> chanspecs;
+  std::map<std::string, uint64_t> receivers;
+  std::map<std::string, tx_stats> tx;
+};
+
+struct bag_job {
+  std::string path;
+  std::string topic;
+  const csi_msg_layout* layout;
+  std::vector<int> stamp, txmac, chan, bw, seq, rx_id;
+  //slice i covers [bounds[i], bounds[i+1]), the last one includes its end
+  std::vector<ros::Time> bounds;
+  int64_t begin_ns;
+  int64_t bin_ns;
+  std::vector<slice_stats> slices;
+  std::atomic<size_t> next;
+};
+
+static std::string mac_str(const uint8_t* m){
+  char s[20];
+  snprintf(s, sizeof(s), "%02x:%02x:%02x:%02x:%02x:%02x", m[0], m[1], m[2], m[3], m[4], m[5]);
+  return s;
+}
+
+static void add_message(bag_job &j, slice_stats &s, const uint8_t* data, size_t len, const ros::Time &bag_time){
+  const uint8_t* mac;
+  size_t n_mac;
+  if(!j.layout->get_array(data, len, j.txmac, mac, n_mac) || n_mac < 6){
+	++s.unreadable;
+	return;
+  }
+  ++s.msgs;
+  s.bytes += len;
+  int64_t chan = 0, bw = 0, seq = -1, stamp = 0;
+  j.layout->get_int(data, len, j.chan, chan);
+  j.layout->get_int(data, len, j.bw, bw);
+  if(j.layout->get_int(data, len, j.seq, seq)) seq = (seq >> 4) & 0x0fff;
+  else seq = -1;
+  //messages without a stamp of their own fall back to when they were recorded
+  if(!j.layout->get_int(data, len, j.stamp, stamp) || stamp == 0) stamp = (int64_t)bag_time.toNSec();
+  const uint8_t* rx;
+  size_t n_rx;
+  std::string rx_id = j.layout->get_array(data, len, j.rx_id, rx, n_rx) ? std::string((const char*)rx, n_rx) : std::string();
+
+  char spec[32];
+  snprintf(spec, sizeof(spec), "%ld/%ld", chan, bw);
+  ++s.chanspecs[spec];
+  ++s.receivers[rx_id];
+
+  tx_stats &t = s.tx[mac_str(mac)];
+  if(t.count == 0){
+	t.first_ns = stamp;
+	t.first_seq = seq;
+  }
+  else{
+	if(stamp - t.last_ns > t.max_gap_ns) t.max_gap_ns = stamp - t.last_ns;
+	if(seq >= 0 && t.last_seq >= 0){
+	  int d = (seq - t.last_seq) & 0x0fff;
+	  if(d == 0) ++t.repeated;
+	  else t.lost += d - 1;
+	}
+  }
+  t.last_ns = stamp;
+  t.last_seq = seq;
+  ++t.count;
+  uint32_t bin = stamp > j.begin_ns ? (uint32_t)((stamp - j.begin_ns) / j.bin_ns) : 0;
+  if(t.bins.empty() || t.bins.back() != bin) t.bins.push_back(bin);
+}
+
+//reads slices until there are none left, each thread has its own handle on the bag
+static void bag_worker(bag_job* j){
+  rosbag::Bag bag;
+  try{
+	bag.open(j->path, rosbag::bagmode::Read);
+  }
+  catch(rosbag::BagException &e){
+	fprintf(stderr, "could not open %s: %s\n", j->path.c_str(), e.what());
+	return;
+  }
+  std::vector<uint8_t> buf;
+  for(size_t i; (i = j->next.fetch_add(1)) + 1 < j->bounds.size();){
+	ros::Time end = j->bounds[i + 1];
+	//views include their end time, so stop short of where the next slice starts
+	if(i + 2 < j->bounds.size()) end = end - ros::Duration(0, 1);
+	rosbag::View view(bag, rosbag::TopicQuery(j->topic), j->bounds[i], end);
+	slice_stats &s = j->slices[i];
+	for(rosbag::View::iterator it = view.begin(); it != view.end(); ++it){
+	  const rosbag::MessageInstance &m = *it;
+	  //the serialized bytes are copied out of the chunk, but never deserialized
+	  buf.resize(m.size());
+	  ros::serialization::OStream out(buf.data(), buf.size());
+	  m.write(out);
+	  add_message(*j, s, buf.data(), buf.size(), m.getTime());
+	}
+  }
+}
+
+//appends the next slice's view of a transmitter, closing the sequence and time gaps between them
+static void merge_tx(tx_stats &a, tx_stats &b){
+  if(a.count == 0){
+	a = b;
+	return;
+  }
+  if(b.first_ns - a.last_ns > a.max_gap_ns) a.max_gap_ns = b.first_ns - a.last_ns;
+  if(b.first_seq >= 0 && a.last_seq >= 0){
+	int d = (b.first_seq - a.last_seq) & 0x0fff;
+	if(d == 0) ++a.repeated;
+	else a.lost += d - 1;
+  }
+  a.count += b.count;
+  a.last_ns = b.last_ns;
+  a.last_seq = b.last_seq;
+  a.lost += b.lost;
+  a.repeated += b.repeated;
+  if(b.max_gap_ns > a.max_gap_ns) a.max_gap_ns = b.max_gap_ns;
+  a.bins.insert(a.bins.end(), b.bins.begin(), b.bins.end());
+}
+
+static void usage(){
+  fprintf(stderr,
+		  "usage: csi_bag_info [options] bag\n"
+		  "  -t topic   topic with the Wifi messages (default /csi)\n"
+		  "  -j n       reader threads (default: all cores)\n"
+		  "  -c sec     coverage bin width, a bin counts as covered if it has a message (default 1)\n");
+}
+
+int main(int argc, char** argv){
+  std::string topic = "/csi";
+  unsigned threads = std::thread::hardware_concurrency();
+  double bin_s = 1.0;
+  int opt;
+  while((opt = getopt(argc, argv, "t:j:c:h")) != -1){
+	switch(opt){
+	case 't': topic = optarg; break;
+	case 'j': threads = atoi(optarg); break;
+	case 'c': bin_s = atof(optarg); break;
+	default: usage(); return 1;
+	}
+  }
+  if(optind != argc - 1){
+	usage();
+	return 1;
+  }
+  if(threads < 1) threads = 1;
+  if(bin_s <= 0) bin_s = 1.0;
+  ros::Time::init();
+
+  bag_job j;
+  j.path = argv[optind];
+  j.topic = topic;
+  rosbag::Bag bag;
+  try{
+	bag.open(j.path, rosbag::bagmode::Read);
+  }
+  catch(rosbag::BagException &e){
+	fprintf(stderr, "could not open %s: %s\n", j.path.c_str(), e.what());
+	return 1;
+  }
+  //the bag index gives the time range and message definitions without reading any messages
+  rosbag::View all(bag, rosbag::TopicQuery(topic));
+  std::vector<const rosbag::ConnectionInfo*> conns = all.getConnections();
+  uint32_t n_msgs = all.size();
+  if(conns.empty() || n_msgs == 0){
+	fprintf(stderr, "no messages on %s\n", topic.c_str());
+	return 1;
+  }
+  for(size_t i = 1; i < conns.size(); ++i){
+	if(conns[i]->md5sum != conns[0]->md5sum){
+	  fprintf(stderr, "%s holds more than one message type\n", topic.c_str());
+	  return 1;
+	}
+  }
+  csi_msg_layout layout;
+  std::string err;
+  if(!layout.parse(conns[0]->msg_def, err)){
+	fprintf(stderr, "could not parse the %s definition: %s\n", conns[0]->datatype.c_str(), err.c_str());
+	return 1;
+  }
+  j.layout = &layout;
+  j.stamp = layout.path("header.stamp");
+  j.txmac = layout.path("txmac");
+  j.chan = layout.path("chan");
+  j.bw = layout.path("bw");
+  j.seq = layout.path("seq_num");
+  j.rx_id = layout.path("rx_id");
+  if(j.txmac.empty()){
+	fprintf(stderr, "%s has no txmac field\n", conns[0]->datatype.c_str());
+	return 1;
+  }
+
+  ros::Time begin = all.getBeginTime(), end = all.getEndTime();
+  j.begin_ns = begin.toNSec();
+  j.bin_ns = (int64_t)(bin_s * 1e9);
+  if(j.bin_ns < 1) j.bin_ns = 1;
+  size_t n_slices = threads * SLICES_PER_THREAD;
+  uint64_t span = end.toNSec() - begin.toNSec();
+  if(span < n_slices) n_slices = 1;
+  for(size_t i = 0; i <= n_slices; ++i){
+	ros::Time t;
+	t.fromNSec(begin.toNSec() + span / n_slices * i);
+	j.bounds.push_back(i == n_slices ? end : t);
+  }
+  j.slices.resize(n_slices);
+  j.next = 0;
+  bag.close();
+
+  std::vector<std::thread> workers;
+  for(unsigned i = 0; i < threads; ++i) workers.push_back(std::thread(bag_worker, &j));
+  for(size_t i = 0; i < workers.size(); ++i) workers[i].join();
+
+  //slices are merged in time order, so sequence gaps across slice boundaries are counted too
+  slice_stats total;
+  for(size_t i = 0; i < j.slices.size(); ++i){
+	slice_stats &s = j.slices[i];
+	total.msgs += s.msgs;
+	total.bytes += s.bytes;
+	total.unreadable += s.unreadable;
+	for(std::map<std::string, uint64_t>::iterator it = s.chanspecs.begin(); it != s.chanspecs.end(); ++it) total.chanspecs[it->first] += it->second;
+	for(std::map<std::string, uint64_t>::iterator it = s.receivers.begin(); it != s.receivers.end(); ++it) total.receivers[it->first] += it->second;
+	for(std::map<std::string, tx_stats>::iterator it = s.tx.begin(); it != s.tx.end(); ++it) merge_tx(total.tx[it->first], it->second);
+  }
+  if(total.msgs + total.unreadable != n_msgs)
+	fprintf(stderr, "warning: read %lu of the %u messages on %s\n", total.msgs + total.unreadable, n_msgs, topic.c_str());
+  if(total.unreadable)
+	fprintf(stderr, "warning: %lu messages were too short for their definition\n", total.unreadable);
+
+  double bag_s = span * 1e-9;
+  uint64_t bag_bins = span / j.bin_ns + 1;
+  printf("%s: %lu messages (%.1f MB) on %s over %.1f s\n", j.path.c_str(), total.msgs, total.bytes / 1e6, topic.c_str(), bag_s);
+
+  printf("\n---Transmitters Detected---\n");
+  printf("MAC\t\t\tCount\tRate/s\tLoss%%\tRepeat\tFirst s\tLast s\tCover%%\tMax gap s\n");
+  for(std::map<std::string, tx_stats>::iterator it = total.tx.begin(); it != total.tx.end(); ++it){
+	tx_stats &t = it->second;
+	std::sort(t.bins.begin(), t.bins.end());
+	size_t covered = std::unique(t.bins.begin(), t.bins.end()) - t.bins.begin();
+	double active_s = (t.last_ns - t.first_ns) * 1e-9;
+	double loss = t.count + t.lost ? 100.0 * t.lost / (t.count + t.lost) : 0.0;
+	printf("%s\t%lu\t%.1f\t%.2f\t%lu\t%.1f\t%.1f\t%.1f\t%.3f\n", it->first.c_str(), t.count,
+		   active_s > 0 ? (t.count - 1) / active_s : 0.0, loss, t.repeated,
+		   (t.first_ns - j.begin_ns) * 1e-9, (t.last_ns - j.begin_ns) * 1e-9,
+		   100.0 * covered / bag_bins, t.max_gap_ns * 1e-9);
+  }
+
+  printf("\n---CHANSPECs Detected---\nSpec\tCount\n");
+  for(std::map<std::string, uint64_t>::iterator it = total.chanspecs.begin(); it != total.chanspecs.end(); ++it)
+	printf("%s\t%lu\n", it->first.c_str(), it->second);
+
+  printf("\n---Receiver Devices---\nID\t\tCount\n");
+  for(std::map<std::string, uint64_t>::iterator it = total.receivers.begin(); it != total.receivers.end(); ++it)
+	printf("%s\t%lu\n", it->first.c_str(), it->second);
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,450 @@
+//microbenchmarks for the CSI hot paths: frame decoding, pcap record parsing, MAC filtering and
+//building the published message. reports ns per frame/message, heap allocations and bytes copied,
+//and writes JSON and/or CSV so runs can be compared across commits (see scripts/csi_bench_compare.py).
+//
+//usage: csi_bench [-o results.json] [-c results.csv] [-l label] [-t min_seconds] [-f capture.pcap]...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <new>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <ros/ros.h>
+#include <ros/serialization.h>
+#include "csi_parser.h"
+#include "csi_reassembly.h"
+#include "csi_synth.h"
+#include "pcap_stream.h"
+#include "utils.h"
+
+//every heap allocation in the process is counted, the benchmarks are single threaded
+static uint64_t n_allocs = 0;
+
+void* operator new(size_t n){
+  ++n_allocs;
+  void* p = malloc(n ? n : 1);
+  if(!p) throw std::bad_alloc();
+  return p;
+}
+void* operator new[](size_t n){
+  ++n_allocs;
+  void* p = malloc(n ? n : 1);
+  if(!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept{
+  free(p);
+}
+void operator delete[](void* p) noexcept{
+  free(p);
+}
+void operator delete(void* p, size_t) noexcept{
+  free(p);
+}
+void operator delete[](void* p, size_t) noexcept{
+  free(p);
+}
+
+//repetitions of each benchmark, the median is reported
+#define BENCH_REPS 5
+
+struct bench_result {
+  std::string name;
+  std::string fixture;
+  int bw;
+  int chains;
+  double ns_per_frame;
+  double ns_per_msg;
+  double allocs_per_frame;
+  double allocs_per_msg;
+  //CSI bytes written into each message, and its serialized size (what a TCPROS publish copies)
+  double copied_per_msg;
+  double serialized_per_msg;
+};
+
+//a fixture: raw udp payloads in arrival order
+struct frame_set {
+  std::string name;
+  int bw;
+  int chains;
+  std::vector<std::vector<unsigned char> > frames;
+};
+
+static volatile uint64_t sink;
+static double min_time = 0.2;
+
+static double now_s(){
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//runs body(iters) with growing iteration counts until it takes min_time, BENCH_REPS times.
+//returns the median seconds per iteration, and the allocations per iteration and iteration count of the last rep
+template<typename F>
+static double time_it(F body, double &allocs_per_iter, size_t &last_iters){
+  size_t iters = 1;
+  //find an iteration count that runs for about min_time
+  for(;;){
+	double t0 = now_s();
+	body(iters);
+	double dt = now_s() - t0;
+	if(dt > min_time || iters > (1ull << 30)) break;
+	iters = dt > 0 ? std::max(iters * 2, (size_t)(iters * min_time * 1.2 / dt)) : iters * 2;
+  }
+  std::vector<double> per(BENCH_REPS);
+  for(int r = 0; r < BENCH_REPS; ++r){
+	uint64_t a0 = n_allocs;
+	double t0 = now_s();
+	body(iters);
+	per[r] = (now_s() - t0) / iters;
+	allocs_per_iter = (double)(n_allocs - a0) / iters;
+  }
+  last_iters = iters;
+  std::sort(per.begin(), per.end());
+  return per[BENCH_REPS / 2];
+}
+
+static frame_set synth_fixture(int bw, int chains){
+  //rx cores first, then spatial streams
+  static const uint8_t core[17] = {0, 1, 3, 7, 15, 0, 0, 0, 15, 0, 0, 0, 15, 0, 0, 0, 15};
+  static const uint8_t nss[17] = {0, 1, 1, 1, 1, 0, 0, 0, 3, 0, 0, 0, 7, 0, 0, 0, 15};
+  csi_synth_config cfg;
+  cfg.bw = bw;
+  cfg.core_mask = core[chains];
+  cfg.nss_mask = nss[chains];
+  csi_synth synth(cfg);
+  frame_set fs;
+  char name[32];
+  snprintf(name, sizeof(name), "synth_%dmhz_%dch", bw, chains);
+  fs.name = name;
+  fs.bw = bw;
+  fs.chains = chains;
+  //enough measurements that the working set isn't a single frame
+  size_t n = std::max(64, 16*chains);
+  csi_synth_frame f;
+  for(size_t i = 0; i < n; ++i){
+	synth.next(f);
+	fs.frames.push_back(std::vector<unsigned char>(f.data, f.data + f.len));
+  }
+  return fs;
+}
+
+//every CSI frame in a capture, e.g. from collectcsi.sh
+static bool pcap_fixture(const char* path, const csi_parser &parser, frame_set &fs){
+  FILE* fp = fopen(path, "rb");
+  if(!fp) return false;
+  std::vector<unsigned char> data;
+  unsigned char buf[65536];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), fp)) > 0) data.insert(data.end(), buf, buf + n);
+  fclose(fp);
+
+  pcap_format fmt;
+  if(data.size() < PCAP_GLOBAL_HDR || !pcap_parse_global(data.data(), fmt)) return false;
+  fs.name = std::string("pcap_") + path;
+  fs.bw = 0;
+  fs.chains = 0;
+  size_t pos = PCAP_GLOBAL_HDR;
+  pcap_record rec;
+  while(pos + PCAP_RECORD_HDR <= data.size() && pcap_parse_record(fmt, data.data() + pos, rec)){
+	pos += PCAP_RECORD_HDR + rec.caplen;
+	if(pos > data.size()) break;
+	const unsigned char* payload;
+	size_t len;
+	uint8_t bw_code;
+	if(!pcap_udp_payload(fmt.link, rec.data, rec.caplen, &payload, &len)) continue;
+	if(parser.check(payload, len, bw_code) != CSI_FRAME_OK) continue;
+	fs.bw = csi_bw_mhz[bw_code];
+	fs.frames.push_back(std::vector<unsigned char>(payload, payload + len));
+  }
+  return !fs.frames.empty();
+}
+
+//decode only, a pool slot per frame like the node
+static bench_result bench_decode(const frame_set &fs, const csi_parser &parser, const char* name){
+  csi_pool pool(64);
+  bench_result r = bench_result();
+  r.name = name;
+  r.fixture = fs.name;
+  r.bw = fs.bw;
+  r.chains = fs.chains;
+  size_t nf = fs.frames.size(), iters;
+  r.ns_per_frame = 1e9 * time_it([&](size_t n){
+	csi_instance out;
+	for(size_t i = 0; i < n; ++i){
+	  const std::vector<unsigned char> &f = fs.frames[i % nf];
+	  parser.decode(f.data(), f.size(), ros::Time(), pool, out);
+	  sink = out.buf.csi_r[0] != 0;
+	}
+  }, r.allocs_per_frame, iters);
+  return r;
+}
+
+//decode, group and build messages: everything parse_csi and publish_csi do short of handing the message to ROS
+static bench_result bench_parse_publish(const frame_set &fs, const csi_parser &parser){
+  csi_pool pool(64);
+  bench_result r = bench_result();
+  r.name = "parse_publish";
+  r.fixture = fs.name;
+  r.bw = fs.bw;
+  r.chains = fs.chains;
+  size_t nf = fs.frames.size(), iters;
+  //the node's defaults
+  csi_reassembler reassembly(64, 10000000);
+  std::string rx_id = "192.168.43.227";
+  uint64_t n_msgs = 0, copied = 0, serialized = 0;
+  auto emit = [&](std::vector<csi_instance> &group, bool complete){
+	rf_msgs::WifiPtr msg = boost::make_shared<rf_msgs::Wifi>();
+	csi_fill_msg(group, rx_id, *msg);
+	++n_msgs;
+	copied += (msg->csi_real.size() + msg->csi_imag.size()) * sizeof(double);
+	serialized += ros::serialization::serializationLength(*msg);
+  };
+  //a frame every microsecond, far inside the timeout
+  uint64_t now = 0;
+  //learn the fixture's transmitters first, so measurements are published as soon as they are complete
+  for(size_t i = 0; i < nf; ++i){
+	csi_instance out;
+	if(parser.decode(fs.frames[i].data(), fs.frames[i].size(), ros::Time(1, 0), pool, out) != CSI_FRAME_OK) continue;
+	now += 1000;
+	reassembly.add(out, now, emit);
+  }
+  reassembly.flush(emit);
+  r.ns_per_frame = 1e9 * time_it([&](size_t n){
+	n_msgs = 0;
+	copied = 0;
+	serialized = 0;
+	for(size_t i = 0; i < n; ++i){
+	  const std::vector<unsigned char> &f = fs.frames[i % nf];
+	  csi_instance out;
+	  if(parser.decode(f.data(), f.size(), ros::Time(1, 0), pool, out) != CSI_FRAME_OK) continue;
+	  now += 1000;
+	  reassembly.add(out, now, emit);
+	}
+  }, r.allocs_per_frame, iters);
+  reassembly.clear();
+  if(n_msgs){
+	double frames_per_msg = (double)iters / n_msgs;
+	r.ns_per_msg = r.ns_per_frame * frames_per_msg;
+	r.allocs_per_msg = r.allocs_per_frame * frames_per_msg;
+	r.copied_per_msg = (double)copied / n_msgs;
+	r.serialized_per_msg = (double)serialized / n_msgs;
+  }
+  return r;
+}
+
+//message building alone, for one measurement of the fixture
+static bench_result bench_fill_msg(const frame_set &fs, const csi_parser &parser){
+  csi_pool pool(64);
+  bench_result r = bench_result();
+  r.name = "fill_msg";
+  r.fixture = fs.name;
+  r.bw = fs.bw;
+  r.chains = fs.chains;
+  std::vector<csi_instance> group;
+  for(int i = 0; i < fs.chains && i < (int)fs.frames.size(); ++i){
+	group.emplace_back();
+	parser.decode(fs.frames[i].data(), fs.frames[i].size(), ros::Time(1, 0), pool, group.back());
+  }
+  std::string rx_id = "192.168.43.227";
+  size_t iters;
+  r.ns_per_msg = 1e9 * time_it([&](size_t n){
+	for(size_t i = 0; i < n; ++i){
+	  rf_msgs::WifiPtr msg = boost::make_shared<rf_msgs::Wifi>();
+	  csi_fill_msg(group, rx_id, *msg);
+	  sink = msg->csi_real.size();
+	}
+  }, r.allocs_per_msg, iters);
+  rf_msgs::Wifi msg;
+  csi_fill_msg(group, rx_id, msg);
+  r.copied_per_msg = (msg.csi_real.size() + msg.csi_imag.size()) * sizeof(double);
+  r.serialized_per_msg = ros::serialization::serializationLength(msg);
+  return r;
+}
+
+//pcap record and udp header parsing for the tcp_forward path, fed in 64 KB reads
+static bench_result bench_pcap_parse(const frame_set &fs){
+  //wrap the fixture in a pcap stream once
+  std::vector<unsigned char> stream(PCAP_GLOBAL_HDR, 0);
+  uint32_t g[6] = {PCAP_MAGIC_US, 0x00040002, 0, 0, 262144, PCAP_LINK_ETHERNET};
+  memcpy(stream.data(), g, sizeof(g));
+  for(size_t i = 0; i < fs.frames.size(); ++i){
+	const std::vector<unsigned char> &f = fs.frames[i];
+	size_t len = 14 + 20 + 8 + f.size();
+	uint32_t h[4] = {1, 0, (uint32_t)len, (uint32_t)len};
+	unsigned char hdr[14 + 20 + 8] = {0};
+	hdr[12] = 0x08;
+	hdr[14] = 0x45;
+	hdr[14 + 9] = 17;
+	hdr[14 + 20 + 4] = (f.size() + 8) >> 8;
+	hdr[14 + 20 + 5] = (f.size() + 8) & 0xff;
+	stream.insert(stream.end(), (unsigned char*)h, (unsigned char*)h + sizeof(h));
+	stream.insert(stream.end(), hdr, hdr + sizeof(hdr));
+	stream.insert(stream.end(), f.begin(), f.end());
+  }
+  bench_result r = bench_result();
+  r.name = "pcap_parse";
+  r.fixture = fs.name;
+  r.bw = fs.bw;
+  r.chains = fs.chains;
+  size_t iters;
+  double per_pass = time_it([&](size_t n){
+	for(size_t i = 0; i < n; ++i){
+	  pcap_stream ps;
+	  pcap_record rec;
+	  for(size_t pos = 0; pos < stream.size(); ){
+		size_t k = std::min((size_t)65536, stream.size() - pos);
+		memcpy(ps.write_ptr(k), stream.data() + pos, k);
+		ps.commit(k);
+		pos += k;
+		const unsigned char* payload;
+		size_t len;
+		while(ps.next(rec)){
+		  if(pcap_udp_payload(ps.link_type(), rec.data, rec.caplen, &payload, &len)) sink = len;
+		}
+	  }
+	}
+  }, r.allocs_per_frame, iters);
+  r.ns_per_frame = 1e9 * per_pass / fs.frames.size();
+  r.allocs_per_frame /= fs.frames.size();
+  return r;
+}
+
+//software MAC filter, matching and non-matching prefixes of every length
+static bench_result bench_mac_cmp(const frame_set &fs){
+  bench_result r = bench_result();
+  r.name = "mac_cmp";
+  r.fixture = fs.name;
+  r.bw = fs.bw;
+  r.chains = fs.chains;
+  std::vector<mac_filter> filters;
+  for(int len = 0; len <= 6; ++len){
+	uint8_t mac[6] = {0x02, 0, 0, 0, 0, 0};
+	filters.push_back(mac_filter(len, mac));
+	mac[0] = 0x11;
+	filters.push_back(mac_filter(len, mac));
+  }
+  size_t nf = fs.frames.size(), iters;
+  r.ns_per_frame = 1e9 * time_it([&](size_t n){
+	uint64_t hits = 0;
+	for(size_t i = 0; i < n; ++i){
+	  const csi_udp_frame* hdr = reinterpret_cast<const csi_udp_frame*>(fs.frames[i % nf].data());
+	  hits += mac_cmp(hdr->src_mac, filters[i % filters.size()]);
+	}
+	sink = hits;
+  }, r.allocs_per_frame, iters);
+  return r;
+}
+
+static void print_json(FILE* fp, const std::vector<bench_result> &res, const std::string &label, const char* decoder){
+  fprintf(fp, "{\n  \"label\": \"%s\",\n  \"decoder\": \"%s\",\n  \"results\": [\n", label.c_str(), decoder);
+  for(size_t i = 0; i < res.size(); ++i){
+	const bench_result &r = res[i];
+	fprintf(fp, "    {\"name\": \"%s\", \"fixture\": \"%s\", \"bw\": %d, \"chains\": %d, "
+			"\"ns_per_frame\": %.2f, \"ns_per_msg\": %.2f, \"allocs_per_frame\": %.3f, \"allocs_per_msg\": %.3f, "
+			"\"copied_bytes_per_msg\": %.0f, \"serialized_bytes_per_msg\": %.0f}%s\n",
+			r.name.c_str(), r.fixture.c_str(), r.bw, r.chains, r.ns_per_frame, r.ns_per_msg,
+			r.allocs_per_frame, r.allocs_per_msg, r.copied_per_msg, r.serialized_per_msg,
+			i + 1 < res.size() ? "," : "");
+  }
+  fprintf(fp, "  ]\n}\n");
+}
+
+static void print_csv(FILE* fp, const std::vector<bench_result> &res, const std::string &label){
+  fprintf(fp, "label,name,fixture,bw,chains,ns_per_frame,ns_per_msg,allocs_per_frame,allocs_per_msg,copied_bytes_per_msg,serialized_bytes_per_msg\n");
+  for(size_t i = 0; i < res.size(); ++i){
+	const bench_result &r = res[i];
+	fprintf(fp, "%s,%s,%s,%d,%d,%.2f,%.2f,%.3f,%.3f,%.0f,%.0f\n", label.c_str(), r.name.c_str(), r.fixture.c_str(),
+			r.bw, r.chains, r.ns_per_frame, r.ns_per_msg, r.allocs_per_frame, r.allocs_per_msg,
+			r.copied_per_msg, r.serialized_per_msg);
+  }
+}
+
+static void usage(){
+  fprintf(stderr,
+		  "usage: csi_bench [options]\n"
+		  "  -o file    write results as JSON (default: stdout)\n"
+		  "  -c file    also write results as CSV\n"
+		  "  -l label   label for this run, e.g. the git commit\n"
+		  "  -t secs    minimum time per measurement (default 0.2)\n"
+		  "  -f pcap    also benchmark the CSI frames in this capture, may be repeated\n");
+}
+
+int main(int argc, char** argv){
+  std::string json_path, csv_path, label;
+  std::vector<const char*> captures;
+  int opt;
+  while((opt = getopt(argc, argv, "o:c:l:t:f:h")) != -1){
+	switch(opt){
+	case 'o': json_path = optarg; break;
+	case 'c': csv_path = optarg; break;
+	case 'l': label = optarg; break;
+	case 't': min_time = atof(optarg); break;
+	case 'f': captures.push_back(optarg); break;
+	default: usage(); return 1;
+	}
+  }
+#ifndef __OPTIMIZE__
+  fprintf(stderr, "warning: built without optimization, build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers\n");
+#endif
+
+  csi_parser simd(true), scalar(false);
+  std::vector<frame_set> fixtures;
+  const int bws[4] = {20, 40, 80, 160};
+  const int chains[5] = {1, 2, 4, 8, 16};
+  for(int b = 0; b < 4; ++b){
+	for(int c = 0; c < 5; ++c) fixtures.push_back(synth_fixture(bws[b], chains[c]));
+  }
+  for(size_t i = 0; i < captures.size(); ++i){
+	frame_set fs;
+	if(!pcap_fixture(captures[i], simd, fs)){
+	  fprintf(stderr, "no CSI frames in %s\n", captures[i]);
+	  return 1;
+	}
+	fixtures.push_back(fs);
+  }
+
+  std::vector<bench_result> res;
+  for(size_t i = 0; i < fixtures.size(); ++i){
+	const frame_set &fs = fixtures[i];
+	bool recorded = fs.chains == 0;
+	//per-frame costs don't depend on the chain count, only measure them once per bandwidth
+	if(recorded || fs.chains == 16){
+	  res.push_back(bench_decode(fs, simd, "decode"));
+	  res.push_back(bench_decode(fs, scalar, "decode_scalar"));
+	  res.push_back(bench_pcap_parse(fs));
+	  res.push_back(bench_mac_cmp(fs));
+	}
+	if(!recorded) res.push_back(bench_fill_msg(fs, simd));
+	res.push_back(bench_parse_publish(fs, simd));
+  }
+
+  fprintf(stderr, "%-14s %-24s %9s %9s %9s %9s %10s %10s\n", "benchmark", "fixture", "ns/frame", "ns/msg",
+		  "alloc/fr", "alloc/msg", "copied/msg", "serial/msg");
+  for(size_t i = 0; i < res.size(); ++i){
+	const bench_result &r = res[i];
+	fprintf(stderr, "%-14s %-24s %9.1f %9.1f %9.3f %9.3f %10.0f %10.0f\n", r.name.c_str(), r.fixture.c_str(),
+			r.ns_per_frame, r.ns_per_msg, r.allocs_per_frame, r.allocs_per_msg, r.copied_per_msg, r.serialized_per_msg);
+  }
+
+  FILE* out = json_path.empty() ? stdout : fopen(json_path.c_str(), "w");
+  if(!out){
+	fprintf(stderr, "could not open %s\n", json_path.c_str());
+	return 1;
+  }
+  print_json(out, res, label, simd.decoder_name());
+  if(out != stdout) fclose(out);
+  if(!csv_path.empty()){
+	FILE* csv = fopen(csv_path.c_str(), "w");
+	if(!csv){
+	  fprintf(stderr, "could not open %s\n", csv_path.c_str());
+	  return 1;
+	}
+	print_csv(csv, res, label);
+	fclose(csv);
+  }
+  return 0;
+}
@@ -0,0 +1,560 @@
+//exports the CSI in a rosbag or in pcap captures to columnar .npy files, which analysis code can memory-map
+//instead of parsing: one column per header field, and a single complex64 tensor holding only the chains
+//that occur in the data. a first pass counts the measurements so every file is created at its final size,
+//then threads fill their own rows of the mapped files.
+//
+//usage: csi_export -o outdir [-j threads] [-t topic] [-n n_sub] [-r rx_id] [-m mac_filter] [-g groups] [-w timeout_ms] [-s] in.bag | capture.pcap...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ros/ros.h>
+#include <ros/serialization.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include "csi_capture.h"
+#include "csi_msg_layout.h"
+#include "csi_npy.h"
+
+//time slices of a bag per thread
+#define SLICES_PER_THREAD 8
+//pool slots per worker, a measurement holds at most 16 frames
+#define WORKER_POOL_SIZE 64
+//subcarrier counts a measurement can have, 20 to 160 MHz
+#define N_NSUB 4
+static const size_t nsub_values[N_NSUB] = {64, 128, 256, 512};
+
+static int nsub_index(size_t n_sub){
+  for(int i = 0; i < N_NSUB; ++i) if(nsub_values[i] == n_sub) return i;
+  return -1;
+}
+
+//a slice of a bag or a chunk of a capture. the first pass counts its measurements and the chains they
+//hold for each subcarrier count, which gives every unit its first row in the output
+struct export_unit {
+  uint64_t count[N_NSUB] = {0};
+  uint16_t chains[N_NSUB] = {0};
+  size_t row = 0;
+  std::vector<std::string> receivers;
+};
+
+//the mapped output columns
+struct export_out {
+  size_t n_sub;
+  //tensor column of every chain tx*4 + rx, -1 if it isn't exported
+  int col[16];
+  size_t n_cols;
+  uint64_t* stamp_ns;
+  uint8_t* mac;
+  uint16_t* seq;
+  int8_t* rssi;
+  uint8_t* chan;
+  uint16_t* bw;
+  uint8_t* fc;
+  uint16_t* chain_mask;
+  uint16_t* rx;
+  float* csi;
+  std::map<std::string, uint16_t> rx_index;
+};
+
+//the header fields of one measurement
+struct export_row {
+  uint64_t stamp_ns;
+  const uint8_t* mac;
+  uint16_t seq;
+  int8_t rssi;
+  uint8_t chan;
+  uint16_t bw;
+  uint8_t fc;
+  uint16_t chain_mask;
+  uint16_t rx;
+};
+
+static void write_row(export_out &o, size_t row, const export_row &r){
+  o.stamp_ns[row] = r.stamp_ns;
+  memcpy(o.mac + row*6, r.mac, 6);
+  o.seq[row] = r.seq;
+  o.rssi[row] = r.rssi;
+  o.chan[row] = r.chan;
+  o.bw[row] = r.bw;
+  o.fc[row] = r.fc;
+  o.chain_mask[row] = r.chain_mask;
+  o.rx[row] = r.rx;
+}
+
+//interleaved real/imag floats of one chain of a row
+static float* row_chain(export_out &o, size_t row, int chain){
+  return o.csi + (row*o.n_cols + o.col[chain]) * o.n_sub * 2;
+}
+
+//runs work(unit) for every unit on threads threads, each of which calls init() first
+static void run_units(size_t n_units, unsigned threads, const std::function<void(std::function<void(size_t)>&)> &init_and_run){
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for(unsigned t = 0; t < threads; ++t){
+	workers.push_back(std::thread([&]{
+	  std::function<void(size_t)> work;
+	  init_and_run(work);
+	  if(!work) return;
+	  for(size_t i; (i = next.fetch_add(1)) < n_units;) work(i);
+	}));
+  }
+  for(size_t i = 0; i < workers.size(); ++i) workers[i].join();
+}
+
+////////// rosbags //////////
+
+struct bag_fields {
+  csi_msg_layout layout;
+  std::vector<int> stamp, txmac, chan, bw, seq, rssi, fc, n_sub, n_rows, n_cols, real, imag, rx_id;
+};
+
+//the chains of a Wifi message that hold any CSI. blocks are tx-major, n_rows x n_cols
+static uint16_t bag_chains(const bag_fields &f, const uint8_t* data, size_t len, size_t n_sub,
+						   const uint8_t* &re, const uint8_t* &im, int64_t &rows, int64_t &cols){
+  size_t n_re, n_im;
+  if(!f.layout.get_array(data, len, f.real, re, n_re) || !f.layout.get_array(data, len, f.imag, im, n_im)) return 0;
+  if(!f.layout.get_int(data, len, f.n_rows, rows)) rows = 4;
+  if(!f.layout.get_int(data, len, f.n_cols, cols)) cols = 4;
+  uint16_t mask = 0;
+  for(int64_t t = 0; t < rows && t < 4; ++t){
+	for(int64_t r = 0; r < cols && r < 4; ++r){
+	  size_t b = (t*cols + r) * n_sub;
+	  if(b + n_sub > n_re || b + n_sub > n_im) continue;
+	  //missing chains are zero filled by the node
+	  for(size_t k = 0; k < n_sub; ++k){
+		uint64_t x, y;
+		memcpy(&x, re + (b + k)*8, 8);
+		memcpy(&y, im + (b + k)*8, 8);
+		if(x | y){
+		  mask |= 1 << (t*4 + r);
+		  break;
+		}
+	  }
+	}
+  }
+  return mask;
+}
+
+//calls f(data, len, bag_time) for every message on topic in slice i
+template<typename F>
+static void bag_slice(rosbag::Bag &bag, const std::string &topic, const std::vector<ros::Time> &bounds, size_t i,
+					  std::vector<uint8_t> &buf, F f){
+  ros::Time end = bounds[i + 1];
+  //views include their end time, so stop short of where the next slice starts
+  if(i + 2 < bounds.size()) end = end - ros::Duration(0, 1);
+  rosbag::View view(bag, rosbag::TopicQuery(topic), bounds[i], end);
+  for(rosbag::View::iterator it = view.begin(); it != view.end(); ++it){
+	const rosbag::MessageInstance &m = *it;
+	buf.resize(m.size());
+	ros::serialization::OStream out(buf.data(), buf.size());
+	m.write(out);
+	f(buf.data(), buf.size(), m.getTime());
+  }
+}
+
+////////// pcap captures //////////
+
+struct capture_state {
+  const csi_parser* parser;
+  std::string rx_id;
+  std::vector<csi_record> records;
+  //first record of every measurement, see group_capture
+  std::vector<size_t> starts;
+  //ranges of measurements
+  std::vector<std::pair<size_t, size_t> > chunks;
+};
+
+//counts the measurements in a chunk from the frame headers alone. both passes walk the same measurements,
+//so the rows counted are the rows filled
+static void count_chunk(const capture_state &s, size_t begin, size_t end, export_unit &u){
+  for(size_t g = begin; g < end; ++g){
+	int first = -1;
+	uint16_t same = 0;
+	for(size_t i = s.starts[g]; i < group_end(s.starts, s.records.size(), g); ++i){
+	  const csi_record &r = s.records[i];
+	  const csi_udp_frame* h = reinterpret_cast<const csi_udp_frame*>(r.payload);
+	  int k = nsub_index(csi_bw_nsub[(h->chanspec >> 11) & 0x07]);
+	  if(first < 0) first = k;
+	  if(k == first) same |= 1 << (r.tx*4 + r.rx);
+	}
+	if(first < 0) continue;
+	++u.count[first];
+	u.chains[first] |= same;
+  }
+}
+
+static void export_group(export_out &o, size_t &row, const std::vector<csi_instance> &group){
+  const csi_instance &c0 = group[0];
+  if(c0.n_sub != o.n_sub) return;
+  export_row r;
+  r.stamp_ns = c0.stamp.toNSec();
+  r.mac = c0.source_mac;
+  r.seq = c0.seq;
+  r.rssi = c0.rssi;
+  r.chan = c0.channel;
+  r.bw = c0.bw;
+  r.fc = c0.fc;
+  r.chain_mask = 0;
+  r.rx = 0;
+  for(size_t i = 0; i < group.size(); ++i){
+	const csi_instance &c = group[i];
+	int b = c.tx*4 + c.rx;
+	if(c.n_sub != o.n_sub || o.col[b] < 0) continue;
+	r.chain_mask |= 1 << b;
+	float* out = row_chain(o, row, b);
+	for(size_t k = 0; k < o.n_sub; ++k){
+	  out[2*k] = (float)c.buf.csi_r[k];
+	  out[2*k + 1] = (float)c.buf.csi_i[k];
+	}
+  }
+  write_row(o, row, r);
+  ++row;
+}
+
+static void decode_chunk_rows(const capture_state &s, csi_pool &pool, size_t begin, size_t end, export_out &o, size_t row){
+  std::vector<csi_instance> group;
+  group.reserve(16);
+  for(size_t g = begin; g < end; ++g){
+	for(size_t i = s.starts[g]; i < group_end(s.starts, s.records.size(), g); ++i){
+	  const csi_record &r = s.records[i];
+	  csi_instance out;
+	  if(s.parser->decode(r.payload, r.len, r.stamp, pool, out) == CSI_FRAME_OK) group.push_back(std::move(out));
+	}
+	if(group.empty()) continue;
+	export_group(o, row, group);
+	group.clear();
+  }
+}
+
+static void usage(){
+  fprintf(stderr,
+		  "usage: csi_export -o outdir [options] <in.bag | capture.pcap...>\n"
+		  "  -o dir     output directory, created if needed\n"
+		  "  -j n       threads (default: all cores)\n"
+		  "  -t topic   rosbag topic (default /csi)\n"
+		  "  -n n_sub   only export measurements with this many subcarriers (default: the most common)\n"
+		  "  -r rx_id   receiver recorded for pcap captures (default empty)\n"
+		  "  -m filter  pcap captures: only keep frames from this MAC, e.g. 11:22:*:*:*:*\n"
+		  "  -g n       pcap captures: measurements waiting for chains at once, as the node's reassembly_groups (default 64)\n"
+		  "  -w ms      pcap captures: how long a measurement waits for chains, as the node's reassembly_timeout_ms (default 10)\n"
+		  "  -s         pcap captures: use the scalar decoder instead of SIMD\n");
+}
+
+int main(int argc, char** argv){
+  std::string out_dir, topic = "/csi", rx_id, filter_str;
+  unsigned threads = std::thread::hardware_concurrency();
+  size_t want_nsub = 0;
+  bool use_simd = true;
+  csi_grouping grouping;
+  int opt;
+  while((opt = getopt(argc, argv, "o:j:t:n:r:m:g:w:sh")) != -1){
+	switch(opt){
+	case 'o': out_dir = optarg; break;
+	case 'j': threads = atoi(optarg); break;
+	case 't': topic = optarg; break;
+	case 'n': want_nsub = atoi(optarg); break;
+	case 'r': rx_id = optarg; break;
+	case 'm': filter_str = optarg; break;
+	case 'g': grouping.max_groups = atoi(optarg); break;
+	case 'w': grouping.timeout_ms = atof(optarg); break;
+	case 's': use_simd = false; break;
+	default: usage(); return 1;
+	}
+  }
+  if(out_dir.empty() || optind >= argc){
+	usage();
+	return 1;
+  }
+  if(want_nsub && nsub_index(want_nsub) < 0){
+	fprintf(stderr, "n_sub must be 64, 128, 256 or 512\n");
+	return 1;
+  }
+  if(threads < 1) threads = 1;
+  ros::Time::init();
+  auto t_start = std::chrono::steady_clock::now();
+
+  std::string first = argv[optind];
+  bool is_bag = first.size() > 4 && first.compare(first.size() - 4, 4, ".bag") == 0;
+  if(is_bag && optind != argc - 1){
+	fprintf(stderr, "only one bag can be exported at a time\n");
+	return 1;
+  }
+
+  std::vector<export_unit> units;
+  bag_fields bf;
+  std::vector<ros::Time> bounds;
+  capture_state cs;
+  csi_parser parser(use_simd);
+  std::vector<mapped_file> files;
+
+  //first pass: count measurements and chains per unit
+  if(is_bag){
+	rosbag::Bag bag;
+	try{
+	  bag.open(first, rosbag::bagmode::Read);
+	}
+	catch(rosbag::BagException &e){
+	  fprintf(stderr, "could not open %s: %s\n", first.c_str(), e.what());
+	  return 1;
+	}
+	rosbag::View all(bag, rosbag::TopicQuery(topic));
+	std::vector<const rosbag::ConnectionInfo*> conns = all.getConnections();
+	if(conns.empty() || all.size() == 0){
+	  fprintf(stderr, "no messages on %s\n", topic.c_str());
+	  return 1;
+	}
+	std::string err;
+	if(!bf.layout.parse(conns[0]->msg_def, err)){
+	  fprintf(stderr, "could not parse the %s definition: %s\n", conns[0]->datatype.c_str(), err.c_str());
+	  return 1;
+	}
+	bf.stamp = bf.layout.path("header.stamp");
+	bf.txmac = bf.layout.path("txmac");
+	bf.chan = bf.layout.path("chan");
+	bf.bw = bf.layout.path("bw");
+	bf.seq = bf.layout.path("seq_num");
+	bf.rssi = bf.layout.path("rssi");
+	bf.fc = bf.layout.path("fc");
+	bf.n_sub = bf.layout.path("n_sub");
+	bf.n_rows = bf.layout.path("n_rows");
+	bf.n_cols = bf.layout.path("n_cols");
+	bf.real = bf.layout.path("csi_real");
+	bf.imag = bf.layout.path("csi_imag");
+	bf.rx_id = bf.layout.path("rx_id");
+	if(bf.txmac.empty() || bf.n_sub.empty() || bf.real.empty() || bf.imag.empty()){
+	  fprintf(stderr, "%s lacks txmac, n_sub, csi_real or csi_imag\n", conns[0]->datatype.c_str());
+	  return 1;
+	}
+	ros::Time begin = all.getBeginTime(), end = all.getEndTime();
+	size_t n_slices = threads * SLICES_PER_THREAD;
+	uint64_t span = end.toNSec() - begin.toNSec();
+	if(span < n_slices) n_slices = 1;
+	for(size_t i = 0; i <= n_slices; ++i){
+	  ros::Time t;
+	  t.fromNSec(begin.toNSec() + span / n_slices * i);
+	  bounds.push_back(i == n_slices ? end : t);
+	}
+	units.resize(n_slices);
+	bag.close();
+
+	run_units(units.size(), threads, [&](std::function<void(size_t)> &work){
+	  std::shared_ptr<rosbag::Bag> b = std::make_shared<rosbag::Bag>();
+	  try{
+		b->open(first, rosbag::bagmode::Read);
+	  }
+	  catch(rosbag::BagException &e){
+		fprintf(stderr, "could not open %s: %s\n", first.c_str(), e.what());
+		return;
+	  }
+	  std::shared_ptr<std::vector<uint8_t> > buf = std::make_shared<std::vector<uint8_t> >();
+	  work = [&, b, buf](size_t i){
+		export_unit &u = units[i];
+		std::map<std::string, bool> seen;
+		bag_slice(*b, topic, bounds, i, *buf, [&](const uint8_t* data, size_t len, const ros::Time &t){
+		  int64_t n_sub, rows, cols;
+		  const uint8_t* re, * im;
+		  if(!bf.layout.get_int(data, len, bf.n_sub, n_sub)) return;
+		  int k = nsub_index(n_sub);
+		  if(k < 0) return;
+		  ++u.count[k];
+		  u.chains[k] |= bag_chains(bf, data, len, n_sub, re, im, rows, cols);
+		  const uint8_t* rx;
+		  size_t n_rx;
+		  std::string id = bf.layout.get_array(data, len, bf.rx_id, rx, n_rx) ? std::string((const char*)rx, n_rx) : std::string();
+		  if(!seen.count(id)){
+			seen[id] = true;
+			u.receivers.push_back(id);
+		  }
+		});
+	  };
+	});
+  }
+  else{
+	cs.parser = &parser;
+	cs.rx_id = rx_id;
+	mac_filter filter = mac_filter_str(filter_str);
+	size_t skipped = 0;
+	for(int i = optind; i < argc; ++i){
+	  mapped_file f;
+	  if(!map_file(argv[i], f)){
+		fprintf(stderr, "could not map %s: %s\n", argv[i], strerror(errno));
+		return 1;
+	  }
+	  files.push_back(f);
+	  size_t begin = cs.records.size();
+	  if(!index_capture(f, parser, filter, cs.records, skipped)){
+		fprintf(stderr, "%s is not a pcap file\n", argv[i]);
+		return 1;
+	  }
+	  size_t first_group = cs.starts.size();
+	  group_capture(cs.records, begin, cs.records.size(), grouping, cs.starts);
+	  split_chunks(cs.starts, cs.records.size(), first_group, cs.starts.size(), cs.chunks);
+	}
+	fprintf(stderr, "%lu CSI frames in %lu files (%lu other packets skipped), %s decoder\n",
+			cs.records.size(), files.size(), skipped, parser.decoder_name());
+	units.resize(cs.chunks.size());
+	run_units(units.size(), threads, [&](std::function<void(size_t)> &work){
+	  work = [&](size_t i){
+		count_chunk(cs, cs.chunks[i].first, cs.chunks[i].second, units[i]);
+	  };
+	});
+	if(!units.empty()) units[0].receivers.push_back(rx_id);
+  }
+
+  //pick the subcarrier count, and number the rows and receivers
+  uint64_t per_nsub[N_NSUB] = {0};
+  uint16_t chains[N_NSUB] = {0};
+  for(size_t i = 0; i < units.size(); ++i){
+	for(int k = 0; k < N_NSUB; ++k){
+	  per_nsub[k] += units[i].count[k];
+	  chains[k] |= units[i].chains[k];
+	}
+  }
+  int k = want_nsub ? nsub_index(want_nsub) : 0;
+  if(!want_nsub){
+	for(int i = 1; i < N_NSUB; ++i) if(per_nsub[i] > per_nsub[k]) k = i;
+  }
+  export_out o;
+  o.n_sub = nsub_values[k];
+  o.n_cols = 0;
+  for(int b = 0; b < 16; ++b) o.col[b] = chains[k] & (1 << b) ? o.n_cols++ : -1;
+  size_t n = 0;
+  std::vector<std::string> receivers;
+  for(size_t i = 0; i < units.size(); ++i){
+	units[i].row = n;
+	n += units[i].count[k];
+	for(size_t r = 0; r < units[i].receivers.size(); ++r){
+	  if(!o.rx_index.count(units[i].receivers[r])){
+		o.rx_index[units[i].receivers[r]] = receivers.size();
+		receivers.push_back(units[i].receivers[r]);
+	  }
+	}
+  }
+  for(int i = 0; i < N_NSUB; ++i){
+	if(i != k && per_nsub[i])
+	  fprintf(stderr, "skipping %lu measurements with %lu subcarriers, export them with -n %lu\n", per_nsub[i], nsub_values[i], nsub_values[i]);
+  }
+
+  //create every file at its final size
+  if(mkdir(out_dir.c_str(), 0755) != 0 && errno != EEXIST){
+	fprintf(stderr, "could not create %s: %s\n", out_dir.c_str(), strerror(errno));
+	return 1;
+  }
+  std::string err;
+  csi_npy_file f_stamp, f_mac, f_seq, f_rssi, f_chan, f_bw, f_fc, f_mask, f_rx, f_csi, f_chains;
+  std::string d = out_dir + "/";
+  if(!f_stamp.create(d + "stamp_ns.npy", "<u8", {n}, 8, err) ||
+	 !f_mac.create(d + "mac.npy", "|u1", {n, 6}, 1, err) ||
+	 !f_seq.create(d + "seq.npy", "<u2", {n}, 2, err) ||
+	 !f_rssi.create(d + "rssi.npy", "|i1", {n}, 1, err) ||
+	 !f_chan.create(d + "chan.npy", "|u1", {n}, 1, err) ||
+	 !f_bw.create(d + "bw.npy", "<u2", {n}, 2, err) ||
+	 !f_fc.create(d + "fc.npy", "|u1", {n}, 1, err) ||
+	 !f_mask.create(d + "chain_mask.npy", "<u2", {n}, 2, err) ||
+	 !f_rx.create(d + "rx.npy", "<u2", {n}, 2, err) ||
+	 !f_csi.create(d + "csi.npy", "<c8", {n, o.n_cols, o.n_sub}, 8, err) ||
+	 !f_chains.create(d + "chains.npy", "|u1", {o.n_cols, 2}, 1, err)){
+	fprintf(stderr, "could not create the output: %s\n", err.c_str());
+	return 1;
+  }
+  o.stamp_ns = f_stamp.data<uint64_t>();
+  o.mac = f_mac.data<uint8_t>();
+  o.seq = f_seq.data<uint16_t>();
+  o.rssi = f_rssi.data<int8_t>();
+  o.chan = f_chan.data<uint8_t>();
+  o.bw = f_bw.data<uint16_t>();
+  o.fc = f_fc.data<uint8_t>();
+  o.chain_mask = f_mask.data<uint16_t>();
+  o.rx = f_rx.data<uint16_t>();
+  o.csi = f_csi.data<float>();
+  for(int b = 0; b < 16; ++b){
+	if(o.col[b] < 0) continue;
+	f_chains.data<uint8_t>()[o.col[b]*2] = b / 4;
+	f_chains.data<uint8_t>()[o.col[b]*2 + 1] = b % 4;
+  }
+  FILE* rx_fp = fopen((d + "receivers.txt").c_str(), "w");
+  if(rx_fp){
+	for(size_t i = 0; i < receivers.size(); ++i) fprintf(rx_fp, "%s\n", receivers[i].c_str());
+	fclose(rx_fp);
+  }
+
+  //second pass: every unit fills its own rows
+  if(is_bag){
+	run_units(units.size(), threads, [&](std::function<void(size_t)> &work){
+	  std::shared_ptr<rosbag::Bag> b = std::make_shared<rosbag::Bag>();
+	  try{
+		b->open(first, rosbag::bagmode::Read);
+	  }
+	  catch(rosbag::BagException &e){
+		fprintf(stderr, "could not open %s: %s\n", first.c_str(), e.what());
+		return;
+	  }
+	  std::shared_ptr<std::vector<uint8_t> > buf = std::make_shared<std::vector<uint8_t> >();
+	  work = [&, b, buf](size_t i){
+		size_t row = units[i].row;
+		bag_slice(*b, topic, bounds, i, *buf, [&](const uint8_t* data, size_t len, const ros::Time &t){
+		  int64_t n_sub, rows, cols, v;
+		  const uint8_t* re, * im;
+		  if(!bf.layout.get_int(data, len, bf.n_sub, n_sub) || (size_t)n_sub != o.n_sub) return;
+		  export_row r;
+		  size_t n_mac;
+		  static const uint8_t no_mac[6] = {0};
+		  if(!bf.layout.get_array(data, len, bf.txmac, r.mac, n_mac) || n_mac < 6) r.mac = no_mac;
+		  int64_t stamp = 0;
+		  if(!bf.layout.get_int(data, len, bf.stamp, stamp) || stamp == 0) stamp = t.toNSec();
+		  r.stamp_ns = stamp;
+		  r.seq = bf.layout.get_int(data, len, bf.seq, v) ? v : 0;
+		  r.rssi = bf.layout.get_int(data, len, bf.rssi, v) ? v : 0;
+		  r.chan = bf.layout.get_int(data, len, bf.chan, v) ? v : 0;
+		  r.bw = bf.layout.get_int(data, len, bf.bw, v) ? v : 0;
+		  r.fc = bf.layout.get_int(data, len, bf.fc, v) ? v : 0;
+		  const uint8_t* rx;
+		  size_t n_rx;
+		  std::string id = bf.layout.get_array(data, len, bf.rx_id, rx, n_rx) ? std::string((const char*)rx, n_rx) : std::string();
+		  r.rx = o.rx_index.find(id)->second;
+		  r.chain_mask = bag_chains(bf, data, len, n_sub, re, im, rows, cols);
+		  for(int c = 0; c < 16; ++c){
+			if(!(r.chain_mask & (1 << c))) continue;
+			const uint8_t* src_re = re + ((c/4)*cols + c%4) * n_sub * 8;
+			const uint8_t* src_im = im + ((c/4)*cols + c%4) * n_sub * 8;
+			float* out = row_chain(o, row, c);
+			for(int64_t s = 0; s < n_sub; ++s){
+			  double x, y;
+			  memcpy(&x, src_re + s*8, 8);
+			  memcpy(&y, src_im + s*8, 8);
+			  out[2*s] = (float)x;
+			  out[2*s + 1] = (float)y;
+			}
+		  }
+		  write_row(o, row, r);
+		  ++row;
+		});
+	  };
+	});
+  }
+  else{
+	run_units(units.size(), threads, [&](std::function<void(size_t)> &work){
+	  std::shared_ptr<csi_pool> pool = std::make_shared<csi_pool>(WORKER_POOL_SIZE);
+	  work = [&, pool](size_t i){
+		decode_chunk_rows(cs, *pool, cs.chunks[i].first, cs.chunks[i].second, o, units[i].row);
+	  };
+	});
+	for(size_t i = 0; i < files.size(); ++i) unmap_file(files[i]);
+  }
+
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+  fprintf(stderr, "wrote %lu measurements, %lu chains of %lu subcarriers, to %s in %.2f s\n",
+		  n, o.n_cols, o.n_sub, out_dir.c_str(), secs);
+  return 0;
+}
@@ -0,0 +1,224 @@
+//load test for csi_node: sends synthetic CSI to it over loopback and subscribes to /csi to measure
+//how much of it comes back out. run csi_node with no_config set, see launch/loadtest.launch.
+//
+//reports the sustained decode rate (chains that made it into messages), publish rate, kernel drops on the
+//node's socket and send-to-receive latency percentiles.
+
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <sstream>
+#include <ros/ros.h>
+#include "rf_msgs/Wifi.h"
+#include "csi_synth.h"
+
+//sequence numbers per transmitter, send times are indexed by (transmitter, sequence number)
+#define SEQ_SPACE 4096
+
+static std::atomic<uint64_t>* send_ns = NULL;
+static int n_macs = 1;
+
+static std::atomic<uint64_t> frames_sent(0);
+static std::atomic<uint64_t> frames_decoded(0);
+static std::atomic<uint64_t> msgs_received(0);
+static std::mutex latency_lock;
+static std::vector<uint64_t> latencies;
+static std::vector<uint64_t> period_latencies;
+
+static void csi_callback(const rf_msgs::Wifi::ConstPtr &msg){
+  uint64_t now = csi_synth_now_ns();
+  msgs_received++;
+  //missing chains are zero-filled, decoded ones are never zero
+  size_t n_sub = msg->n_sub;
+  size_t n_chains = msg->n_sub ? msg->csi_real.size() / n_sub : 0;
+  uint64_t populated = 0;
+  for(size_t b = 0; b < n_chains; ++b){
+	if(msg->csi_real[b*n_sub] != 0.0 || msg->csi_imag[b*n_sub] != 0.0) ++populated;
+  }
+  frames_decoded += populated;
+
+  if(msg->txmac.size() < 6) return;
+  int mac_idx = msg->txmac[4] << 8 | msg->txmac[5];
+  if(mac_idx >= n_macs) return;
+  uint64_t sent = send_ns[mac_idx*SEQ_SPACE + ((msg->seq_num >> 4) & (SEQ_SPACE - 1))].load(std::memory_order_relaxed);
+  if(sent == 0 || sent > now) return;
+  std::lock_guard<std::mutex> lk(latency_lock);
+  latencies.push_back(now - sent);
+  period_latencies.push_back(now - sent);
+}
+
+//drops counted by the kernel on every udp socket bound to port
+static uint64_t udp_port_drops(int port){
+  uint64_t drops = 0;
+  const char* files[2] = {"/proc/net/udp", "/proc/net/udp6"};
+  for(int f = 0; f < 2; ++f){
+	std::ifstream in(files[f]);
+	std::string line;
+	std::getline(in, line);
+	while(std::getline(in, line)){
+	  std::istringstream fields(line);
+	  std::string sl, local, field;
+	  fields >> sl >> local;
+	  size_t colon = local.rfind(':');
+	  if(colon == std::string::npos || strtol(local.c_str() + colon + 1, NULL, 16) != port) continue;
+	  //drops is the last column
+	  std::string last;
+	  while(fields >> field) last = field;
+	  drops += strtoull(last.c_str(), NULL, 10);
+	}
+  }
+  return drops;
+}
+
+//p50/p90/p99/p99.9/max in microseconds, sorts v
+static std::string latency_summary(std::vector<uint64_t> &v){
+  if(v.empty()) return "no samples";
+  std::sort(v.begin(), v.end());
+  const double q[4] = {0.5, 0.9, 0.99, 0.999};
+  char buf[160];
+  double p[4];
+  for(int i = 0; i < 4; ++i) p[i] = v[(size_t)(q[i] * (v.size() - 1))] * 1e-3;
+  snprintf(buf, sizeof(buf), "p50 %.0f us, p90 %.0f us, p99 %.0f us, p99.9 %.0f us, max %.0f us (%lu samples)",
+		   p[0], p[1], p[2], p[3], v.back() * 1e-3, v.size());
+  return buf;
+}
+
+int main(int argc, char** argv){
+  ros::init(argc, argv, "csi_loadtest");
+  ros::NodeHandle nh("~");
+
+  csi_synth_config cfg;
+  double rate, duration, report_period, drain, min_decode_ratio, wait_timeout;
+  int core_mask, nss_mask, port;
+  std::string seq_mode, dest;
+  nh.param<double>("rate", rate, 10000.0);
+  nh.param<double>("duration", duration, 10.0);
+  nh.param<int>("bw", cfg.bw, 80);
+  nh.param<int>("channel", cfg.channel, 157);
+  nh.param<int>("core_mask", core_mask, 0x0f);
+  nh.param<int>("nss_mask", nss_mask, 0x0f);
+  nh.param<int>("n_macs", cfg.n_macs, 1);
+  nh.param<std::string>("seq_mode", seq_mode, "inc");
+  nh.param<double>("loss", cfg.loss, 0.0);
+  nh.param<double>("reorder", cfg.reorder, 0.0);
+  nh.param<int>("reorder_depth", cfg.reorder_depth, 4);
+  nh.param<std::string>("dest", dest, "127.0.0.1");
+  nh.param<int>("port", port, 5500);
+  nh.param<double>("report_period", report_period, 1.0);
+  nh.param<double>("drain", drain, 1.0);
+  nh.param<double>("wait_timeout", wait_timeout, 30.0);
+  //exit with an error if fewer than this fraction of the sent frames come back out, for CI
+  nh.param<double>("min_decode_ratio", min_decode_ratio, 0.0);
+  cfg.core_mask = core_mask;
+  cfg.nss_mask = nss_mask;
+  if(!csi_synth_seq_mode(seq_mode, cfg.seq_mode)){
+	ROS_FATAL("Invalid seq_mode %s, should be inc, const or random", seq_mode.c_str());
+	return 1;
+  }
+  csi_synth synth(cfg);
+  if(!synth.ok() || rate <= 0){
+	ROS_FATAL("Invalid bw, chain masks, n_macs or rate");
+	return 1;
+  }
+  n_macs = cfg.n_macs;
+  send_ns = new std::atomic<uint64_t>[n_macs*SEQ_SPACE];
+  for(int i = 0; i < n_macs*SEQ_SPACE; ++i) send_ns[i].store(0, std::memory_order_relaxed);
+
+  struct sockaddr_in dst;
+  memset(&dst, 0, sizeof(dst));
+  dst.sin_family = AF_INET;
+  dst.sin_port = htons(port);
+  if(inet_pton(AF_INET, dest.c_str(), &dst.sin_addr) != 1){
+	ROS_FATAL("Invalid dest address %s", dest.c_str());
+	return 1;
+  }
+  int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if(fd < 0){
+	ROS_FATAL("socket creation failed: %s", strerror(errno));
+	return 1;
+  }
+
+  ros::Subscriber sub = nh.subscribe("/csi", 100000, csi_callback, ros::TransportHints().tcpNoDelay());
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
+
+  ROS_INFO("Waiting for csi_node to publish /csi...");
+  ros::WallTime wait_start = ros::WallTime::now();
+  while(ros::ok() && sub.getNumPublishers() == 0){
+	if(ros::WallTime::now().toSec() - wait_start.toSec() > wait_timeout){
+	  ROS_FATAL("Nothing is publishing /csi, is csi_node running with no_config?");
+	  return 1;
+	}
+	usleep(100000);
+  }
+  //give the connection a moment to come up before the first message
+  usleep(500000);
+
+  uint64_t drops_start = udp_port_drops(port);
+  ROS_INFO("Sending %d MHz CSI (%u subcarriers) to %s:%d at %.0f frames/s for %.0f s",
+		   cfg.bw, synth.subcarriers(), dest.c_str(), port, rate, duration);
+
+  std::atomic<bool> stop(false);
+  std::atomic<bool> sending(true);
+  uint64_t t0 = csi_synth_now_ns();
+  std::thread sender([&](){
+	csi_synth_send(synth, fd, dst, rate, duration, stop, [](const csi_synth_frame &f, uint64_t t){
+	  if(f.first) send_ns[f.mac_idx*SEQ_SPACE + f.seq].store(t, std::memory_order_relaxed);
+	  frames_sent.fetch_add(1, std::memory_order_relaxed);
+	});
+	sending = false;
+  });
+
+  //per-period report while sending
+  uint64_t last_sent = 0, last_decoded = 0, last_msgs = 0, last_drops = drops_start;
+  uint64_t last_t = t0;
+  while(sending && ros::ok()){
+	usleep((useconds_t)(report_period * 1e6));
+	uint64_t t = csi_synth_now_ns();
+	double dt = (t - last_t) * 1e-9;
+	uint64_t sent = frames_sent, decoded = frames_decoded, msgs = msgs_received, drops = udp_port_drops(port);
+	std::vector<uint64_t> lat;
+	{
+	  std::lock_guard<std::mutex> lk(latency_lock);
+	  lat.swap(period_latencies);
+	}
+	ROS_INFO("sent %.0f frames/s, decoded %.0f frames/s, published %.0f msgs/s, kernel drops %lu, latency %s",
+			 (sent - last_sent) / dt, (decoded - last_decoded) / dt, (msgs - last_msgs) / dt,
+			 drops - last_drops, latency_summary(lat).c_str());
+	last_sent = sent;
+	last_decoded = decoded;
+	last_msgs = msgs;
+	last_drops = drops;
+	last_t = t;
+  }
+  stop = true;
+  sender.join();
+  double send_secs = (csi_synth_now_ns() - t0) * 1e-9;
+
+  //let the node publish what it still has queued
+  usleep((useconds_t)(drain * 1e6));
+  spinner.stop();
+
+  uint64_t sent = frames_sent, decoded = frames_decoded, msgs = msgs_received;
+  uint64_t drops = udp_port_drops(port) - drops_start;
+  double ratio = sent ? (double)decoded / sent : 0.0;
+  std::lock_guard<std::mutex> lk(latency_lock);
+  ROS_INFO("*** load test summary ***");
+  ROS_INFO("sent %lu frames in %.2f s (%.0f frames/s), %lu more dropped on purpose",
+		   sent, send_secs, sent / send_secs, synth.frames_lost());
+  ROS_INFO("decoded %lu frames (%.2f%%, %.0f frames/s), %lu messages (%.0f msgs/s)",
+		   decoded, 100.0 * ratio, decoded / send_secs, msgs, msgs / send_secs);
+  ROS_INFO("kernel drops on port %d: %lu", port, drops);
+  ROS_INFO("send to receive latency: %s", latency_summary(latencies).c_str());
+
+  close(fd);
+  delete[] send_ns;
+  if(ratio < min_decode_ratio){
+	ROS_ERROR("Decoded %.2f%% of sent frames, below min_decode_ratio %.2f%%", 100.0 * ratio, 100.0 * min_decode_ratio);
+	return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,44 @@
+//standalone csi_node executable, a thin wrapper around csi_server.
+//the same server can also be loaded into a nodelet manager, see csi_nodelet.cpp
+
+#include "nexcsiserver.h"
+
+csi_server* server = NULL;
+
+//close the active processes on asus
+void handle_shutdown(int sig){
+  ROS_WARN("Shutting down.");
+  if(server){
+	server->stop();
+	server->shutdown_router();
+  }
+  ROS_WARN("Calling ros::shutdown()");
+  ros::shutdown();
+  ROS_WARN("Done.");
+}
+
+int main(int argc, char* argv[]){
+
+  //setup ros
+  ros::init(argc, argv, "nexcsi", ros::init_options::NoSigintHandler);
+  ros::NodeHandle nh("~");
+
+  ros::AsyncSpinner spinner(0);
+  spinner.start();
+
+  server = new csi_server(nh);
+
+  //handle shutdown
+  signal(SIGINT, handle_shutdown);
+
+  bool started = server->start();
+  if(started) server->run();
+  else server->shutdown_router();
+
+  spinner.stop();
+  //also removes the shared memory ring and finishes the recording, if either was opened
+  csi_server* s = server;
+  server = NULL;
+  delete s;
+  return started ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+//runs csi_server inside a nodelet manager. consumers loaded into the same manager receive the
+//published CSI as shared pointers, without serializing it.
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <memory>
+#include "nexcsiserver.h"
+
+namespace wiros_csi_node
+{
+
+class csi_nodelet : public nodelet::Nodelet
+{
+public:
+  ~csi_nodelet(){
+    if(server) server->stop();
+    if(worker.joinable()) worker.join();
+    if(server) server->shutdown_router();
+  }
+
+private:
+  virtual void onInit(){
+    server.reset(new csi_server(getMTPrivateNodeHandle()));
+    //configuring the asus and receiving both block, so they can't run on the manager's thread
+    worker = std::thread([this](){
+      if(server->start()){
+        server->run();
+        return;
+      }
+      //unloaded before the router was set up
+      if(server->stopped()) return;
+      //like csi_node exiting, so a required manager takes the launch file down instead of idling
+      NODELET_FATAL("Could not start the CSI receiver, shutting down the nodelet manager");
+      ros::requestShutdown();
+    });
+  }
+
+  std::unique_ptr<csi_server> server;
+  std::thread worker;
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(wiros_csi_node::csi_nodelet, nodelet::Nodelet)
@@ -0,0 +1,191 @@
+#include "csi_parser.h"
+#include <string.h>
+#include <algorithm>
+
+csi_parser::csi_parser(bool use_simd){
+  csi_frame_select(use_simd, frame_decoders, &name);
+}
+
+csi_frame_status csi_parser::check(const unsigned char* data, size_t nbytes, uint8_t &bw_code) const{
+  if(nbytes < sizeof(csi_udp_frame)) return CSI_FRAME_TRUNCATED;
+  const csi_udp_frame *rxframe = reinterpret_cast<const csi_udp_frame*>(data);
+  bw_code = (rxframe->chanspec>>11) & 0x07;
+  if(!frame_decoders[bw_code]) return CSI_FRAME_BAD_BW;
+  if(nbytes < sizeof(csi_udp_frame) + csi_bw_nsub[bw_code]*sizeof(uint32_t)) return CSI_FRAME_TRUNCATED;
+  return CSI_FRAME_OK;
+}
+
+void csi_parser::fill_header(const unsigned char* data, uint8_t bw_code, const ros::Time &stamp, csi_instance &out) const{
+  const csi_udp_frame *rxframe = reinterpret_cast<const csi_udp_frame*>(data);
+  out.rssi = rxframe->rssi;
+  out.stamp = stamp;
+  memcpy(out.source_mac, rxframe->src_mac, 6);
+  out.seq = rxframe->seqCnt;
+  out.fc = (uint8_t)(rxframe->fc);
+  out.tx = (rxframe->csiconf >> 11) & 0x3;
+  out.rx = (rxframe->csiconf >> 8) & 0x3;
+  out.channel = (rxframe->chanspec) & 255;
+  out.bw = csi_bw_mhz[bw_code];
+  out.n_sub = csi_bw_nsub[bw_code];
+}
+
+csi_frame_status csi_parser::decode(const unsigned char* data, size_t nbytes, const ros::Time &stamp,
+                                    csi_pool &pool, csi_instance &out) const{
+  uint8_t bw_code;
+  csi_frame_status status = check(data, nbytes, bw_code);
+  if(status != CSI_FRAME_OK) return status;
+  fill_header(data, bw_code, stamp, out);
+
+  if(!pool.acquire(out.buf)) return CSI_FRAME_NO_SLOT;
+
+  //decode CSI, already fft-shifted
+  const uint32_t *csi = reinterpret_cast<const uint32_t*>(data + sizeof(csi_udp_frame));
+  frame_decoders[bw_code](csi, out.buf.csi_r, out.buf.csi_i);
+  return CSI_FRAME_OK;
+}
+
+csi_frame_status csi_parser::copy(const unsigned char* data, size_t nbytes, const ros::Time &stamp,
+                                  csi_pool &pool, csi_instance &out) const{
+  uint8_t bw_code;
+  csi_frame_status status = check(data, nbytes, bw_code);
+  if(status != CSI_FRAME_OK) return status;
+  fill_header(data, bw_code, stamp, out);
+
+  if(!pool.acquire(out.buf)) return CSI_FRAME_NO_SLOT;
+  memcpy(out.buf.words(), data + sizeof(csi_udp_frame), out.n_sub*sizeof(uint32_t));
+  return CSI_FRAME_OK;
+}
+
+void csi_fill_msg(const std::vector<csi_instance> &group, const std::string &rx_id, rf_msgs::Wifi &msg){
+  //4x4 matrices, with n_sub elements each
+  const csi_instance &csi_0 = group.at(0);
+  size_t rx_stride = csi_0.n_sub;
+  size_t num_floats = rx_stride*16;
+  msg.header.stamp = csi_0.stamp.isZero() ? ros::Time::now() : csi_0.stamp;
+  msg.ap_id = 0;
+  msg.txmac.assign(csi_0.source_mac, csi_0.source_mac + 6);
+  msg.chan = csi_0.channel;
+  msg.n_sub = csi_0.n_sub;
+  msg.seq_num = csi_0.seq;
+  msg.fc = csi_0.fc;
+  msg.n_rows = 4;
+  msg.n_cols = 4;
+  msg.bw = csi_0.bw;
+  msg.mcs = 0;
+  msg.rssi = (int32_t)(csi_0.rssi);
+  msg.rx_id = rx_id;
+  msg.msg_id = 0;
+
+  //chain blocks are laid out tx-major, rx-minor
+  const csi_instance* chains[16] = {NULL};
+  for(auto c = group.begin(); c != group.end(); ++c){
+	if(c->n_sub == rx_stride)
+	  chains[c->tx*4 + c->rx] = &(*c);
+  }
+  //append each block straight from the frame slots (frames are fft-shifted by the decoder), so every
+  //element of the message is written exactly once and only missing chains are zero-filled
+  msg.csi_real.clear();
+  msg.csi_imag.clear();
+  msg.csi_real.reserve(num_floats);
+  msg.csi_imag.reserve(num_floats);
+  for(int b = 0; b < 16; ++b){
+	if(chains[b]){
+	  msg.csi_real.insert(msg.csi_real.end(), chains[b]->buf.csi_r, chains[b]->buf.csi_r + rx_stride);
+	  msg.csi_imag.insert(msg.csi_imag.end(), chains[b]->buf.csi_i, chains[b]->buf.csi_i + rx_stride);
+	}
+	else{
+	  msg.csi_real.insert(msg.csi_real.end(), rx_stride, 0.0);
+	  msg.csi_imag.insert(msg.csi_imag.end(), rx_stride, 0.0);
+	}
+  }
+}
+
+//the frames of a measurement by tx*4 + rx, with the first frame's subcarrier count. returns how many there are
+static size_t csi_group_chains(const std::vector<csi_instance> &group, const csi_instance* chains[16], uint16_t &mask){
+  size_t n_sub = group[0].n_sub;
+  for(int b = 0; b < 16; ++b) chains[b] = NULL;
+  for(auto c = group.begin(); c != group.end(); ++c){
+	if(c->n_sub == n_sub) chains[c->tx*4 + c->rx] = &(*c);
+  }
+  size_t n = 0;
+  mask = 0;
+  for(int b = 0; b < 16; ++b){
+	if(!chains[b]) continue;
+	mask |= 1 << b;
+	++n;
+  }
+  return n;
+}
+
+//writes the chains as blocks of interleaved float32 real/imaginary pairs
+static void csi_pack_float(const csi_instance* const chains[16], size_t n_sub, float* out){
+  for(int b = 0; b < 16; ++b){
+	if(!chains[b]) continue;
+	const double* re = chains[b]->buf.csi_r;
+	const double* im = chains[b]->buf.csi_i;
+	for(size_t k = 0; k < n_sub; ++k){
+	  out[2*k] = (float)re[k];
+	  out[2*k + 1] = (float)im[k];
+	}
+	out += 2*n_sub;
+  }
+}
+
+//the header fields CsiCompact and CsiRaw share, returns the subcarrier count
+template<typename M>
+static size_t csi_fill_sparse_header(const std::vector<csi_instance> &group, const std::string &rx_id, M &msg){
+  const csi_instance &csi_0 = group.at(0);
+  msg.header.stamp = csi_0.stamp.isZero() ? ros::Time::now() : csi_0.stamp;
+  msg.rx_id = rx_id;
+  std::copy(csi_0.source_mac, csi_0.source_mac + 6, msg.txmac.begin());
+  msg.chan = csi_0.channel;
+  msg.bw = csi_0.bw;
+  msg.n_sub = csi_0.n_sub;
+  msg.seq_num = csi_0.seq;
+  msg.fc = csi_0.fc;
+  msg.rssi = csi_0.rssi;
+  return csi_0.n_sub;
+}
+
+void csi_fill_compact(const std::vector<csi_instance> &group, const std::string &rx_id, wiros_csi_node::CsiCompact &msg){
+  size_t n_sub = csi_fill_sparse_header(group, rx_id, msg);
+  const csi_instance* chains[16];
+  size_t n_chains = csi_group_chains(group, chains, msg.chain_mask);
+  msg.csi.resize(n_chains*n_sub*2);
+  csi_pack_float(chains, n_sub, msg.csi.data());
+}
+
+void csi_fill_raw(const std::vector<csi_instance> &group, const std::string &rx_id, wiros_csi_node::CsiRaw &msg){
+  size_t n_sub = csi_fill_sparse_header(group, rx_id, msg);
+  const csi_instance* chains[16];
+  size_t n_chains = csi_group_chains(group, chains, msg.chain_mask);
+  msg.csi.resize(n_chains*n_sub);
+  uint32_t* out = msg.csi.data();
+  for(int b = 0; b < 16; ++b){
+	if(!chains[b]) continue;
+	memcpy(out, chains[b]->buf.words(), n_sub*sizeof(uint32_t));
+	out += n_sub;
+  }
+}
+
+void csi_append_batch(const std::vector<csi_instance> &group, wiros_csi_node::CsiBatch &msg){
+  const csi_instance &csi_0 = group.at(0);
+  size_t n_sub = csi_0.n_sub;
+  msg.stamp.push_back(csi_0.stamp.isZero() ? ros::Time::now() : csi_0.stamp);
+  msg.txmac.insert(msg.txmac.end(), csi_0.source_mac, csi_0.source_mac + 6);
+  msg.chan.push_back(csi_0.channel);
+  msg.bw.push_back(csi_0.bw);
+  msg.n_sub.push_back(n_sub);
+  msg.seq_num.push_back(csi_0.seq);
+  msg.fc.push_back(csi_0.fc);
+  msg.rssi.push_back(csi_0.rssi);
+
+  const csi_instance* chains[16];
+  uint16_t mask;
+  size_t n_chains = csi_group_chains(group, chains, mask);
+  msg.chain_mask.push_back(mask);
+  size_t offset = msg.csi.size();
+  msg.csi_offset.push_back(offset);
+  msg.csi.resize(offset + n_chains*n_sub*2);
+  csi_pack_float(chains, n_sub, msg.csi.data() + offset);
+}
@@ -0,0 +1,300 @@
+//offline decoder for pcap captures of nexmon CSI, e.g. from nexmon_firmware/csi/collectcsi.sh.
+//produces the same Wifi messages csi_node would publish, decoded on every core, into a rosbag or a flat binary file.
+//
+//usage: csi_pcap_decode -o out.bag [-j threads] [-t topic] [-r rx_id] [-m mac_filter] [-g groups] [-w timeout_ms] [-b MB] [-s] capture.pcap...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include "csi_capture.h"
+
+//pool slots per worker, a measurement holds at most 16 frames
+#define WORKER_POOL_SIZE 64
+//chunks per thread the memory limit should allow for
+#define CHUNKS_PER_THREAD 4
+
+//flat binary output: the magic "CSIB", a uint32 version, then for every message a csi_bin_header
+//followed by n_rows*n_cols*n_sub float64 real parts and as many imaginary parts, little endian
+#define CSI_BIN_MAGIC "CSIB"
+#define CSI_BIN_VERSION 1
+struct __attribute__((packed)) csi_bin_header {
+  uint64_t stamp_ns;
+  uint8_t txmac[6];
+  uint16_t seq_num;
+  uint16_t n_sub;
+  uint16_t bw;
+  uint8_t chan;
+  uint8_t fc;
+  int8_t rssi;
+  uint8_t n_rows;
+  uint8_t n_cols;
+  uint8_t pad[7];
+};
+
+//a range of measurements decoded by one worker
+struct decode_chunk {
+  size_t begin;
+  size_t end;
+  //size of the decoded messages, estimated from the frame headers
+  size_t bytes;
+  bool done;
+  std::vector<rf_msgs::Wifi> msgs;
+};
+
+//shared between the workers and the writer
+struct batch_state {
+  const csi_parser* parser;
+  std::string rx_id;
+  std::vector<csi_record> records;
+  //first record of every measurement, see group_capture
+  std::vector<size_t> starts;
+  std::vector<decode_chunk> chunks;
+  //chunks handed out / written so far. the messages of chunks handed out but not written take at most
+  //max_bytes, except that the chunk the writer waits for is always handed out
+  size_t next = 0;
+  size_t written = 0;
+  size_t queued_bytes = 0;
+  size_t max_bytes = 0;
+  std::mutex lock;
+  std::condition_variable cv;
+};
+
+static void decode_range(batch_state &s, csi_pool &pool, decode_chunk &c){
+  std::vector<csi_instance> group;
+  group.reserve(16);
+  for(size_t g = c.begin; g < c.end; ++g){
+	for(size_t i = s.starts[g]; i < group_end(s.starts, s.records.size(), g); ++i){
+	  const csi_record &r = s.records[i];
+	  csi_instance out;
+	  if(s.parser->decode(r.payload, r.len, r.stamp, pool, out) == CSI_FRAME_OK) group.push_back(std::move(out));
+	}
+	if(group.empty()) continue;
+	c.msgs.emplace_back();
+	csi_fill_msg(group, s.rx_id, c.msgs.back());
+	group.clear();
+  }
+}
+
+//bytes of the Wifi message of measurement g, a dense 4x4 grid of n_sub real and imaginary doubles
+static size_t msg_bytes(const batch_state &s, size_t g){
+  const csi_udp_frame* h = reinterpret_cast<const csi_udp_frame*>(s.records[s.starts[g]].payload);
+  return sizeof(rf_msgs::Wifi) + 2*16*csi_bw_nsub[(h->chanspec >> 11) & 0x07]*sizeof(double);
+}
+
+//splits measurements [begin, end) into chunks of at most CHUNK_RECORDS records and max_bytes of messages
+static void split_decode_chunks(batch_state &s, size_t begin, size_t end, size_t max_bytes){
+  size_t g = begin;
+  while(g < end){
+	decode_chunk c;
+	c.begin = g;
+	c.bytes = 0;
+	c.done = false;
+	do{
+	  c.bytes += msg_bytes(s, g);
+	  ++g;
+	}while(g < end && group_end(s.starts, s.records.size(), g) - s.starts[c.begin] <= CHUNK_RECORDS &&
+		   c.bytes + msg_bytes(s, g) <= max_bytes);
+	c.end = g;
+	s.chunks.push_back(c);
+  }
+}
+
+static void decode_worker(batch_state* s){
+  csi_pool pool(WORKER_POOL_SIZE);
+  for(;;){
+	size_t k;
+	{
+	  std::unique_lock<std::mutex> lk(s->lock);
+	  s->cv.wait(lk, [s]{
+		return s->next >= s->chunks.size() || s->next == s->written ||
+		  s->queued_bytes + s->chunks[s->next].bytes <= s->max_bytes;
+	  });
+	  if(s->next >= s->chunks.size()) return;
+	  k = s->next++;
+	  s->queued_bytes += s->chunks[k].bytes;
+	}
+	decode_range(*s, pool, s->chunks[k]);
+	{
+	  std::lock_guard<std::mutex> lk(s->lock);
+	  s->chunks[k].done = true;
+	}
+	s->cv.notify_all();
+  }
+}
+
+static void write_bin(FILE* fp, const rf_msgs::Wifi &m){
+  csi_bin_header h;
+  memset(&h, 0, sizeof(h));
+  h.stamp_ns = m.header.stamp.toNSec();
+  memcpy(h.txmac, m.txmac.data(), m.txmac.size() < 6 ? m.txmac.size() : 6);
+  h.seq_num = m.seq_num;
+  h.n_sub = m.n_sub;
+  h.bw = m.bw;
+  h.chan = m.chan;
+  h.fc = m.fc;
+  h.rssi = m.rssi;
+  h.n_rows = m.n_rows;
+  h.n_cols = m.n_cols;
+  fwrite(&h, sizeof(h), 1, fp);
+  fwrite(m.csi_real.data(), sizeof(double), m.csi_real.size(), fp);
+  fwrite(m.csi_imag.data(), sizeof(double), m.csi_imag.size(), fp);
+}
+
+static void usage(){
+  fprintf(stderr,
+		  "usage: csi_pcap_decode -o <out.bag|out.bin> [options] capture.pcap...\n"
+		  "  -o file    output, a rosbag if it ends in .bag, otherwise flat binary\n"
+		  "  -j n       decoder threads (default: all cores)\n"
+		  "  -t topic   rosbag topic (default /csi)\n"
+		  "  -r rx_id   rx_id of the messages, usually the AP's ip (default empty)\n"
+		  "  -m filter  only keep frames from this MAC, e.g. 11:22:*:*:*:*\n"
+		  "  -g n       measurements waiting for chains at once, as the node's reassembly_groups (default 64)\n"
+		  "  -w ms      how long a measurement waits for chains, as the node's reassembly_timeout_ms (default 10)\n"
+		  "  -b MB      decoded messages held for the writer at most (default 1024)\n"
+		  "  -s         use the scalar decoder instead of SIMD\n");
+}
+
+int main(int argc, char** argv){
+  std::string out_path, topic = "/csi", rx_id, filter_str;
+  unsigned threads = std::thread::hardware_concurrency();
+  bool use_simd = true;
+  csi_grouping grouping;
+  double max_mb = 1024;
+  int opt;
+  while((opt = getopt(argc, argv, "o:j:t:r:m:g:w:b:sh")) != -1){
+	switch(opt){
+	case 'o': out_path = optarg; break;
+	case 'j': threads = atoi(optarg); break;
+	case 't': topic = optarg; break;
+	case 'r': rx_id = optarg; break;
+	case 'm': filter_str = optarg; break;
+	case 'g': grouping.max_groups = atoi(optarg); break;
+	case 'w': grouping.timeout_ms = atof(optarg); break;
+	case 'b': max_mb = atof(optarg); break;
+	case 's': use_simd = false; break;
+	default: usage(); return 1;
+	}
+  }
+  if(out_path.empty() || optind >= argc){
+	usage();
+	return 1;
+  }
+  if(threads < 1) threads = 1;
+  ros::Time::init();
+
+  auto t_start = std::chrono::steady_clock::now();
+  csi_parser parser(use_simd);
+  mac_filter filter = mac_filter_str(filter_str);
+  batch_state s;
+  s.parser = &parser;
+  s.rx_id = rx_id;
+  s.max_bytes = max_mb > 0 ? (size_t)(max_mb * 1e6) : 0;
+  //small enough chunks that the limit keeps every thread busy
+  size_t chunk_bytes = s.max_bytes / (CHUNKS_PER_THREAD * threads);
+
+  //index and group every capture, chunks never span two files
+  std::vector<mapped_file> files;
+  size_t skipped = 0, in_bytes = 0, incomplete = 0;
+  for(int i = optind; i < argc; ++i){
+	mapped_file f;
+	if(!map_file(argv[i], f)){
+	  fprintf(stderr, "could not map %s: %s\n", argv[i], strerror(errno));
+	  return 1;
+	}
+	files.push_back(f);
+	size_t begin = s.records.size();
+	if(!index_capture(f, parser, filter, s.records, skipped)){
+	  fprintf(stderr, "%s is not a pcap file\n", argv[i]);
+	  return 1;
+	}
+	size_t first_group = s.starts.size();
+	incomplete += group_capture(s.records, begin, s.records.size(), grouping, s.starts);
+	split_decode_chunks(s, first_group, s.starts.size(), chunk_bytes);
+	in_bytes += f.len;
+  }
+  fprintf(stderr, "%lu CSI frames in %lu files (%lu other packets skipped), %lu measurements (%lu missing chains), %lu chunks, %u threads, %s decoder\n",
+		  s.records.size(), files.size(), skipped, s.starts.size(), incomplete, s.chunks.size(), threads, parser.decoder_name());
+
+  bool to_bag = out_path.size() > 4 && out_path.compare(out_path.size() - 4, 4, ".bag") == 0;
+  rosbag::Bag bag;
+  FILE* bin = NULL;
+  if(to_bag){
+	try{
+	  bag.open(out_path, rosbag::bagmode::Write);
+	}
+	catch(rosbag::BagException &e){
+	  fprintf(stderr, "could not open %s: %s\n", out_path.c_str(), e.what());
+	  return 1;
+	}
+  }
+  else{
+	bin = fopen(out_path.c_str(), "wb");
+	if(!bin){
+	  fprintf(stderr, "could not open %s: %s\n", out_path.c_str(), strerror(errno));
+	  return 1;
+	}
+	uint32_t version = CSI_BIN_VERSION;
+	fwrite(CSI_BIN_MAGIC, 1, 4, bin);
+	fwrite(&version, sizeof(version), 1, bin);
+  }
+
+  std::vector<std::thread> workers;
+  for(unsigned i = 0; i < threads; ++i) workers.push_back(std::thread(decode_worker, &s));
+
+  //write chunks in capture order as they finish
+  size_t n_msgs = 0;
+  bool failed = false;
+  for(size_t k = 0; k < s.chunks.size() && !failed; ++k){
+	std::vector<rf_msgs::Wifi> msgs;
+	{
+	  std::unique_lock<std::mutex> lk(s.lock);
+	  s.cv.wait(lk, [&]{ return s.chunks[k].done; });
+	  msgs.swap(s.chunks[k].msgs);
+	}
+	try{
+	  for(size_t i = 0; i < msgs.size(); ++i){
+		if(to_bag) bag.write(topic, msgs[i].header.stamp, msgs[i]);
+		else write_bin(bin, msgs[i]);
+	  }
+	}
+	catch(rosbag::BagException &e){
+	  fprintf(stderr, "rosbag error: %s\n", e.what());
+	  failed = true;
+	}
+	if(bin && ferror(bin)){
+	  fprintf(stderr, "write error: %s\n", strerror(errno));
+	  failed = true;
+	}
+	n_msgs += msgs.size();
+	{
+	  std::lock_guard<std::mutex> lk(s.lock);
+	  ++s.written;
+	  s.queued_bytes -= s.chunks[k].bytes;
+	  //stop handing out work
+	  if(failed) s.next = s.chunks.size();
+	}
+	s.cv.notify_all();
+  }
+  for(size_t i = 0; i < workers.size(); ++i) workers[i].join();
+
+  if(to_bag) bag.close();
+  else fclose(bin);
+  if(failed) return 1;
+
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+  fprintf(stderr, "wrote %lu messages to %s in %.2f s (%.1f MB/s of capture)\n",
+		  n_msgs, out_path.c_str(), secs, in_bytes / secs / 1e6);
+
+  for(size_t i = 0; i < files.size(); ++i) unmap_file(files[i]);
+  return 0;
+}
@@ -0,0 +1,97 @@
+//summarizes a csi_node recording (record_prefix), or lists the measurements in a time range or from one
+//transmitter. only reads the index unless a listed measurement's CSI is asked for.
+//
+//usage: csi_record_info [-b sec] [-e sec] [-m mac] [-l] [-c] prefix
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <map>
+#include <string>
+#include "csi_record_reader.h"
+
+static void usage(){
+  fprintf(stderr,
+		  "usage: csi_record_info [options] prefix\n"
+		  "  prefix     record_prefix of the recording, e.g. /data/run1 for /data/run1_00000.csir...\n"
+		  "  -b sec     only measurements at least this long after the first one\n"
+		  "  -e sec     only measurements less than this long after the first one\n"
+		  "  -m mac     only measurements from this transmitter, e.g. 11:22:33:44:55:66\n"
+		  "  -l         list the measurements instead of counting them per transmitter\n"
+		  "  -c         with -l, also print the first subcarrier of every chain\n");
+}
+
+static std::string mac_str(const uint8_t* m){
+  char s[20];
+  snprintf(s, sizeof(s), "%02x:%02x:%02x:%02x:%02x:%02x", m[0], m[1], m[2], m[3], m[4], m[5]);
+  return s;
+}
+
+int main(int argc, char** argv){
+  double begin = 0, end = -1;
+  uint8_t mac[6];
+  bool use_mac = false, list = false, show_csi = false;
+  int opt;
+  while((opt = getopt(argc, argv, "b:e:m:lch")) != -1){
+	switch(opt){
+	case 'b': begin = atof(optarg); break;
+	case 'e': end = atof(optarg); break;
+	case 'm':
+	  if(sscanf(optarg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != 6){
+		fprintf(stderr, "invalid MAC %s, should be xx:xx:xx:xx:xx:xx\n", optarg);
+		return 1;
+	  }
+	  use_mac = true;
+	  break;
+	case 'l': list = true; break;
+	case 'c': show_csi = true; break;
+	default: usage(); return 1;
+	}
+  }
+  if(optind != argc - 1){
+	usage();
+	return 1;
+  }
+
+  csi_record_reader rd;
+  std::string err;
+  if(!rd.open(argv[optind], err)){
+	fprintf(stderr, "could not open the recording: %s\n", err.c_str());
+	return 1;
+  }
+  uint64_t first = rd.first_ns(), last = rd.last_ns();
+  printf("%lu segments, %lu measurements, %.3f s from %lu.%09lu\n",
+		 rd.segments(), rd.records(), (last - first) * 1e-9, first / 1000000000, first % 1000000000);
+
+  uint64_t t0 = first + (uint64_t)(begin * 1e9);
+  uint64_t t1 = end < 0 ? UINT64_MAX : first + (uint64_t)(end * 1e9);
+  std::vector<csi_rec_entry> found = rd.find(t0, t1, use_mac ? mac : NULL);
+  if(!list){
+	std::map<std::string, size_t> per_mac;
+	for(size_t i = 0; i < found.size(); ++i) ++per_mac[mac_str(found[i].mac)];
+	printf("%lu measurements selected\n", found.size());
+	for(std::map<std::string, size_t>::iterator it = per_mac.begin(); it != per_mac.end(); ++it)
+	  printf("  %s: %lu\n", it->first.c_str(), it->second);
+	return 0;
+  }
+  for(size_t i = 0; i < found.size(); ++i){
+	const csi_rec_entry &e = found[i];
+	printf("%.6f %s seq %u", (e.stamp_ns - first) * 1e-9, mac_str(e.mac).c_str(), e.seq);
+	if(show_csi){
+	  const csi_rec_header* h = rd.record(e);
+	  if(!h){
+		printf(" (damaged)\n");
+		continue;
+	  }
+	  printf(" chan %u bw %u rssi %d n_sub %u", h->chan, h->bw, h->rssi, h->n_sub);
+	  for(int b = 0; b < 16; ++b){
+		const float* c = csi_record_reader::chain(h, b / 4, b % 4);
+		if(c) printf(" [%d,%d] %g%+gi", b / 4, b % 4, c[0], c[h->n_sub]);
+	  }
+	}
+	printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,101 @@
+//sends synthetic nexmon CSI udp packets, in place of an ASUS, to a csi_node running with no_config.
+//see csi_loadtest for measuring how the node keeps up.
+//
+//usage: csi_synth [-r frames_per_s] [-d seconds] [-b bw] [-c channel] [-x nss_mask] [-y core_mask]
+//                 [-n n_macs] [-q inc|const|random] [-l loss] [-o reorder] [-w reorder_depth] [-a addr] [-p port]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include "csi_synth.h"
+
+static std::atomic<bool> stop_sending(false);
+
+static void handle_sigint(int){
+  stop_sending = true;
+}
+
+static void usage(){
+  fprintf(stderr,
+		  "usage: csi_synth [options]\n"
+		  "  -r rate    frames per second (default 10000)\n"
+		  "  -d secs    how long to send for, 0 until ctrl-c (default 0)\n"
+		  "  -b bw      bandwidth, 20, 40, 80 or 160 MHz (default 80)\n"
+		  "  -c chan    channel (default 157)\n"
+		  "  -x mask    spatial streams (tx) to report, bitmask (default 0xf)\n"
+		  "  -y mask    rx cores to report, bitmask (default 0xf)\n"
+		  "  -n macs    number of transmitters (default 1)\n"
+		  "  -q mode    sequence numbers: inc, const or random (default inc)\n"
+		  "  -l prob    probability of dropping a frame (default 0)\n"
+		  "  -o prob    probability of reordering a frame (default 0)\n"
+		  "  -w depth   how far a frame can be reordered (default 4)\n"
+		  "  -a addr    destination (default 127.0.0.1)\n"
+		  "  -p port    destination port (default 5500)\n");
+}
+
+int main(int argc, char** argv){
+  csi_synth_config cfg;
+  double rate = 10000, duration = 0;
+  std::string addr = "127.0.0.1";
+  int port = 5500;
+  int opt;
+  while((opt = getopt(argc, argv, "r:d:b:c:x:y:n:q:l:o:w:a:p:h")) != -1){
+	switch(opt){
+	case 'r': rate = atof(optarg); break;
+	case 'd': duration = atof(optarg); break;
+	case 'b': cfg.bw = atoi(optarg); break;
+	case 'c': cfg.channel = atoi(optarg); break;
+	case 'x': cfg.nss_mask = strtol(optarg, NULL, 0); break;
+	case 'y': cfg.core_mask = strtol(optarg, NULL, 0); break;
+	case 'n': cfg.n_macs = atoi(optarg); break;
+	case 'q':
+	  if(!csi_synth_seq_mode(optarg, cfg.seq_mode)){
+		usage();
+		return 1;
+	  }
+	  break;
+	case 'l': cfg.loss = atof(optarg); break;
+	case 'o': cfg.reorder = atof(optarg); break;
+	case 'w': cfg.reorder_depth = atoi(optarg); break;
+	case 'a': addr = optarg; break;
+	case 'p': port = atoi(optarg); break;
+	default: usage(); return 1;
+	}
+  }
+
+  csi_synth synth(cfg);
+  if(!synth.ok() || rate <= 0){
+	fprintf(stderr, "invalid bandwidth, chain masks, transmitter count or rate\n");
+	return 1;
+  }
+
+  struct sockaddr_in dst;
+  memset(&dst, 0, sizeof(dst));
+  dst.sin_family = AF_INET;
+  dst.sin_port = htons(port);
+  if(inet_pton(AF_INET, addr.c_str(), &dst.sin_addr) != 1){
+	fprintf(stderr, "invalid address %s\n", addr.c_str());
+	return 1;
+  }
+  int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if(fd < 0){
+	perror("socket creation failed");
+	return 1;
+  }
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(int));
+
+  signal(SIGINT, handle_sigint);
+  fprintf(stderr, "sending %d MHz CSI (%u subcarriers) to %s:%d at %.0f frames/s\n",
+		  cfg.bw, synth.subcarriers(), addr.c_str(), port, rate);
+  uint64_t t0 = csi_synth_now_ns();
+  uint64_t sent = csi_synth_send(synth, fd, dst, rate, duration, stop_sending,
+								 [](const csi_synth_frame&, uint64_t){});
+  double secs = (csi_synth_now_ns() - t0) * 1e-9;
+  fprintf(stderr, "sent %lu frames in %.2f s (%.0f frames/s), %lu more dropped on purpose\n",
+		  sent, secs, sent / secs, synth.frames_lost());
+  close(fd);
+  return 0;
+}
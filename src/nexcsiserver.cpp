@@ -1,76 +1,75 @@
 //reads udp data from nexmon_csi running on an ASUS
-//converts to CSI message format
+//converts to CSI message format. csi_node.cpp and csi_nodelet.cpp run it.
 
 #include "nexcsiserver.h"
 
-//CSI-Buffering related globals
-std::vector<csi_instance> channel_current;
-uint16_t last_seq;
-
-//Buffer in which the full CSI message is reconstructed
-double* csi_r_out = NULL;
-double* csi_i_out = NULL;
-//size of the above buffers
-size_t csi_size = 0;
-
-//Info about the ASUS that the node is connected to
-std::string rx_ip;
-std::string rx_pass;
-std::string rx_host;
-
-//Forward the packets over tcpdump->netcat (older kernels won't receive the udp broadcasts)
-bool use_tcp = false;
-
-//Don't configure
-bool no_config = false;
-
-//Info about the node itself
-std::string hostname;
-
-//publisher
-ros::Publisher pub_csi;
-ros::Subscriber sub_ap;
-
-//info about current wireless settings
-int ch, bw;
-double beacon;
-
-//parameters that differ between 2.4GHz and 5GHz.
-std::string iface;
-int tx_nss;
-
-//MAC addresses to be filtered for in software
-mac_filter filter;
-bool use_software_mac_filter = true;
-
-//if not "", the node will listen on the given topic for a list of APs and try to collect CSI from
-//the first AP on the list.
-std::string lock_topic;
-
-//various buffers
-unsigned char *csi_buf, *csi_data;
-
-int main(int argc, char* argv[]){
-
-  //setup ros
-  ros::init(argc, argv, "nexcsi", ros::init_options::NoSigintHandler);
-  ros::NodeHandle nh("~");
-
-  ros::AsyncSpinner spinner(0);
-  spinner.start();
-
+csi_server::csi_server(ros::NodeHandle nh) : nh(nh), running(true),
+  mac_routing(std::make_shared<const csi_mac_routing>()), use_software_mac_filter(false), mac_routes(false), kernel_drops(0), pipeline_running(false){
+}
 
-  ros::ServiceServer set_chanspec_srv = nh.advertiseService<wiros_csi_node::ConfigureCSI::Request, wiros_csi_node::ConfigureCSI::Response>("configure_csi",config_csi_callback);
+csi_server::~csi_server(){
+  stop();
+  stop_pipeline();
+  stats_timer.stop();
+  diag_timer.stop();
+  if(sockfd >= 0) close(sockfd);
+  if(connfd >= 0) close(connfd);
+  if(wake_fd >= 0) close(wake_fd);
+  delete raw_q;
+  delete decoded_q;
+  delete group_q;
+  for(size_t i = 0; i < worker_q.size(); ++i) delete worker_q[i];
+  //groups still hold pool slots, return them before the pool goes away
+  delete reassembly;
+  for(size_t i = 0; i < routers.size(); ++i){
+	if(routers[i]->connfd >= 0) close(routers[i]->connfd);
+	delete routers[i];
+  }
+  delete ring;
+  //publishes the open batches
+  delete batcher;
+  //indexes and flushes what is left of the recording
+  delete recorder;
+  delete shm;
+  delete frame_pool;
+  delete parser;
+}
 
-  //handle shutdown
-  signal(SIGINT, handle_shutdown);
+bool csi_server::start(){
+  set_chanspec_srv = nh.advertiseService("configure_csi", &csi_server::config_csi_callback, this);
 
   //read params
-  setup_params(nh);
+  setup_params();
+
+  //fail before touching the router if there is nowhere to record or share CSI to
+  if(!record_config.prefix.empty()){
+	recorder = new csi_recorder(record_config);
+	std::string err;
+	if(!recorder->open(err)){
+	  ROS_FATAL("Could not start recording: %s", err.c_str());
+	  delete recorder;
+	  recorder = NULL;
+	  return false;
+	}
+	ROS_INFO("Recording CSI to %s%s", csi_rec_segment_path(record_config.prefix, 0).c_str(), record_only ? ", not publishing it" : "");
+  }
+  if(!shm_config.name.empty()){
+	shm = new csi_shm_writer(shm_config);
+	std::string err;
+	if(!shm->open(err)){
+	  ROS_FATAL("Could not create the shared memory ring: %s", err.c_str());
+	  delete shm;
+	  shm = NULL;
+	  return false;
+	}
+	ROS_INFO("Writing CSI to shared memory %s, %u slots of up to %u chains x %u subcarriers",
+			 shm_config.name.c_str(), shm_config.n_slots, shm_config.max_chains, shm_config.max_nsub);
+  }
+  if(!router_ips.empty() && !setup_routers()) return false;
 
   //optional subscribe to AP info topic
   if(lock_topic != std::string("")){
-	sub_ap = nh.subscribe(lock_topic, 10, ap_info_callback);
+	sub_ap = nh.subscribe(lock_topic, 10, &csi_server::ap_info_callback, this);
 	ROS_INFO("Subscribing: %s", sub_ap.getTopic().c_str());
   }
 
@@ -89,11 +88,11 @@ int main(int argc, char* argv[]){
   }
   else{
 	ROS_FATAL("Invalid target IP, needs to be xxx.xxx.xxx.xxx or xxx.xxx.xxx.*");
+	return false;
   }
 
   std::stringstream IPs(sh_exec_block("hostname -I"));
   std::string IP;
-  std::string hostIP;
   bool iface_up = false;
   while(getline(IPs, IP, ' ')){
 	if (IP.rfind(subnet, 0) == 0) {
@@ -119,19 +118,26 @@ int main(int argc, char* argv[]){
 	}
   }
   char setupcmd[512];
-  sprintf(setupcmd, "ping -c 3 -i 0.3 %s", rx_ip.c_str());
-  std::string ping_result = sh_exec_block(setupcmd);
-  ROS_INFO("%s", ping_result.c_str());
-  if(ping_result.find("Destination Host Unreachable",0) != std::string::npos || ping_result.find("100% packet loss",0) != std::string::npos){
-	ROS_ERROR("The host at %s did not respond to a ping.", rx_ip.c_str());
-	ROS_ERROR("This is probably because the 'asus_ip' param is setup to the incorrect value.");
-	ROS_ERROR("You can enable automatic ASUS detection by setting 'asus_ip' to \"\"");
-	exit(1);
+  std::vector<std::string> targets = router_ips.empty() ? std::vector<std::string>(1, rx_ip) : router_ips;
+  for(size_t i = 0; i < targets.size(); ++i){
+	sprintf(setupcmd, "ping -c 3 -i 0.3 %s", targets[i].c_str());
+	std::string ping_result = sh_exec_block(setupcmd);
+	ROS_INFO("%s", ping_result.c_str());
+	if(ping_result.find("Destination Host Unreachable",0) != std::string::npos || ping_result.find("100% packet loss",0) != std::string::npos){
+	  ROS_ERROR("The host at %s did not respond to a ping.", targets[i].c_str());
+	  ROS_ERROR("This is probably because the 'asus_ip' or 'routers' param is setup to the incorrect value.");
+	  ROS_ERROR("You can enable automatic ASUS detection by setting 'asus_ip' to \"\"");
+	  if(!no_config) return false;
+	}
   }
 
+  //without configuring, the node can also take CSI from another source, e.g. csi_synth on loopback
   if(!iface_up){
-	ROS_ERROR("The subnet does not appear to be active.");
-	exit(1);
+	if(!no_config){
+	  ROS_ERROR("The subnet does not appear to be active.");
+	  return false;
+	}
+	ROS_WARN("The connection w/subnet %s is not active.", subnet);
   }
 
   //figure out the name of this computer
@@ -139,16 +145,14 @@ int main(int argc, char* argv[]){
   //mac address we will transmit on will be 17:17:17:first byte of name:second byte of name:last byte of ip4
   uint8_t mac4 = hostname[0];
   uint8_t mac5 = hostname[1];
-  size_t pos = hostIP.rfind('.');
-  uint8_t mac6 = (uint8_t)std::stoi(std::string(hostIP).erase(0,pos+1));
-
-  if(!ros::ok()){
-	return 0;
+  uint8_t mac6 = 0;
+  if(iface_up){
+	size_t pos = hostIP.rfind('.');
+	mac6 = (uint8_t)std::stoi(std::string(hostIP).erase(0,pos+1));
   }
 
-  if(!iface_up){
-	ROS_INFO("The connection w/subnet %s is not active.", subnet);
-	exit(1);
+  if(!ros::ok()){
+	return false;
   }
 
 
@@ -162,13 +166,13 @@ int main(int argc, char* argv[]){
 	while(unconfigured){
 	  if(set_chanspec((int)ch, (int)bw)){
 		ROS_ERROR("Invalid channel or bandwidth.");
-		exit(1);
+		return false;
 	  }
 	  std::string res_out = reconfigure();
 	  ROS_INFO("\n***\nSetup Output:\n\n%s\n***", res_out.c_str());
 	  if(res_out.find("Permission denied") != std::string::npos){
 		ROS_ERROR("A device was found at %s, but it refused SSH access.\nPlease check the 'asus_pwd' param and ensure it is set to the device's password.\nCurrent passsword: %s\nThis may also be caused by setup scripts not having the correct permissions set.",rx_ip.c_str(),rx_pass.c_str());
-		exit(EXIT_FAILURE);
+		return false;
 	  }
 	  if(res_out.find("Connection refused") != std::string::npos){
 		ROS_INFO("Waiting 5 seconds and retrying...");
@@ -180,7 +184,7 @@ int main(int argc, char* argv[]){
 	}
   }
 
-  if(beacon > 0) {
+  if(beacon > 0 && iface_up) {
 	ROS_INFO("Starting transmitter...");
 	sprintf(setupcmd, "sshpass -p %s ssh -o strictHostKeyChecking=no %s@%s /jffs/csi/send.sh %d %d %d %s 11 11 11 %x %x %x > /dev/null 2>&1",
             rx_pass.c_str(), rx_host.c_str(), rx_ip.c_str(), bw, tx_nss,
@@ -195,12 +199,23 @@ int main(int argc, char* argv[]){
   // rx_no_dot.erase(remove(rx_no_dot.begin(), rx_no_dot.end(), '.'), rx_no_dot.end());
   // sprintf(topic_name, "csi", rx_no_dot.c_str());
   sprintf(topic_name, "/csi");
-  pub_csi = nh.advertise<rf_msgs::Wifi>(topic_name,10);
+  pub_csi = advertise_csi(topic_name);
   ROS_INFO("Publishing: %s", pub_csi.getTopic().c_str());
+  for(size_t i = 0; i < routers.size(); ++i){
+	if(router_topics){
+	  //topic names can't contain dots
+	  std::string ip_name = routers[i]->ip;
+	  std::replace(ip_name.begin(), ip_name.end(), '.', '_');
+	  routers[i]->pub = advertise_csi(std::string("/csi/rx_") + ip_name);
+	  ROS_INFO("Publishing %s on %s", routers[i]->ip.c_str(), routers[i]->pub.getTopic().c_str());
+	}
+	else{
+	  routers[i]->pub = pub_csi;
+	}
+  }
 
 
-  int sockfd, connfd;
-  socklen_t len;
+  if(!ring_iface.empty()) return setup_ring();
 
   struct sockaddr_in servaddr, cliaddr;
   socklen_t sockaddr_len = sizeof(cliaddr);
@@ -209,20 +224,16 @@ int main(int argc, char* argv[]){
   if (use_tcp) {//forward over tcpdump-netcat
 	if ( (sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ) {
 	  perror("socket creation failed");
-	  exit(EXIT_FAILURE);
+	  return false;
 	}
   }
   else{//forward over udp
     if ( (sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0 ) {
 	  perror("socket creation failed");
-	  exit(EXIT_FAILURE);
+	  return false;
     }
-	struct timeval tv;
-	tv.tv_sec = 1;
-	tv.tv_usec = 10000;
-	if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO,&tv,sizeof(tv)) < 0) {
-	  perror("Error");
-	}
+	setup_udp_socket(sockfd);
+	apply_mac_filter();
   }
   memset(&servaddr, 0, sizeof(servaddr));
   memset(&cliaddr, 0, sizeof(cliaddr));
@@ -245,287 +256,892 @@ int main(int argc, char* argv[]){
 			sizeof(servaddr)) < 0 )
 	{
 	  ROS_INFO("bind failed: %s", strerror(errno));
-	  exit(EXIT_FAILURE);
+	  return false;
 	}
 
   ROS_INFO("Opened socket.");
 
-  int n;
+  //the receive loop accepts each router's connection itself
+  if(use_tcp && !routers.empty()){
+	fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+	if(listen(sockfd, routers.size() + 4) != 0){
+	  ROS_ERROR("listen failed: %s", strerror(errno));
+	  return false;
+	}
+	for(size_t i = 0; i < routers.size(); ++i) routers[i]->cli_fp = setup_tcpdump(routers[i]->ip, hostIP);
+	return true;
+  }
 
   if(use_tcp){
-    setup_tcpdump(hostIP);
-    while(ros::ok() && (listen(sockfd, 5)) != 0){
+    cli_fp = setup_tcpdump(rx_ip, hostIP);
+    while(running && ros::ok() && (listen(sockfd, 5)) != 0){
 	  ROS_INFO("Waiting for TCP connection...");
 	  sleep(1);
     }
-    while(ros::ok()) {
-	  connfd = accept(sockfd, (SA * ) & cliaddr, &len);
-	  
-	  
-	  if (connfd == -1 && errno == EAGAIN) {
-		sleep(0.05);
+    if(!accept_tcp()) return false;
+  }
+
+  return true;
+}
+
+//waits for the router's tcpdump to connect. polls rather than blocking in accept() so stop() can end the wait
+bool csi_server::accept_tcp(){
+  struct pollfd pfd;
+  pfd.fd = sockfd;
+  pfd.events = POLLIN;
+  while(running && ros::ok()){
+	int r = poll(&pfd, 1, 100);
+	if(r < 0 && errno != EINTR){
+	  ROS_ERROR("Waiting for the TCP connection failed: %s", strerror(errno));
+	  return false;
+	}
+	if(r <= 0) continue;
+	connfd = accept(sockfd, NULL, NULL);
+	if(connfd >= 0){
+	  ROS_INFO("Accepted Connection from %s", rx_ip.c_str());
+	  return true;
+	}
+	if(errno == EAGAIN || errno == EINTR || errno == ECONNABORTED) continue;
+	ROS_ERROR("Connection failed: %s", strerror(errno));
+	return false;
+  }
+  return false;
+}
+
+void csi_server::run(){
+  frame_pool = new csi_pool(pool_size);
+  reassembly = new csi_reassembler(reassembly_groups, reassembly_timeout_ns);
+
+  if(batch_csi){
+	batcher = new csi_batcher(batch_config);
+	ROS_INFO("Publishing CSI in batches of up to %lu measurements, flushed after %.0f ms", batch_config.max_count, batch_config.window * 1e3);
+  }
+
+  if(use_pipeline && routers.empty()){
+	start_pipeline();
+	stats_timer = nh.createTimer(ros::Duration(stats_period), &csi_server::report_pipeline, this);
+  }
+  if(diag_period > 0){
+	pub_diag = nh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+	diag_prev_t = ros::WallTime::now();
+	diag_timer = nh.createTimer(ros::Duration(diag_period), &csi_server::publish_diagnostics, this);
+  }
+
+  ROS_INFO("Starting CSI collection");
+  ROS_WARN("Filtering for MAC Addresses: %s%s",hr_mac_table(std::atomic_load(&mac_routing)->table).c_str(), kernel_filter_attached ? " (in the kernel)" : "");
+
+  if(!routers.empty())
+	run_routers();
+  else if(ring)
+	run_ring();
+  else if(use_tcp)
+	run_tcp();
+  else
+	run_udp();
+
+  stop_pipeline();
+}
+
+void csi_server::stop(){
+  running = false;
+  if(wake_fd >= 0){
+	uint64_t one = 1;
+	if(write(wake_fd, &one, sizeof(one)) < 0){}
+  }
+}
+
+//normal udp broadcast version
+void csi_server::run_udp(){
+  int n;
+  //drain up to recv_batch datagrams per syscall into pre-allocated slots
+  csi_rx_batch rx(recv_batch);
+  while(running && ros::ok() && !ros::isShuttingDown()){
+	rx.reset();
+	//a blocking receive waits up to recv_timeout_ms, which is too long for a group waiting for chains
+	bool waiting = groups_waiting();
+	if ((n = recvmmsg(sockfd, rx.msgs, rx.n_slots, waiting ? MSG_DONTWAIT : MSG_WAITFORONE, NULL)) == -1){
+	  if(errno == ETIMEDOUT || errno == EAGAIN || errno == EINTR){
+		if(waiting) wait_readable(sockfd);
+		//without the pipeline this thread owns the reassembler, publish what has timed out
+		if(!pipeline_running) expire_groups();
 		continue;
 	  }
-	  else if(connfd > 0) {
-		ROS_INFO("Accepted Connection from %s", rx_ip.c_str());
-		break;
-	  }
-	  else{
-		ROS_ERROR("Connection failed.");
-		exit(1);
+	  ROS_ERROR("Socket Error: %s", strerror(errno));
+	  continue;
+	}
+
+	uint64_t mono_ns = csi_mono_ns(), real_ns = csi_real_ns();
+	for(int i = 0; i < n; ++i){
+	  uint64_t rx_ns;
+	  ros::Time stamp;
+	  read_ancillary(&rx.msgs[i].msg_hdr, mono_ns, real_ns, rx_ns, stamp);
+	  if(rx.msgs[i].msg_len > 0){
+		ingest_csi(rx.frame(i), rx.msgs[i].msg_len, rx_ns, stamp);
 	  }
-    }
+	}
+
+	warn_kernel_drops();
+	if(!pipeline_running) expire_groups();
   }
+}
 
-  ROS_INFO("Starting CSI collection");
-  //buffer to hold incoming UDP data
-  char buffer[MAXLINE];
+bool csi_server::setup_ring(){
+  if(use_tcp || !routers.empty()){
+	ROS_FATAL("ring_iface can't be used with tcp_forward or routers");
+	return false;
+  }
+  ring = new csi_packet_ring();
+  std::string what;
+  if(!ring->open(ring_config, what)){
+	ROS_FATAL("Could not open the packet ring on %s (%s): %s. It needs CAP_NET_RAW.", ring_iface.c_str(), what.c_str(), strerror(errno));
+	return false;
+  }
+  //filter before binding, so only frames that pass it are ever captured
+  apply_mac_filter();
+  if(!ring->bind(ring_config.iface, what)){
+	ROS_FATAL("Could not open the packet ring on %s (%s): %s", ring_iface.c_str(), what.c_str(), strerror(errno));
+	return false;
+  }
+  ROS_INFO("Capturing from a %lu KB packet ring on %s", ring->ring_bytes() / 1024, ring_iface.c_str());
+  return true;
+}
 
-  //incoming data is separated by packet, stored in here
-  csi_buf = new unsigned char[CSI_BUF_SIZE];
-  csi_data = new unsigned char[CSI_BUF_SIZE];
-  //CSI binary data is then processed into a csi_data struct, put in here
-  std::queue<csi_instance> pkts;
-  int it = 0;
-  size_t csi_pos = 0;
+//capture straight from the packet ring, frames are decoded where the kernel wrote them
+void csi_server::run_ring(){
+  while(running && ros::ok() && !ros::isShuttingDown()){
+	uint64_t mono_ns = 0, real_ns = 0;
+	int n = ring->read((recv_wait_ns() + 999999) / 1000000, [&](unsigned char* data, size_t len, uint16_t port, uint64_t kernel_ns){
+	  //the filter already checks the port, unless it could not be attached
+	  if(port != PORT) return;
+	  if(mono_ns == 0){
+		mono_ns = csi_mono_ns();
+		real_ns = csi_real_ns();
+	  }
+	  uint64_t rx_ns;
+	  ros::Time stamp;
+	  stamp_arrival(kernel_ns, mono_ns, real_ns, rx_ns, stamp);
+	  ingest_ring(data, len, rx_ns, stamp);
+	});
+	if(n < 0){
+	  ROS_ERROR("Packet ring error: %s", strerror(errno));
+	  break;
+	}
+	kernel_drops.fetch_add(ring->drops(), std::memory_order_relaxed);
+	warn_kernel_drops();
+	if(!pipeline_running) expire_groups();
+  }
+}
 
-  ROS_WARN("Filtering for MAC Addresses: %s",hr_mac_filt(filter).c_str());
+void csi_server::ingest_ring(unsigned char* data, size_t nbytes, uint64_t rx_ns, const ros::Time &stamp){
+  csi_thread_stats &st = stats.local();
+  st.count(CSI_STAT_FRAMES_RECEIVED);
+  if(!pipeline_running){
+	parse_csi(data, nbytes, rx_ns, stamp);
+	return;
+  }
+  //the block goes back to the kernel after this, so decode now rather than queue a pointer into it
+  csi_instance* out = decoded_q->write_slot();
+  if(!out){
+	decoded_q->mark_overflow();
+	st.count(CSI_STAT_QUEUE_DROPPED);
+	return;
+  }
+  if(decode_csi(data, nbytes, rx_ns, stamp, *out))
+	decoded_q->push();
+}
 
-  //normal udp broadcast version
-  if(!use_tcp){
-    while(ros::ok() && !ros::isShuttingDown()){
-	  if ((n = recvfrom(sockfd, csi_buf, CSI_BUF_SIZE, 0, (struct sockaddr *)&cliaddr, &sockaddr_len)) == -1){
-		if(errno == ETIMEDOUT || errno == EAGAIN){
-		  continue;
-		}
-		ROS_ERROR("Socket Error: %s", strerror(errno));
+void csi_server::warn_kernel_drops(){
+  uint32_t drops = kernel_drops.load(std::memory_order_relaxed);
+  if(drops != kernel_drops_reported){
+	ROS_WARN_THROTTLE(5.0, "Kernel dropped %u CSI frames (%u total), consider raising %s",
+					  drops - kernel_drops_reported, drops, ring ? "'ring_blocks' or 'ring_block_kb'" : "'rcvbuf_size' or 'recv_batch'");
+	kernel_drops_reported = drops;
+  }
+}
+
+//parse the pcap stream from tcpdump, each record holds one CSI udp packet
+void csi_server::run_tcp(){
+  pcap_stream stream;
+  pcap_record rec;
+  uint64_t skipped = 0;
+
+  while(running && ros::ok()){
+	//never block in recv, so waiting groups are published on time and stop() is noticed
+	ssize_t n = recv(connfd, stream.write_ptr(TCP_READ_SIZE), TCP_READ_SIZE, MSG_DONTWAIT);
+	if(n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)){
+	  wait_readable(connfd);
+	  if(!pipeline_running) expire_groups();
+	  continue;
+	}
+	if(n <= 0){
+	  //tcpdump exited or the connection dropped, wait for the router to connect again
+	  if(n == 0) ROS_WARN("Lost connection from %s, waiting for it to reconnect", rx_ip.c_str());
+	  else ROS_ERROR("Lost connection from %s (%s), waiting for it to reconnect", rx_ip.c_str(), strerror(errno));
+	  close(connfd);
+	  connfd = -1;
+	  //a new connection starts with a fresh pcap header
+	  stream.reset();
+	  //the missing chains went with the connection
+	  if(!pipeline_running){
+		reassembly->flush([this](std::vector<csi_instance> &g, bool complete){
+		  emit_group(g, complete);
+		});
 	  }
-	  //	  ROS_INFO("%s", inet_ntoa(cliaddr.sin_addr));
-	  
-	  if(n > 0){
-		//#ifdef Debug
-		//ROS_INFO("Read %d", n);
-		//#endif
-		parse_csi(csi_buf, n);
+	  if(!accept_tcp()) break;
+	  continue;
+	}
+	stream.commit(n);
+	uint64_t rx_ns = csi_mono_ns();
+	uint64_t real_ns = csi_real_ns();
+
+	while(stream.next(rec)){
+	  const unsigned char* payload;
+	  size_t payload_len;
+	  if(!pcap_udp_payload(stream.link_type(), rec.data, rec.caplen, &payload, &payload_len)){
+		++skipped;
+		ROS_WARN_THROTTLE(5.0, "Skipped %lu captured packets that were not CSI udp packets (link type %u)", skipped, stream.link_type());
+		continue;
 	  }
-    }
+	  ros::Time stamp(real_ns / 1000000000ull, real_ns % 1000000000ull);
+	  if(use_router_stamps) stamp = ros::Time(rec.ts_sec, rec.ts_nsec);
+	  ingest_csi(const_cast<unsigned char*>(payload), payload_len, rx_ns, stamp);
+	}
+	if(!pipeline_running) expire_groups();
+	if(stream.bad()){
+	  ROS_ERROR("Invalid pcap data from tcpdump, no longer receiving CSI");
+	  break;
+	}
+  }
+}
+
+void csi_server::ingest_csi(unsigned char* data, size_t nbytes, uint64_t rx_ns, const ros::Time &stamp){
+  csi_thread_stats &st = stats.local();
+  st.count(CSI_STAT_FRAMES_RECEIVED);
+  if(!pipeline_running){
+	parse_csi(data, nbytes, rx_ns, stamp);
+	return;
+  }
+  //never block the socket reader, drop the frame if the decoder has fallen behind
+  csi_raw_frame* f = raw_q->write_slot();
+  if(!f){
+	raw_q->mark_overflow();
+	st.count(CSI_STAT_QUEUE_DROPPED);
+	return;
   }
+  f->len = nbytes < CSI_BUF_SIZE ? nbytes : CSI_BUF_SIZE;
+  f->stamp = stamp;
+  f->rx_ns = rx_ns;
+  memcpy(f->data, data, f->len);
+  raw_q->push();
+}
 
-  else{//decode the received packet from tcpdump
-    while(ros::ok()){
+void csi_server::start_pipeline(){
+  raw_q = new spsc_queue<csi_raw_frame>(pipeline_depth);
+  decoded_q = new spsc_queue<csi_instance>(pipeline_depth);
+  group_q = new spsc_queue<std::vector<csi_instance> >(pipeline_depth / 4 + 1);
+  //reserve every group slot up front, they are swapped with finished groups rather than reallocated
+  for(size_t i = 0; i < group_q->capacity(); ++i){
+	std::vector<csi_instance>* g = group_q->write_slot();
+	g->reserve(16);
+	group_q->push();
+	group_q->read_slot();
+	group_q->pop();
+  }
+  pipeline_running = true;
+  //the ring is decoded in place by the receive thread, there is nothing for a decode stage to do
+  if(!ring) decode_thread = std::thread(&csi_server::decode_stage, this);
+  assemble_thread = std::thread(&csi_server::assemble_stage, this);
+  publish_thread = std::thread(&csi_server::publish_stage, this);
+  pin_thread(pthread_self(), pipeline_cpus[0], "receive");
+  if(!ring) pin_thread(decode_thread.native_handle(), pipeline_cpus[1], "decode");
+  pin_thread(assemble_thread.native_handle(), pipeline_cpus[2], "assemble");
+  pin_thread(publish_thread.native_handle(), pipeline_cpus[3], "publish");
+  ROS_INFO("Started CSI pipeline, queue depth %lu", raw_q->capacity());
+}
 
-	  n = read(connfd, buffer, MAXLINE);
-	  if(n == 0) continue;
+void csi_server::stop_pipeline(){
+  if(!pipeline_running) return;
+  pipeline_running = false;
+  raw_q->wake();
+  decoded_q->wake();
+  group_q->wake();
+  if(decode_thread.joinable()) decode_thread.join();
+  assemble_thread.join();
+  publish_thread.join();
+}
 
-	  //if too much data is accumulating with no packets found, get rid of all our data
-	  if(csi_pos + n > CSI_BUF_SIZE){
-		ROS_ERROR("CSI BUFFER OVERFLOWED, FLUSHING");
-		memset(csi_buf, 0, CSI_BUF_SIZE);
-		csi_pos = 0;
-	  }
+void csi_server::decode_stage(){
+  size_t idle = 0;
+  while(pipeline_running){
+	csi_raw_frame* f = raw_q->read_slot();
+	if(!f){
+	  if(stage_idle(idle)) raw_q->wait(CSI_STAGE_PARK_NS);
+	  continue;
+	}
+	//wait for room downstream, the raw queue absorbs the backlog
+	csi_instance* out = decoded_q->write_slot();
+	if(!out){
+	  decoded_q->mark_overflow();
+	  while(!(out = decoded_q->write_slot()) && pipeline_running) stage_backoff(idle);
+	  if(!out) break;
+	}
+	idle = 0;
+	if(decode_csi(f->data, f->len, f->rx_ns, f->stamp, *out))
+	  decoded_q->push();
+	raw_q->pop();
+  }
+}
 
-	  //add new data to buffer
-	  memcpy(csi_buf + csi_pos, buffer, n);
-	  csi_pos += n;
-	  size_t hdr_pos = 0;
-	  //searches for start of the next packet from first 8 bytes (as we expect the beginning of the buffer to be the header of the packet currently being received)
-	  while((hdr_pos = find_csi_hdr(csi_buf)) != NO_HDR_IN_BUF){
-		memcpy(csi_data, csi_buf, hdr_pos);
-		//size of remaining data in buffer
-		csi_pos = csi_pos - hdr_pos;
-		//shift data back in buffer
-		memcpy(csi_buf, csi_buf + hdr_pos, csi_pos);
-		//now process csi data
-		parse_csi(csi_data+8+8, hdr_pos);
-		//clear empty space in the buffer
-		memset(csi_buf + csi_pos, 0, CSI_BUF_SIZE - csi_pos);
-	  }
-    }
+void csi_server::assemble_stage(){
+  size_t idle = 0;
+  while(pipeline_running){
+	csi_instance* c = decoded_q->read_slot();
+	if(!c){
+	  expire_groups();
+	  //sleep until the next frame, or until the oldest measurement has to be published without it
+	  if(stage_idle(idle)) decoded_q->wait(stage_park_ns(reassembly->deadline(), csi_mono_ns()));
+	  continue;
+	}
+	idle = 0;
+	assemble_csi(*c);
+	decoded_q->pop();
   }
 }
 
-void parse_csi(unsigned char* data, size_t nbytes){
-  //8 is sizeof the ethernet header
-  csi_udp_frame *rxframe = reinterpret_cast<csi_udp_frame*>(data);
-  if(use_software_mac_filter){
-	if(!mac_cmp(rxframe->src_mac, filter)) return;
+void csi_server::publish_stage(){
+  size_t idle = 0;
+  while(pipeline_running){
+	std::vector<csi_instance>* g = group_q->read_slot();
+	if(!g){
+	  if(stage_idle(idle)) group_q->wait(CSI_STAGE_PARK_NS);
+	  continue;
+	}
+	idle = 0;
+	publish_csi(*g);
+	//keep the vector's capacity for the next group that lands in this slot
+	g->clear();
+	group_q->pop();
   }
-  csi_instance out;
+}
 
-  out.rssi = rxframe->rssi;
-  //ROS_INFO("%.4hhx", rxframe->kk1);
-  memcpy(out.source_mac, rxframe->src_mac, 6);
-  out.seq = rxframe->seqCnt;
-  out.fc = (uint8_t)(rxframe->fc);
-
-  out.tx = (rxframe->csiconf >> 11) & 0x3;
-  out.rx = (rxframe->csiconf >> 8) & 0x3;
-  out.bw = (rxframe->chanspec>>11) & 0x07;
-  out.channel = (rxframe->chanspec) & 255;
-
-  switch(out.bw)
-    {
-    case 0x4:
-	  out.bw = 80;
-	  break;
-    case 0x3:
-	  out.bw = 40;
-	  break;
-    case 0x2:
-	  out.bw = 20;
-	  break;
-    default:
-	  ROS_ERROR("Invalid Bandwidth received %d", out.bw);
-	  return;
-    }
+void csi_server::report_pipeline(const ros::TimerEvent& e){
+  if(!pipeline_running) return;
+  ROS_DEBUG("pipeline depth/overflows: raw %lu/%lu, decoded %lu/%lu, groups %lu/%lu",
+			raw_q->depth(), raw_q->overflows(), decoded_q->depth(), decoded_q->overflows(),
+			group_q->depth(), group_q->overflows());
+  ROS_DEBUG("frame pool: %lu/%lu in use, high-water %lu, exhausted %lu",
+			frame_pool->in_use(), frame_pool->size(), frame_pool->high_water_mark(), frame_pool->exhaustions());
+  if(raw_q->overflows() != raw_overflow_reported){
+	ROS_WARN("Decoder fell behind, dropped %lu CSI frames (%lu total)",
+			 raw_q->overflows() - raw_overflow_reported, raw_q->overflows());
+	raw_overflow_reported = raw_q->overflows();
+  }
+}
 
-  uint32_t n_sub = (uint32_t)(((float)out.bw) *3.2);
-  size_t csi_nbytes = (size_t)(n_sub * sizeof(int32_t));
-
-  uint32_t *csi = reinterpret_cast<uint32_t*>(data+sizeof(csi_udp_frame));
-
-  out.n_sub = n_sub;
-  out.csi_r = new double[n_sub];
-  out.csi_i = new double[n_sub];
-
-  //decode CSI
-  uint64_t c_r, c_i;
-  uint64_t c_r_buf[n_sub], c_i_buf[n_sub];
-  for(int i = 0; i < n_sub; ++i){
-
-	uint32_t c = (uint64_t)csi[i];
-	c_r=0;
-	c_i=0;
-	uint32_t exp = ((int32_t)(c & e_mask) - 31 + 1023);
-	uint32_t r_exp = exp;
-	uint32_t i_exp = exp;
-
-	uint32_t r_mant = (c&r_mant_mask) >> 18;
-	uint32_t i_mant = (c&i_mant_mask) >> 6;
-
-	//construct real mantissa
-	uint32_t e_shift = 0;
-	while(!(r_mant & count_mask)){
-	  r_mant *= 2;
-	  e_shift += 1;
-	  if(e_shift == 10){
-		r_exp = 1023;
-		e_shift = 0;
-		r_mant = 0;
-		break;
-	  }
+//multi-router mode: every address in 'routers' gets its own reassembly state, owned by one worker
+bool csi_server::setup_routers(){
+  //nexmon broadcasts every router's CSI from the same address (10.10.10.10), so over udp there is no
+  //telling the routers apart. each tcp_forward connection comes from one router
+  if(!use_tcp){
+	ROS_FATAL("'routers' needs tcp_forward, the routers' udp broadcasts all have the same source address");
+	return false;
+  }
+  if(n_workers > (int)router_ips.size()) n_workers = router_ips.size();
+  for(size_t i = 0; i < router_ips.size(); ++i){
+	struct in_addr a;
+	if(inet_pton(AF_INET, router_ips[i].c_str(), &a) != 1){
+	  ROS_FATAL("Invalid router address %s, 'routers' entries need to be xxx.xxx.xxx.xxx", router_ips[i].c_str());
+	  return false;
+	}
+	csi_router* r = new csi_router();
+	r->ip = router_ips[i];
+	r->addr = a.s_addr;
+	r->worker = i % n_workers;
+	r->reassembly = new csi_reassembler(reassembly_groups, reassembly_timeout_ns);
+	routers.push_back(r);
+  }
+  //the first router is used to find the subnet, and beacons if beacon_rate is set
+  rx_ip = router_ips[0];
+  wake_fd = eventfd(0, EFD_NONBLOCK);
+  ROS_INFO("Receiving from %lu routers on %d worker threads", routers.size(), n_workers);
+  return true;
+}
+
+int csi_server::find_router(in_addr_t addr) const{
+  //a handful of routers, a scan beats hashing
+  for(size_t i = 0; i < routers.size(); ++i){
+	if(routers[i]->addr == addr) return i;
+  }
+  return -1;
+}
+
+void csi_server::run_routers(){
+  for(int w = 0; w < n_workers; ++w) worker_q.push_back(new spsc_queue<csi_raw_frame>(pipeline_depth));
+  worker_overflow_reported.assign(n_workers, 0);
+  pipeline_running = true;
+  for(int w = 0; w < n_workers; ++w) worker_threads.push_back(std::thread(&csi_server::router_worker, this, w));
+  pin_thread(pthread_self(), pipeline_cpus[0], "receive");
+  stats_timer = nh.createTimer(ros::Duration(stats_period), &csi_server::report_routers, this);
+
+  int epfd = epoll_create1(0);
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = sockfd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev);
+  ev.data.fd = wake_fd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+  struct epoll_event events[64];
+  while(running && ros::ok() && !ros::isShuttingDown()){
+	int ne = epoll_wait(epfd, events, 64, recv_timeout_ms);
+	if(ne < 0){
+	  if(errno == EINTR) continue;
+	  ROS_ERROR("epoll Error: %s", strerror(errno));
+	  break;
 	}
-	r_exp -= e_shift;
-
-	//construct imaginary mantissa
-	e_shift = 0;
-	while(!(i_mant & count_mask)){
-	  i_mant *= 2;
-	  e_shift += 1;
-	  if(e_shift == 10){
-		i_exp = 1023;
-		e_shift = 0;
-		i_mant = 0;
-		break;
+	for(int e = 0; e < ne; ++e){
+	  int fd = events[e].data.fd;
+	  //stop() was called, the loop condition catches it
+	  if(fd == wake_fd) continue;
+	  if(fd == sockfd){
+		accept_router(epfd);
+		continue;
+	  }
+	  for(size_t r = 0; r < routers.size(); ++r){
+		if(routers[r]->connfd == fd) read_router(epfd, r);
 	  }
 	}
-	i_exp -= e_shift;
+  }
 
-	//construct doubles
-	c_r |= (uint64_t)(c & r_sign_mask) << 34;
-	c_i |= (uint64_t)(c & i_sign_mask) << 46;
+  close(epfd);
+  pipeline_running = false;
+  for(size_t w = 0; w < worker_q.size(); ++w) worker_q[w]->wake();
+  for(size_t w = 0; w < worker_threads.size(); ++w) worker_threads[w].join();
+  worker_threads.clear();
+}
 
-	c_r |= ((uint64_t)(r_mant & mant_mask)) << 42;
-	c_i |= ((uint64_t)(i_mant & mant_mask)) << 42;
+void csi_server::dispatch_router(int r, const unsigned char* data, size_t nbytes, uint64_t rx_ns, const ros::Time &stamp){
+  csi_thread_stats &st = stats.local();
+  st.count(CSI_STAT_FRAMES_RECEIVED);
+  routers[r]->frames.fetch_add(1, std::memory_order_relaxed);
+  spsc_queue<csi_raw_frame>* q = worker_q[routers[r]->worker];
+  //never block the receive loop, drop the frame if the router's worker has fallen behind
+  csi_raw_frame* f = q->write_slot();
+  if(!f){
+	q->mark_overflow();
+	st.count(CSI_STAT_QUEUE_DROPPED);
+	return;
+  }
+  f->len = nbytes < CSI_BUF_SIZE ? nbytes : CSI_BUF_SIZE;
+  f->stamp = stamp;
+  f->rx_ns = rx_ns;
+  f->router = r;
+  memcpy(f->data, data, f->len);
+  q->push();
+}
+
+void csi_server::accept_router(int epfd){
+  struct sockaddr_in peer;
+  socklen_t len = sizeof(peer);
+  int fd;
+  while((fd = accept(sockfd, (SA*)&peer, &len)) >= 0){
+	len = sizeof(peer);
+	int r = find_router(peer.sin_addr.s_addr);
+	if(r < 0){
+	  ROS_WARN("Refused connection from %s, it is not in 'routers'", inet_ntoa(peer.sin_addr));
+	  close(fd);
+	  continue;
+	}
+	csi_router &rt = *routers[r];
+	//the router's tcpdump restarted, its new stream starts with a fresh pcap header
+	if(rt.connfd >= 0){
+	  epoll_ctl(epfd, EPOLL_CTL_DEL, rt.connfd, NULL);
+	  close(rt.connfd);
+	}
+	rt.connfd = fd;
+	rt.stream.reset();
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	ROS_INFO("Accepted Connection from %s", rt.ip.c_str());
+  }
+}
 
-	c_r |= ((uint64_t)r_exp)<<52;
-	c_i |= ((uint64_t)i_exp)<<52;
+void csi_server::read_router(int epfd, int r){
+  csi_router &rt = *routers[r];
+  ssize_t n = read(rt.connfd, rt.stream.write_ptr(TCP_READ_SIZE), TCP_READ_SIZE);
+  if(n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+  if(n > 0){
+	rt.stream.commit(n);
+	uint64_t rx_ns = csi_mono_ns();
+	uint64_t real_ns = csi_real_ns();
+	pcap_record rec;
+	while(rt.stream.next(rec)){
+	  const unsigned char* payload;
+	  size_t payload_len;
+	  if(!pcap_udp_payload(rt.stream.link_type(), rec.data, rec.caplen, &payload, &payload_len)) continue;
+	  ros::Time stamp(real_ns / 1000000000ull, real_ns % 1000000000ull);
+	  if(use_router_stamps) stamp = ros::Time(rec.ts_sec, rec.ts_nsec);
+	  dispatch_router(r, payload, payload_len, rx_ns, stamp);
+	}
+	if(!rt.stream.bad()) return;
+	ROS_ERROR("Invalid pcap data from %s, closing its connection", rt.ip.c_str());
+  }
+  else{
+	ROS_WARN("Lost connection from %s", rt.ip.c_str());
+  }
+  epoll_ctl(epfd, EPOLL_CTL_DEL, rt.connfd, NULL);
+  close(rt.connfd);
+  rt.connfd = -1;
+}
 
-	//place doubles
-	c_r_buf[i] = c_r;
-	c_i_buf[i] = c_i;
+void csi_server::router_worker(int w){
+  spsc_queue<csi_raw_frame>* q = worker_q[w];
+  size_t idle = 0;
+  while(pipeline_running){
+	csi_raw_frame* f = q->read_slot();
+	if(!f){
+	  //nothing arrived, publish whatever has timed out on this worker's routers
+	  uint64_t now = csi_mono_ns(), deadline = UINT64_MAX;
+	  for(size_t i = 0; i < routers.size(); ++i){
+		csi_router &r = *routers[i];
+		if(r.worker != w) continue;
+		r.reassembly->expire(now, [&](std::vector<csi_instance> &g, bool complete){
+		  count_group(g, complete);
+		  publish_router(r, g);
+		});
+		deadline = std::min(deadline, r.reassembly->deadline());
+	  }
+	  if(stage_idle(idle)) q->wait(stage_park_ns(deadline, now));
+	  continue;
+	}
+	idle = 0;
+	csi_router &r = *routers[f->router];
+	csi_instance out;
+	if(decode_csi(f->data, f->len, f->rx_ns, f->stamp, out)){
+	  r.reassembly->add(out, out.rx_ns, [&](std::vector<csi_instance> &g, bool complete){
+		count_group(g, complete);
+		publish_router(r, g);
+	  });
+	}
+	q->pop();
+  }
+}
+
+void csi_server::publish_router(csi_router &r, std::vector<csi_instance> &group){
+  uint64_t t0 = latency_stats ? csi_mono_ns() : 0;
+  if(recorder) record_group(group);
+  if(shm) share_group(group);
+  if(!record_only) send_group(group, r.ip, r.pub);
+  csi_thread_stats &st = stats.local();
+  st.count(CSI_STAT_MSGS_PUBLISHED);
+  if(latency_stats){
+	uint64_t now = csi_mono_ns();
+	st.latency[CSI_LAT_PUBLISH].record(now - t0);
+	st.latency[CSI_LAT_ARRIVAL].record(now > group[0].rx_ns ? now - group[0].rx_ns : 0);
+  }
+  r.msgs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void csi_server::report_routers(const ros::TimerEvent& e){
+  if(!pipeline_running) return;
+  for(size_t i = 0; i < routers.size(); ++i){
+	csi_router &r = *routers[i];
+	uint64_t frames = r.frames.load(std::memory_order_relaxed);
+	ROS_DEBUG("router %s: %lu frames, %lu messages", r.ip.c_str(), frames, r.msgs.load(std::memory_order_relaxed));
+	if(frames == r.frames_reported)
+	  ROS_WARN("No CSI from %s in the last %.0f s", r.ip.c_str(), stats_period);
+	r.frames_reported = frames;
+  }
+  for(size_t w = 0; w < worker_q.size(); ++w){
+	if(worker_q[w]->overflows() != worker_overflow_reported[w]){
+	  ROS_WARN("Worker %lu fell behind, dropped %lu CSI frames (%lu total)",
+			   w, worker_q[w]->overflows() - worker_overflow_reported[w], worker_q[w]->overflows());
+	  worker_overflow_reported[w] = worker_q[w]->overflows();
+	}
+  }
+  ROS_DEBUG("frame pool: %lu/%lu in use, high-water %lu, exhausted %lu",
+			frame_pool->in_use(), frame_pool->size(), frame_pool->high_water_mark(), frame_pool->exhaustions());
+}
+
+void csi_server::publish_diagnostics(const ros::TimerEvent& e){
+  ros::WallTime now = ros::WallTime::now();
+  double dt = now.toSec() - diag_prev_t.toSec();
+  diag_prev_t = now;
+  if(dt <= 0) dt = diag_period;
+
+  diagnostic_msgs::DiagnosticArrayPtr msg = boost::make_shared<diagnostic_msgs::DiagnosticArray>();
+  msg->header.stamp = ros::Time::now();
+  msg->status.resize(1);
+  diagnostic_msgs::DiagnosticStatus &st = msg->status[0];
+  st.name = nh.getNamespace() + ": CSI data path";
+  st.hardware_id = rx_ip;
+  char val[128];
+  auto kv = [&](const std::string &key, const char* value){
+	diagnostic_msgs::KeyValue k;
+	k.key = key;
+	k.value = value;
+	st.values.push_back(k);
+  };
+
+  //totals and rates over the last period
+  uint64_t c[CSI_STAT_N_COUNTERS], d[CSI_STAT_N_COUNTERS];
+  stats.counters(c);
+  for(int i = 0; i < CSI_STAT_N_COUNTERS; ++i){
+	d[i] = c[i] - diag_prev[i];
+	snprintf(val, sizeof(val), "%lu (%.1f/s)", c[i], d[i] / dt);
+	kv(csi_counter_name(i), val);
+	diag_prev[i] = c[i];
+  }
+  snprintf(val, sizeof(val), "%u", kernel_drops.load(std::memory_order_relaxed));
+  kv("kernel drops", val);
+  if(recorder){
+	snprintf(val, sizeof(val), "%lu measurements, %.1f MB in %u segments", recorder->records(), recorder->bytes() / 1e6, recorder->segments());
+	kv("recorded", val);
+  }
+  if(batcher){
+	snprintf(val, sizeof(val), "%lu measurements in %lu batches", batcher->entries(), batcher->batches_published());
+	kv("batched", val);
+  }
+  uint64_t shm_lost = 0;
+  if(shm){
+	std::vector<csi_shm_reader_info> readers = shm->readers();
+	uint64_t max_lag = 0, overruns = 0;
+	for(size_t i = 0; i < readers.size(); ++i){
+	  if(readers[i].lag > max_lag) max_lag = readers[i].lag;
+	  overruns += readers[i].overruns;
+	  shm_lost += readers[i].lost;
+	}
+	snprintf(val, sizeof(val), "%lu written, %lu too wide, %lu readers, max lag %lu, %lu overruns (%lu lost)",
+			 shm->written(), shm->skipped(), readers.size(), max_lag, overruns, shm_lost);
+	kv("shared memory", val);
+  }
+  snprintf(val, sizeof(val), "%lu/%lu", frame_pool ? frame_pool->in_use() : 0, frame_pool ? frame_pool->size() : 0);
+  kv("frame pool in use", val);
+
+  //percentiles over the last period, in microseconds
+  if(latency_stats){
+	for(int l = 0; l < CSI_LAT_N; ++l){
+	  csi_hist_snapshot h;
+	  stats.latency((csi_latency)l, h);
+	  csi_hist_snapshot d = h.since(diag_prev_lat[l]);
+	  diag_prev_lat[l] = h;
+	  snprintf(val, sizeof(val), "p50 %.1f, p90 %.1f, p99 %.1f, max %.1f (%lu samples)",
+			   d.quantile(0.5) * 1e-3, d.quantile(0.9) * 1e-3, d.quantile(0.99) * 1e-3, d.quantile(1.0) * 1e-3, d.total());
+	  kv(std::string(csi_latency_name(l)) + " latency (us)", val);
+	}
+  }
 
+  //frames lost inside the node, filtered frames are not a problem
+  uint64_t dropped = d[CSI_STAT_BAD_BW] + d[CSI_STAT_TRUNCATED] + d[CSI_STAT_POOL_EXHAUSTED] + d[CSI_STAT_QUEUE_DROPPED];
+  snprintf(val, sizeof(val), "%.0f frames/s, %.0f msgs/s", d[CSI_STAT_FRAMES_RECEIVED] / dt, d[CSI_STAT_MSGS_PUBLISHED] / dt);
+  st.message = val;
+  st.level = diagnostic_msgs::DiagnosticStatus::OK;
+  if(dropped){
+	st.level = diagnostic_msgs::DiagnosticStatus::WARN;
+	snprintf(val, sizeof(val), ", %lu frames dropped", dropped);
+	st.message += val;
+  }
+  //readers that leave take their counts with them, so only growth is reported
+  if(shm_lost > shm_lost_reported){
+	st.level = diagnostic_msgs::DiagnosticStatus::WARN;
+	snprintf(val, sizeof(val), ", shared memory readers lost %lu measurements", shm_lost - shm_lost_reported);
+	st.message += val;
   }
+  shm_lost_reported = shm_lost;
+  pub_diag.publish(msg);
+}
 
-  //copy to struct
-  memcpy(out.csi_r, c_r_buf, sizeof(double)*n_sub);
-  memcpy(out.csi_i, c_i_buf, sizeof(double)*n_sub);
+void csi_server::parse_csi(unsigned char* data, size_t nbytes, uint64_t rx_ns, const ros::Time &stamp){
+  csi_instance out;
+  if(decode_csi(data, nbytes, rx_ns, stamp, out))
+	assemble_csi(out);
+}
 
-  //scan for repeated tx-rx
-  bool new_csi = false;
-  for(auto ch_it = channel_current.begin(); ch_it != channel_current.end(); ++ch_it){
-	int out_comb = out.tx*4 + out.rx;
-	if(ch_it->tx*4 + ch_it->rx == out_comb){
-	  new_csi = true;
+bool csi_server::decode_csi(unsigned char* data, size_t nbytes, uint64_t rx_ns, const ros::Time &stamp, csi_instance &out){
+  csi_thread_stats &st = stats.local();
+  if(use_software_mac_filter){
+	if(nbytes < sizeof(csi_udp_frame)){
+	  st.count(CSI_STAT_TRUNCATED);
+	  return false;
 	}
+	csi_udp_frame *rxframe = reinterpret_cast<csi_udp_frame*>(data);
+	std::shared_ptr<const csi_mac_routing> m = std::atomic_load(&mac_routing);
+	int rule;
+	if(!m->table.accepts(rxframe->src_mac, rule)){
+	  st.count(CSI_STAT_MAC_FILTERED);
+	  return false;
+	}
+  }
+
+  uint64_t t0 = latency_stats ? csi_mono_ns() : 0;
+  csi_frame_status status = raw_csi ? parser->copy(data, nbytes, stamp, *frame_pool, out)
+	: parser->decode(data, nbytes, stamp, *frame_pool, out);
+  out.rx_ns = rx_ns;
+  if(latency_stats){
+	out.ready_ns = csi_mono_ns();
+	st.latency[CSI_LAT_SOCKET_TO_DECODE].record(t0 > rx_ns ? t0 - rx_ns : 0);
+	st.latency[CSI_LAT_DECODE].record(out.ready_ns - t0);
   }
-  if(out.seq != last_seq && channel_current.size() > 0){
-	new_csi = true;
+  switch(status){
+  case CSI_FRAME_OK:
+	return true;
+  case CSI_FRAME_BAD_BW:
+	st.count(CSI_STAT_BAD_BW);
+	ROS_ERROR_THROTTLE(1.0, "Invalid Bandwidth received %d", (reinterpret_cast<csi_udp_frame*>(data)->chanspec>>11) & 0x07);
+	return false;
+  case CSI_FRAME_TRUNCATED:
+	st.count(CSI_STAT_TRUNCATED);
+	ROS_ERROR_THROTTLE(1.0, "Truncated CSI frame, %lu bytes", nbytes);
+	return false;
+  case CSI_FRAME_NO_SLOT:
+	st.count(CSI_STAT_POOL_EXHAUSTED);
+	ROS_WARN_THROTTLE(1.0, "CSI frame pool exhausted, dropping frames (raise 'pool_size')");
+	return false;
   }
+  return false;
+}
 
-  if(new_csi){
+void csi_server::count_group(const std::vector<csi_instance> &group, bool complete){
+  csi_thread_stats &st = stats.local();
+  if(!complete) st.count(CSI_STAT_PARTIAL_FLUSHED);
+  if(latency_stats){
+	uint64_t now = csi_mono_ns();
+	st.latency[CSI_LAT_REASSEMBLY].record(now > group[0].ready_ns ? now - group[0].ready_ns : 0);
+  }
+}
+
+void csi_server::assemble_csi(csi_instance &out){
+  reassembly->add(out, out.rx_ns, [this](std::vector<csi_instance> &g, bool complete){
+	emit_group(g, complete);
+  });
+}
+
+void csi_server::expire_groups(){
+  reassembly->expire(csi_mono_ns(), [this](std::vector<csi_instance> &g, bool complete){
+	emit_group(g, complete);
+  });
+}
+
+uint64_t csi_server::recv_wait_ns() const{
+  uint64_t wait = (uint64_t)recv_timeout_ms * 1000000ull;
+  if(!groups_waiting()) return wait;
+  uint64_t now = csi_mono_ns(), due = reassembly->deadline();
+  return due > now ? std::min(wait, due - now) : 0;
+}
+
+bool csi_server::groups_waiting() const{
+  return !pipeline_running && reassembly->deadline() != UINT64_MAX;
+}
+
+void csi_server::wait_readable(int fd){
+  uint64_t wait = recv_wait_ns();
+  struct timespec ts;
+  ts.tv_sec = wait / 1000000000ull;
+  ts.tv_nsec = wait % 1000000000ull;
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  ppoll(&pfd, 1, &ts, NULL);
+}
+
+void csi_server::emit_group(std::vector<csi_instance> &channel_current, bool complete){
+  count_group(channel_current, complete);
+  if(!pipeline_running){
 	publish_csi(channel_current);
 	channel_current.clear();
+	return;
+  }
+  std::vector<csi_instance>* g = group_q->write_slot();
+  if(!g){
+	group_q->mark_overflow();
+	size_t idle = 0;
+	while(!(g = group_q->write_slot()) && pipeline_running) stage_backoff(idle);
+	if(!g) return;
+  }
+  //swap so both vectors keep their capacity, the slot's vector was cleared by the publisher
+  g->swap(channel_current);
+  channel_current.clear();
+  group_q->push();
+}
+
+void csi_server::publish_csi(std::vector<csi_instance> &channel_current){
+  uint64_t t0 = latency_stats ? csi_mono_ns() : 0;
+  if(recorder) record_group(channel_current);
+  if(shm) share_group(channel_current);
+  if(!record_only) send_group(channel_current, rx_ip, pub_csi);
+  csi_thread_stats &st = stats.local();
+  st.count(CSI_STAT_MSGS_PUBLISHED);
+  if(latency_stats){
+	uint64_t now = csi_mono_ns();
+	st.latency[CSI_LAT_PUBLISH].record(now - t0);
+	st.latency[CSI_LAT_ARRIVAL].record(now > channel_current[0].rx_ns ? now - channel_current[0].rx_ns : 0);
+  }
+}
+
+void csi_server::send_group(const std::vector<csi_instance> &group, const std::string &rx_id, const ros::Publisher &pub){
+  const csi_instance &c0 = group[0];
+  if(log_packets){
+	ROS_INFO_THROTTLE(log_period, "%s:RSSI%d/seq%d/fc%.2hhx/chan%d/rx%s",hr_mac(c0.source_mac).c_str(), c0.rssi, c0.seq, c0.fc, c0.channel, rx_id.c_str());
+  }
+  if(batcher){
+	batcher->add(route(c0.source_mac, pub), rx_id, group);
+	return;
+  }
+  //a fresh message per measurement, published by pointer so intra-process subscribers share it
+  if(raw_csi){
+	wiros_csi_node::CsiRawPtr msgout = boost::make_shared<wiros_csi_node::CsiRaw>();
+	csi_fill_raw(group, rx_id, *msgout);
+	route(c0.source_mac, pub).publish(msgout);
   }
+  else if(compact_csi){
+	wiros_csi_node::CsiCompactPtr msgout = boost::make_shared<wiros_csi_node::CsiCompact>();
+	csi_fill_compact(group, rx_id, *msgout);
+	route(c0.source_mac, pub).publish(msgout);
+  }
+  else{
+	rf_msgs::WifiPtr msgout = boost::make_shared<rf_msgs::Wifi>();
+	csi_fill_msg(group, rx_id, *msgout);
+	route(c0.source_mac, pub).publish(msgout);
+  }
+}
+
+ros::Publisher csi_server::advertise_csi(const std::string &topic){
+  if(batch_csi) return nh.advertise<wiros_csi_node::CsiBatch>(topic, 10);
+  if(raw_csi) return nh.advertise<wiros_csi_node::CsiRaw>(topic, 10);
+  if(compact_csi) return nh.advertise<wiros_csi_node::CsiCompact>(topic, 10);
+  return nh.advertise<rf_msgs::Wifi>(topic, 10);
+}
 
-  last_seq = out.seq;
-  //save the currently extracted CSI
-  channel_current.push_back(out);
-}
-
-void publish_csi(std::vector<csi_instance> &channel_current){
-  //4x4 matrices, with n_sub elements each, w/ interleaved 4 byte real + imag parts
-  csi_instance csi_0 = channel_current.at(0);
-  size_t rx_stride = csi_0.n_sub;
-  size_t rx2 = rx_stride / 2;
-  size_t tx_stride = rx_stride*4;
-  size_t num_floats = tx_stride*4;
-  rf_msgs::Wifi msgout;
-  if(num_floats > csi_size){
-	delete csi_r_out;
-	delete csi_i_out;
-	//statically allocate csi_out for now
-	csi_r_out = new double[num_floats];
-	csi_i_out = new double[num_floats];
-	csi_size = num_floats;
-  }
-  msgout.header.stamp = ros::Time::now();
-  msgout.ap_id = 0;
-  msgout.txmac = std::vector<unsigned char>(csi_0.source_mac, csi_0.source_mac + 6);
-  msgout.chan = csi_0.channel;
-  msgout.n_sub = csi_0.n_sub;
-  msgout.seq_num = csi_0.seq;
-  msgout.fc = csi_0.fc;
-  msgout.n_rows = 4;
-  msgout.n_cols = 4;
-  msgout.bw = csi_0.bw;
-  msgout.mcs = 0;
-  msgout.rssi = (int32_t)(csi_0.rssi);
-  ROS_INFO("%s:RSSI%d/seq%d/fc%.2hhx/chan%d/rx%s",hr_mac(csi_0.source_mac).c_str(), msgout.rssi, msgout.seq_num, csi_0.fc, msgout.chan, rx_ip.c_str());
-  memset(csi_r_out,0,num_floats*sizeof(double));
-  memset(csi_i_out,0,num_floats*sizeof(double));
-  msgout.rx_id = rx_ip;
-  msgout.msg_id = 0;
-  for(auto c = channel_current.begin(); c != channel_current.end(); ++c){
-	size_t csi_idx = rx_stride*c->rx + tx_stride*c->tx;
-	//fft-shift the data
-	for(int bin = 0; bin < rx2; ++bin){
-	  csi_r_out[csi_idx + bin + rx2] = (c->csi_r[bin]);
-	  csi_i_out[csi_idx + bin + rx2] = (c->csi_i[bin]);
-	  csi_r_out[csi_idx + bin] = (c->csi_r[bin + rx2]);
-	  csi_i_out[csi_idx + bin] = (c->csi_i[bin + rx2]);
-	}
-  }
-  msgout.csi_real = std::vector<double>(csi_r_out, csi_r_out + num_floats);
-  msgout.csi_imag = std::vector<double>(csi_i_out, csi_i_out + num_floats);
-  pub_csi.publish(msgout);
-}
-
-void handle_shutdown(int sig){
-  ROS_WARN("Shutting down.");
+void csi_server::record_group(const std::vector<csi_instance> &group){
+  //same stamp the message gets
+  ros::Time stamp = group[0].stamp.isZero() ? ros::Time::now() : group[0].stamp;
+  if(!recorder->write(group, stamp.toNSec()))
+	ROS_ERROR_THROTTLE(5.0, "Could not record CSI: %s", recorder->error().c_str());
+}
+
+void csi_server::share_group(const std::vector<csi_instance> &group){
+  ros::Time stamp = group[0].stamp.isZero() ? ros::Time::now() : group[0].stamp;
+  if(!shm->write(group, stamp.toNSec()))
+	ROS_WARN_THROTTLE(5.0, "Measurement with %lu subcarriers is too wide for the shared memory ring (raise 'shm_max_nsub')", group[0].n_sub);
+}
+
+void csi_server::shutdown_router(){
   if(cli_fp){
 	ROS_WARN("Closing tcpdump process");
 	pclose(cli_fp);
+	cli_fp = NULL;
+  }
+  for(size_t i = 0; i < routers.size(); ++i){
+	if(routers[i]->cli_fp){
+	  ROS_WARN("Closing tcpdump process on %s", routers[i]->ip.c_str());
+	  pclose(routers[i]->cli_fp);
+	  routers[i]->cli_fp = NULL;
+	}
   }
   if(tx_fp){
 	ROS_WARN("Closing tx process");
@@ -534,16 +1150,13 @@ void handle_shutdown(int sig){
 	
 	sprintf(killcmd, "sshpass -p %s ssh -o strictHostKeyChecking=no %s@%s killall send.sh", rx_pass.c_str(), rx_host.c_str(), rx_ip.c_str());
 	sh_exec(std::string(killcmd));
+	tx_fp = NULL;
   }
-  ROS_WARN("Calling ros::shutdown()");
-  ros::shutdown();
-  ROS_WARN("Done.");
-
 }
 
 //returns true on error
-bool set_chanspec(int s_chan, int s_bw){
-  if(!(s_bw == -1 || s_bw ==20 || s_bw == 40 || s_bw == 80))
+bool csi_server::set_chanspec(int s_chan, int s_bw){
+  if(!(s_bw == -1 || s_bw ==20 || s_bw == 40 || s_bw == 80 || s_bw == 160))
 	return true;
   if(s_chan != -1 && s_chan != ch){
 	ch = s_chan;
@@ -556,19 +1169,87 @@ bool set_chanspec(int s_chan, int s_bw){
   return false;
 }
 
-bool set_mac_filter(mac_filter filt){
-  if(filt.len < 0 || filt.len > 6){
+bool csi_server::set_mac_filter(mac_filter filt){
+  if(filt.len > 6){
 	return true;
   }
-  filter = filt;
-  ROS_WARN("Set MAC FILTER to %s",hr_mac_filt(filter).c_str());
-  if(filt.len == 2){
-	use_software_mac_filter = false;
-  }
+  csi_mac_rule r;
+  r.prefix = filt;
+  csi_mac_table t;
+  t.add(r);
+  set_mac_table(t);
   return false;
 }
 
-std::string reconfigure(){
+void csi_server::set_mac_table(const csi_mac_table &table){
+  std::shared_ptr<csi_mac_routing> m = std::make_shared<csi_mac_routing>();
+  m->table = table;
+  m->pubs.resize(table.size());
+  bool routes = false;
+  for(size_t i = 0; i < table.size(); ++i){
+	if(table.rule(i).topic.empty()) continue;
+	m->pubs[i] = advertise_csi(table.rule(i).topic);
+	ROS_INFO("Publishing %s on %s", hr_mac_filt(table.rule(i).prefix).c_str(), m->pubs[i].getTopic().c_str());
+	routes = true;
+  }
+  std::atomic_store(&mac_routing, std::shared_ptr<const csi_mac_routing>(m));
+  mac_routes = routes;
+  ROS_WARN("Set MAC FILTER to %s",hr_mac_table(table).c_str());
+  apply_mac_filter();
+}
+
+void csi_server::apply_mac_filter(){
+  std::shared_ptr<const csi_mac_routing> m = std::atomic_load(&mac_routing);
+  const csi_mac_table &t = m->table;
+  bool accept_all = t.accepts_all();
+  //re-attaching swaps the program in one step, the socket is never left unfiltered
+  if(ring){
+	//the ring needs the port filter regardless, the table is added to it with kernel_mac_filter
+	if(csi_bpf_attach_packet(ring->fd, kernel_mac_filter ? t : csi_mac_table(), PORT)){
+	  kernel_filter_attached = kernel_mac_filter && !accept_all;
+	}
+	else{
+	  kernel_filter_attached = false;
+	  ROS_WARN("Could not attach the filter to the packet ring, filtering on the node instead: %s", strerror(errno));
+	}
+  }
+  else if(kernel_mac_filter && !use_tcp && sockfd >= 0){
+	if(csi_bpf_attach(sockfd, t)){
+	  kernel_filter_attached = !accept_all;
+	}
+	else{
+	  kernel_filter_attached = false;
+	  ROS_WARN("Could not attach the MAC filter to the socket, filtering on the node instead: %s", strerror(errno));
+	}
+  }
+  //the asus filters a lone two byte prefix itself
+  bool router_only = t.size() == 1 && router_filter().len == 2 && t.rule(0).prefix.len == 2;
+  use_software_mac_filter = !accept_all && !kernel_filter_attached && !router_only;
+}
+
+mac_filter csi_server::router_filter(){
+  std::shared_ptr<const csi_mac_routing> m = std::atomic_load(&mac_routing);
+  const csi_mac_table &t = m->table;
+  //the asus can only keep frames that start with one two byte prefix, which every entry has to share
+  if(t.size() == 0) return mac_filter();
+  for(size_t i = 0; i < t.size(); ++i){
+	const csi_mac_rule &r = t.rule(i);
+	if(r.deny || r.prefix.len < 2) return mac_filter();
+	if(r.prefix.mac[0] != t.rule(0).prefix.mac[0] || r.prefix.mac[1] != t.rule(0).prefix.mac[1]) return mac_filter();
+  }
+  uint8_t mac[6] = {t.rule(0).prefix.mac[0], t.rule(0).prefix.mac[1], 0, 0, 0, 0};
+  return mac_filter(2, mac);
+}
+
+ros::Publisher csi_server::route(const unsigned char* mac, const ros::Publisher &def){
+  if(!mac_routes.load(std::memory_order_relaxed)) return def;
+  std::shared_ptr<const csi_mac_routing> m = std::atomic_load(&mac_routing);
+  int rule = m->table.match(mac);
+  if(rule >= 0 && m->pubs[rule]) return m->pubs[rule];
+  return def;
+}
+
+std::string csi_server::reconfigure(){
 
     //reset iface
   if(ch >= 32){
@@ -580,29 +1261,118 @@ std::string reconfigure(){
 	  tx_nss = tx_nss > 3 ? 3 : tx_nss;
   }
 
-    
+
+  //the transmitters may send other chains after this, learn them again
+  if(reassembly) reassembly->forget();
+  for(size_t i = 0; i < routers.size(); ++i){
+	if(routers[i]->reassembly) routers[i]->reassembly->forget();
+  }
+
+  if(router_ips.empty()) return configure_router(rx_ip);
+  //every router listens on the same chanspec and filter
+  std::string out;
+  for(size_t i = 0; i < router_ips.size(); ++i){
+	out += router_ips[i] + ":\n" + configure_router(router_ips[i]);
+  }
+  return out;
+}
+
+std::string csi_server::configure_router(const std::string &ip){
   char configcmd[512];
+  mac_filter filter = router_filter();
   if(filter.len > 1){
 	sprintf(configcmd, "sshpass -p %s ssh -o strictHostKeyChecking=no %s@%s /jffs/csi/setup.sh %d %d 4 %.2hhx:%.2hhx:00:00:00:00 2>&1",
-            rx_pass.c_str(), rx_host.c_str(), rx_ip.c_str(), ch, bw, filter.mac[0],filter.mac[1]);
+            rx_pass.c_str(), rx_host.c_str(), ip.c_str(), ch, bw, filter.mac[0],filter.mac[1]);
   }
   else{
-	sprintf(configcmd, "sshpass -p %s ssh -o strictHostKeyChecking=no %s@%s /jffs/csi/setup.sh %d %d 4 2>&1", rx_pass.c_str(), rx_host.c_str(), rx_ip.c_str(), ch, bw);
+	sprintf(configcmd, "sshpass -p %s ssh -o strictHostKeyChecking=no %s@%s /jffs/csi/setup.sh %d %d 4 2>&1", rx_pass.c_str(), rx_host.c_str(), ip.c_str(), ch, bw);
   }
   ROS_INFO("%s",configcmd);
   return sh_exec_block(configcmd);
 }
 
-void setup_tcpdump(std::string hostIP){
+FILE* csi_server::setup_tcpdump(const std::string &ip, std::string hostIP){
   char setupcmd[512];
-  sprintf(setupcmd, "sshpass -p %s ssh -o strictHostKeyChecking=no %s@%s /jffs/csi/tcpdump -i %s port 5500 -nn -s 0 -w - --immediate-mode | nc %s %d > /dev/null 2>&1", rx_pass.c_str(), rx_host.c_str(), rx_ip.c_str(), iface.c_str(), hostIP.c_str(), PORT_TCP);
+  sprintf(setupcmd, "sshpass -p %s ssh -o strictHostKeyChecking=no %s@%s /jffs/csi/tcpdump -i %s port 5500 -nn -s 0 -w - --immediate-mode | nc %s %d > /dev/null 2>&1", rx_pass.c_str(), rx_host.c_str(), ip.c_str(), iface.c_str(), hostIP.c_str(), PORT_TCP);
   ROS_INFO("%s",setupcmd);
-  cli_fp = popen(setupcmd, "r");
+  return popen(setupcmd, "r");
 }
 
 
 
-void setup_params(ros::NodeHandle& nh){
+void csi_server::setup_udp_socket(int sockfd){
+  struct timeval tv;
+  tv.tv_sec = recv_timeout_ms / 1000;
+  tv.tv_usec = (recv_timeout_ms % 1000) * 1000;
+  if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO,&tv,sizeof(tv)) < 0) {
+	perror("Error");
+  }
+
+  //bursts of 16 frames per measurement overflow the default receive queue at high beacon rates
+  if(rcvbuf_size > 0){
+	if(setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf_size, sizeof(int)) < 0){
+	  ROS_WARN("Could not set SO_RCVBUF: %s", strerror(errno));
+	}
+	int actual = 0;
+	socklen_t optlen = sizeof(int);
+	getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &actual, &optlen);
+	//the kernel doubles the requested size; anything less means we hit net.core.rmem_max
+	if(actual < rcvbuf_size * 2){
+	  //try to exceed rmem_max, which only works with CAP_NET_ADMIN
+	  if(setsockopt(sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf_size, sizeof(int)) == 0){
+		getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &actual, &optlen);
+	  }
+	  else{
+		ROS_WARN("Receive buffer capped at %d bytes, raise net.core.rmem_max to allow %d", actual, rcvbuf_size);
+	  }
+	}
+	ROS_INFO("Socket receive buffer: %d bytes", actual);
+  }
+
+  if(busy_poll_us > 0){
+	if(setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(int)) < 0){
+	  ROS_WARN("Could not set SO_BUSY_POLL: %s", strerror(errno));
+	}
+  }
+
+  //have the kernel report its drop counter and receive time with every datagram
+  int yes = 1;
+  if(setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &yes, sizeof(int)) < 0){
+	ROS_WARN("Could not enable SO_RXQ_OVFL, kernel drops will not be reported: %s", strerror(errno));
+  }
+  if(setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &yes, sizeof(int)) < 0){
+	ROS_WARN("Could not enable SO_TIMESTAMPNS, CSI will be stamped when the node reads it: %s", strerror(errno));
+  }
+}
+
+void csi_server::read_ancillary(struct msghdr* hdr, uint64_t mono_ns, uint64_t real_ns, uint64_t &rx_ns, ros::Time &stamp){
+  uint64_t arrival = real_ns;
+  rx_ns = mono_ns;
+  for(struct cmsghdr* cm = CMSG_FIRSTHDR(hdr); cm != NULL; cm = CMSG_NXTHDR(hdr, cm)){
+	if(cm->cmsg_level != SOL_SOCKET) continue;
+	if(cm->cmsg_type == SO_RXQ_OVFL){
+	  //cumulative count since the socket was opened
+	  uint32_t drops;
+	  memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+	  kernel_drops.store(drops, std::memory_order_relaxed);
+	}
+	else if(cm->cmsg_type == SCM_TIMESTAMPNS){
+	  struct timespec ts;
+	  memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+	  arrival = (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+	}
+  }
+  stamp_arrival(arrival, mono_ns, real_ns, rx_ns, stamp);
+}
+
+void csi_server::stamp_arrival(uint64_t kernel_ns, uint64_t mono_ns, uint64_t real_ns, uint64_t &rx_ns, ros::Time &stamp){
+  //time spent in the receive queue, carried over to the monotonic clock for the latency stats
+  if(kernel_ns > real_ns) kernel_ns = real_ns;
+  rx_ns = mono_ns - (real_ns - kernel_ns);
+  stamp = ros::Time(kernel_ns / 1000000000ull, kernel_ns % 1000000000ull);
+}
+
+void csi_server::setup_params(){
   double tmp_ch, tmp_bw;
   std::string tmp_host;
   
@@ -613,40 +1383,148 @@ void setup_params(ros::NodeHandle& nh){
   nh.param<double>("beacon_rate", beacon, 200.0);
   nh.param<int>("beacon_tx_nss", tx_nss, 4);
   nh.param<bool>("tcp_forward", use_tcp, false);
+  nh.param<bool>("router_stamps", use_router_stamps, true);
   nh.param<std::string>("asus_ip", rx_ip, "");
   nh.param<std::string>("asus_pwd", rx_pass, "password");
   nh.param<std::string>("asus_host", rx_host, "HOST");
   nh.param<bool>("no_config", no_config, false);
   nh.param<std::string>("lock_topic", lock_topic, "");
+
+  //udp receive tuning
+  nh.param<int>("recv_batch", recv_batch, 32);
+  nh.param<int>("rcvbuf_size", rcvbuf_size, 4*1024*1024);
+  nh.param<int>("busy_poll_us", busy_poll_us, 0);
+  nh.param<int>("recv_timeout_ms", recv_timeout_ms, 1010);
+  if(recv_batch < 1) recv_batch = 1;
+  if(recv_batch > RECV_BATCH_MAX) recv_batch = RECV_BATCH_MAX;
+
+  //packet ring capture
+  int ring_block_kb, ring_blocks, ring_block_timeout_ms;
+  nh.param<std::string>("ring_iface", ring_iface, "");
+  nh.param<int>("ring_block_kb", ring_block_kb, 1024);
+  nh.param<int>("ring_blocks", ring_blocks, 64);
+  nh.param<int>("ring_block_timeout_ms", ring_block_timeout_ms, 8);
+  ring_config.iface = ring_iface;
+  ring_config.block_size = (size_t)(ring_block_kb > 4 ? ring_block_kb : 4) * 1024;
+  ring_config.blocks = ring_blocks > 1 ? ring_blocks : 2;
+  ring_config.block_timeout_ms = ring_block_timeout_ms > 1 ? ring_block_timeout_ms : 1;
+
+  //recording
+  int record_segment_mb, record_index_interval;
+  nh.param<std::string>("record_prefix", record_config.prefix, "");
+  nh.param<int>("record_segment_mb", record_segment_mb, 256);
+  nh.param<int>("record_index_interval", record_index_interval, 256);
+  nh.param<double>("record_sync_period", record_config.sync_period, 1.0);
+  nh.param<bool>("record_only", record_only, false);
+  record_config.segment_bytes = (size_t)(record_segment_mb > 1 ? record_segment_mb : 1) << 20;
+  record_config.index_interval = record_index_interval > 1 ? record_index_interval : 1;
+  if(record_config.prefix.empty()) record_only = false;
+
+  nh.param<bool>("compact_csi", compact_csi, false);
+  //shared memory ring
+  int shm_slots, shm_max_chains, shm_max_nsub;
+  nh.param<std::string>("shm_name", shm_config.name, "");
+  nh.param<int>("shm_slots", shm_slots, 1024);
+  nh.param<int>("shm_max_chains", shm_max_chains, 16);
+  nh.param<int>("shm_max_nsub", shm_max_nsub, 256);
+  shm_config.n_slots = shm_slots > 2 ? shm_slots : 2;
+  shm_config.max_chains = shm_max_chains < 1 ? 1 : (shm_max_chains > 16 ? 16 : shm_max_chains);
+  shm_config.max_nsub = shm_max_nsub < 64 ? 64 : (shm_max_nsub > CSI_MAX_NSUB ? CSI_MAX_NSUB : shm_max_nsub);
+
+  //batching
+  int batch_size;
+  nh.param<bool>("batch_csi", batch_csi, false);
+  nh.param<int>("batch_size", batch_size, 64);
+  nh.param<double>("batch_window", batch_config.window, 0.05);
+  batch_config.max_count = batch_size > 1 ? batch_size : 1;
+
+  nh.param<bool>("raw_csi", raw_csi, false);
+  if(raw_csi && (!record_config.prefix.empty() || !shm_config.name.empty() || batch_csi)){
+	ROS_WARN("raw_csi is ignored while recording, writing to shared memory or batching, which all hold decoded CSI");
+	raw_csi = false;
+  }
+
+  //threaded data path
+  nh.param<bool>("pipeline", use_pipeline, true);
+  nh.param<int>("pipeline_depth", pipeline_depth, 1024);
+  nh.param<double>("stats_period", stats_period, 10.0);
+  std::vector<int> no_pin = {-1, -1, -1, -1};
+  nh.param<std::vector<int> >("pipeline_cpus", pipeline_cpus, no_pin);
+  pipeline_cpus.resize(4, -1);
+  if(pipeline_depth < 16) pipeline_depth = 16;
+  nh.param<bool>("log_packets", log_packets, false);
+  nh.param<double>("diag_period", diag_period, 1.0);
+  nh.param<bool>("latency_stats", latency_stats, true);
+  double log_rate;
+  nh.param<double>("log_rate", log_rate, 1.0);
+  log_period = log_rate > 0 ? 1.0 / log_rate : 0.0;
+  nh.param<int>("pool_size", pool_size, 2048);
+  double reassembly_timeout_ms;
+  nh.param<int>("reassembly_groups", reassembly_groups, 64);
+  nh.param<double>("reassembly_timeout_ms", reassembly_timeout_ms, 10.0);
+  reassembly_timeout_ns = (uint64_t)(reassembly_timeout_ms * 1e6);
+  if(pool_size < 64) pool_size = 64;
+
+  //decoder
+  nh.param<bool>("simd_decode", use_simd_decode, true);
+  parser = new csi_parser(use_simd_decode);
+  if(raw_csi) ROS_INFO("Publishing CSI undecoded, as CsiRaw");
+  else ROS_INFO("Using %s CSI decoder", parser->decoder_name());
+
+  //multi-router mode
+  nh.param<std::vector<std::string> >("routers", router_ips, std::vector<std::string>());
+  nh.param<int>("workers", n_workers, 2);
+  nh.param<bool>("router_topics", router_topics, false);
+  if(n_workers < 1) n_workers = 1;
   
 
-  //MAC filter param
+  //MAC filter params
   std::string mac_filter_temp;
+  std::vector<std::string> mac_filters_temp;
   nh.param<std::string>("mac_filter", mac_filter_temp, std::string(""));
-  set_mac_filter(mac_filter_str(mac_filter_temp));
+  nh.param<std::vector<std::string> >("mac_filters", mac_filters_temp, std::vector<std::string>());
+  nh.param<bool>("kernel_mac_filter", kernel_mac_filter, true);
+  if(mac_filter_temp != "") mac_filters_temp.insert(mac_filters_temp.begin(), mac_filter_temp);
+  csi_mac_table table;
+  std::string bad;
+  if(!csi_mac_table_parse(mac_filters_temp, table, bad)){
+	ROS_FATAL("Invalid MAC filter entry: %s, should be [!]xx:xx:xx:xx:xx:xx[=topic] with 1-byte hex digits and *", bad.c_str());
+	exit(EXIT_FAILURE);
+  }
+  set_mac_table(table);
 }
 
 
 //handle change of channel, returns false on error.
-bool config_csi_callback(wiros_csi_node::ConfigureCSI::Request &req, wiros_csi_node::ConfigureCSI::Response &resp){
-  if(req.chan == ch && req.bw == bw){
-	resp.result = "No Change Applied.";
-	return true;
+bool csi_server::config_csi_callback(wiros_csi_node::ConfigureCSI::Request &req, wiros_csi_node::ConfigureCSI::Response &resp){
+  std::vector<std::string> entries(req.mac_filters);
+  if(req.mac_filter != "") entries.insert(entries.begin(), req.mac_filter);
+  bool new_table = req.clear_filters || !entries.empty();
+  csi_mac_table table;
+  std::string bad;
+  if(!csi_mac_table_parse(entries, table, bad)){
+	resp.result = "Error: Invalid MAC Filter " + bad;
+	return false;
   }
+  bool chanspec_changed = (req.chan != -1 && req.chan != ch) || (req.bw != -1 && req.bw != bw);
   if(set_chanspec(req.chan, req.bw)){
 	resp.result = "Error: Invalid Channel Or Bandwidth";
 	return false;
   }
-  if(req.mac_filter != "" && set_mac_filter(mac_filter_str(req.mac_filter))){
-	resp.result = "Error: Invalid MAC Filter";
-	return false;
+  mac_filter router_before = router_filter();
+  if(new_table) set_mac_table(table);
+  mac_filter router_after = router_filter();
+  //the routers only need reconfiguring if the chanspec or their own two byte filter changed
+  if(!chanspec_changed && router_before.len == router_after.len && mac_cmp(router_before.mac, router_after)){
+	resp.result = new_table ? "MAC Filter Applied, Router Unchanged." : "No Change Applied.";
+	return true;
   }
   resp.result = reconfigure();
   resp.result.erase(std::remove_if(resp.result.begin(),resp.result.end(), sanitize_string), resp.result.end());
   return true;
 }
 
-void ap_info_callback(const rf_msgs::AccessPoints::ConstPtr& msg){
+void csi_server::ap_info_callback(const rf_msgs::AccessPoints::ConstPtr& msg){
   uint8_t a_mac[6];
   if(msg->aps.size() < 1) return;
   
@@ -0,0 +1,236 @@
+//unit tests for csi_reassembler: grouping, learning each transmitter's chains, relearning and forgetting them
+
+#include <gtest/gtest.h>
+#include <vector>
+#include "csi_reassembly.h"
+
+//10 ms, the node's default
+#define TIMEOUT_NS 10000000ull
+
+//what emit was handed for one group
+struct emitted_group
+{
+  uint8_t last_mac_byte;
+  uint16_t seq;
+  size_t n_frames;
+  bool complete;
+};
+
+class reassembly_test : public ::testing::Test
+{
+protected:
+  reassembly_test() : reassembly(64, TIMEOUT_NS), now(1000){}
+
+  void add(uint8_t mac, uint16_t seq, uint8_t tx, uint8_t rx){
+    csi_instance f;
+    uint8_t m[6] = {0x02, 0, 0, 0, 0, mac};
+    memcpy(f.source_mac, m, 6);
+    f.seq = seq;
+    f.tx = tx;
+    f.rx = rx;
+    now += 1000;
+    reassembly.add(f, now, [this](std::vector<csi_instance> &g, bool complete){ record(g, complete); });
+  }
+
+  //adds one chain per entry of chains, tx in the upper and rx in the lower two bits
+  void add_measurement(uint8_t mac, uint16_t seq, const std::vector<uint8_t> &chains){
+    for(size_t i = 0; i < chains.size(); ++i) add(mac, seq, chains[i] >> 2, chains[i] & 3);
+  }
+
+  //lets every in-flight group time out
+  void timeout(){
+    now += 2*TIMEOUT_NS;
+    reassembly.expire(now, [this](std::vector<csi_instance> &g, bool complete){ record(g, complete); });
+  }
+
+  void record(std::vector<csi_instance> &g, bool complete){
+    emitted_group e;
+    e.last_mac_byte = g[0].source_mac[5];
+    e.seq = g[0].seq;
+    e.n_frames = g.size();
+    e.complete = complete;
+    for(size_t i = 1; i < g.size(); ++i){
+      EXPECT_EQ(g[0].source_mac[5], g[i].source_mac[5]);
+      EXPECT_EQ(g[0].seq, g[i].seq);
+    }
+    out.push_back(e);
+  }
+
+  csi_reassembler reassembly;
+  uint64_t now;
+  std::vector<emitted_group> out;
+};
+
+static const std::vector<uint8_t> four_chains = {0, 1, 4, 5};
+static const std::vector<uint8_t> two_chains = {0, 1};
+
+TEST_F(reassembly_test, first_measurement_waits_for_the_timeout){
+  add_measurement(1, 10, four_chains);
+  EXPECT_TRUE(out.empty());
+  EXPECT_EQ(now - 3000 + TIMEOUT_NS, reassembly.deadline());
+  timeout();
+  ASSERT_EQ(1u, out.size());
+  EXPECT_EQ(4u, out[0].n_frames);
+  EXPECT_TRUE(out[0].complete);
+  EXPECT_EQ(UINT64_MAX, reassembly.deadline());
+}
+
+TEST_F(reassembly_test, learned_measurements_are_emitted_on_their_last_chain){
+  add_measurement(1, 10, four_chains);
+  timeout();
+  out.clear();
+  add_measurement(1, 11, four_chains);
+  ASSERT_EQ(1u, out.size());
+  EXPECT_EQ(11, out[0].seq);
+  EXPECT_EQ(4u, out[0].n_frames);
+  EXPECT_TRUE(out[0].complete);
+  EXPECT_EQ(0u, reassembly.in_flight());
+}
+
+TEST_F(reassembly_test, interleaved_transmitters_are_kept_apart){
+  add_measurement(1, 10, four_chains);
+  add_measurement(2, 10, two_chains);
+  timeout();
+  out.clear();
+  //the same sequence number from both, chains alternating
+  add(1, 20, 0, 0);
+  add(2, 20, 0, 0);
+  add(1, 20, 0, 1);
+  add(2, 20, 0, 1);
+  ASSERT_EQ(1u, out.size());
+  EXPECT_EQ(2, out[0].last_mac_byte);
+  EXPECT_TRUE(out[0].complete);
+  add(1, 20, 1, 0);
+  add(1, 20, 1, 1);
+  ASSERT_EQ(2u, out.size());
+  EXPECT_EQ(1, out[1].last_mac_byte);
+  EXPECT_EQ(4u, out[1].n_frames);
+  EXPECT_TRUE(out[1].complete);
+}
+
+TEST_F(reassembly_test, repeated_chain_starts_the_next_measurement){
+  add(1, 10, 0, 0);
+  add(1, 10, 0, 1);
+  add(1, 10, 0, 0);
+  ASSERT_EQ(1u, out.size());
+  EXPECT_EQ(2u, out[0].n_frames);
+  timeout();
+  ASSERT_EQ(2u, out.size());
+  EXPECT_EQ(1u, out[1].n_frames);
+}
+
+TEST_F(reassembly_test, partial_measurements_time_out_incomplete){
+  add_measurement(1, 10, four_chains);
+  timeout();
+  add_measurement(1, 11, two_chains);
+  EXPECT_EQ(1u, out.size());
+  EXPECT_EQ(now - 1000 + TIMEOUT_NS, reassembly.deadline());
+  timeout();
+  ASSERT_EQ(2u, out.size());
+  EXPECT_FALSE(out[1].complete);
+  EXPECT_EQ(1u, reassembly.incomplete());
+}
+
+TEST_F(reassembly_test, chains_are_relearned_after_partial_measurements){
+  add_measurement(1, 10, four_chains);
+  timeout();
+  //the transmitter now sends two chains. each of these waits for the timeout
+  for(uint16_t seq = 0; seq < CSI_REASM_RELEARN; ++seq){
+    add_measurement(1, 100 + seq, two_chains);
+    timeout();
+  }
+  ASSERT_EQ(1u + CSI_REASM_RELEARN, out.size());
+  for(size_t i = 1; i < out.size(); ++i) EXPECT_FALSE(out[i].complete);
+  out.clear();
+  //and from here on is complete without waiting
+  add_measurement(1, 200, two_chains);
+  ASSERT_EQ(1u, out.size());
+  EXPECT_TRUE(out[0].complete);
+}
+
+TEST_F(reassembly_test, a_complete_measurement_restarts_relearning){
+  add_measurement(1, 10, two_chains);
+  timeout();
+  add_measurement(1, 11, four_chains);
+  timeout();
+  //one partial measurement short of relearning
+  for(uint16_t seq = 0; seq + 1 < CSI_REASM_RELEARN; ++seq){
+    add_measurement(1, 100 + seq, two_chains);
+    timeout();
+  }
+  add_measurement(1, 150, four_chains);
+  timeout();
+  //would be the last partial measurement if the complete one had not started the count again
+  add_measurement(1, 160, two_chains);
+  timeout();
+  out.clear();
+  add_measurement(1, 200, two_chains);
+  EXPECT_TRUE(out.empty());
+}
+
+TEST_F(reassembly_test, forget_drops_learned_chains){
+  add_measurement(1, 10, four_chains);
+  timeout();
+  out.clear();
+  reassembly.forget();
+  add_measurement(1, 11, two_chains);
+  EXPECT_TRUE(out.empty());
+  timeout();
+  ASSERT_EQ(1u, out.size());
+  EXPECT_TRUE(out[0].complete);
+  //two chains is what it sends now
+  add_measurement(1, 12, two_chains);
+  ASSERT_EQ(2u, out.size());
+  EXPECT_TRUE(out[1].complete);
+}
+
+TEST_F(reassembly_test, least_recently_seen_transmitters_are_evicted){
+  add_measurement(1, 10, four_chains);
+  timeout();
+  //far more transmitters than fit, each seen after the first one
+  for(uint32_t i = 0; i < 4*CSI_REASM_TX_SLOTS; ++i){
+    csi_instance f;
+    uint8_t m[6] = {0x04, 0, 0, (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i};
+    memcpy(f.source_mac, m, 6);
+    f.seq = 1;
+    f.tx = 0;
+    f.rx = 0;
+    now += 1000;
+    reassembly.add(f, now, [this](std::vector<csi_instance> &g, bool complete){ record(g, complete); });
+  }
+  timeout();
+  out.clear();
+  //transmitter 1 was forgotten, so its next measurement waits for the timeout again
+  add_measurement(1, 11, four_chains);
+  EXPECT_TRUE(out.empty());
+  timeout();
+  ASSERT_EQ(1u, out.size());
+  EXPECT_TRUE(out[0].complete);
+}
+
+TEST_F(reassembly_test, full_table_emits_the_oldest_group){
+  csi_reassembler small(2, TIMEOUT_NS);
+  std::vector<uint16_t> seqs;
+  auto emit = [&](std::vector<csi_instance> &g, bool complete){ seqs.push_back(g[0].seq); };
+  //a transmitter each, so none of them is known to be complete
+  for(uint16_t seq = 0; seq < 3; ++seq){
+    csi_instance f;
+    memset(f.source_mac, 0, 6);
+    f.source_mac[0] = 0x02;
+    f.source_mac[5] = seq + 1;
+    f.seq = seq;
+    f.tx = 0;
+    f.rx = 0;
+    small.add(f, 1000 + seq, emit);
+  }
+  ASSERT_EQ(1u, seqs.size());
+  EXPECT_EQ(0, seqs[0]);
+  EXPECT_EQ(2u, small.in_flight());
+  small.flush(emit);
+  EXPECT_EQ(3u, seqs.size());
+}
+
+int main(int argc, char** argv){
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}